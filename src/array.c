@@ -1,4 +1,5 @@
 #include "array.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -7,32 +8,50 @@
 #define ARRAY_OCCUPIED(array) (ARRAY_RAW_DATA(array)[1])
 
 void *array_hold(void *array, int count, int item_size) {
+    // sizes in size_t, arrays past 2 GB overflow an int
     if (array == NULL) {
-        int raw_size = (sizeof(int) * 2) + (item_size * count);
+        size_t raw_size = sizeof(int) * 2 + (size_t)item_size * count;
         int *base = (int *)malloc(raw_size);
+        if (base == NULL) {
+            return NULL;
+        }
         base[0] = count; // capacity
         base[1] = count; // occupied
         return base + 2;
-    } else if (ARRAY_OCCUPIED(array) + count <= ARRAY_CAPACITY(array)) {
+    } else if (ARRAY_OCCUPIED(array) + (long long)count <= ARRAY_CAPACITY(array)) {
         ARRAY_OCCUPIED(array) += count;
         return array;
     } else {
-        int needed_size = ARRAY_OCCUPIED(array) + count;
-        int double_curr = ARRAY_CAPACITY(array) * 2;
-        int capacity = needed_size > double_curr ? needed_size : double_curr;
-        int occupied = needed_size;
-        int raw_size = sizeof(int) * 2 + item_size * capacity;
+        long long needed_size = ARRAY_OCCUPIED(array) + (long long)count;
+        long long double_curr = ARRAY_CAPACITY(array) * 2LL;
+        long long capacity = needed_size > double_curr ? needed_size : double_curr;
+        if (needed_size > INT_MAX) {
+            return NULL;
+        }
+        if (capacity > INT_MAX) {
+            capacity = INT_MAX;
+        }
+        size_t raw_size = sizeof(int) * 2 + (size_t)item_size * (size_t)capacity;
         int *base = (int *)realloc(ARRAY_RAW_DATA(array), raw_size);
-        base[0] = capacity;
-        base[1] = occupied;
+        if (base == NULL) {
+            return NULL;
+        }
+        base[0] = (int)capacity;
+        base[1] = (int)needed_size;
         return base + 2;
     }
 }
 
+void array_truncate(void *array, int length) {
+    if (array != NULL && length < ARRAY_OCCUPIED(array)) {
+        ARRAY_OCCUPIED(array) = length;
+    }
+}
+
 int array_length(void *array) { return (array != NULL) ? ARRAY_OCCUPIED(array) : 0; }
 
 void array_free(void *array) {
     if (array != NULL) {
         free(ARRAY_RAW_DATA(array));
     }
-}
\ No newline at end of file
+}
@@ -1,14 +1,24 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+// Append value, or leave the array as it was if there is no memory for it
 #define array_push(array, value)                                                    \
     do {                                                                            \
-        (array) = array_hold((array), 1, sizeof(*(array)));                         \
-        (array)[array_length(array) - 1] = (value);                                 \
+        void *held_ = array_hold((array), 1, sizeof(*(array)));                     \
+        if (held_ != NULL) {                                                        \
+            (array) = held_;                                                        \
+            (array)[array_length(array) - 1] = (value);                             \
+        }                                                                           \
     } while (0);
 
+// Make room for count more items at the end of the array, or a new one if
+// NULL. Returns NULL if out of memory, leaving the array as it was
 void *array_hold(void *array, int count, int item_size);
+
+// Drop the items from length on
+void array_truncate(void *array, int length);
+
 int array_length(void *array);
 void array_free(void *array);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,282 @@
+#include "batch.h"
+#include "array.h"
+#include "image.h"
+#include "renderer.h"
+#include "scene.h"
+#include "stats.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BATCH_MAX_THREADS 64
+
+// How much room the turntable camera leaves around the mesh
+#define TURNTABLE_MARGIN 1.1f
+
+// What the workers share. Frames are handed out one at a time, so a worker
+// that drew quick frames just takes more of them
+typedef struct {
+    const batch_options_t *options;
+    const scene_t *scene;
+    vec3_t turntable_position; // of the camera
+
+    pthread_mutex_t mutex;
+    int next_frame;
+    bool failed;
+
+    float *frame_ms; // time each frame took, from first_frame on
+    png_options_t png;
+} batch_t;
+
+static int compare_keys(const void *a, const void *b) {
+    return ((const camera_key_t *)a)->frame - ((const camera_key_t *)b)->frame;
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+bool batch_load_path(const char *filename, camera_key_t **path) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error opening %s. \n", filename);
+        return false;
+    }
+
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        const char *start = line + strspn(line, " \t\r\n");
+        if (*start == '#' || *start == '\0') {
+            continue;
+        }
+
+        camera_key_t key;
+        float yaw_degrees;
+        if (sscanf(start, "%d %f %f %f %f", &key.frame, &key.position.x, &key.position.y,
+                   &key.position.z, &yaw_degrees) != 5) {
+            fprintf(stderr, "Malformed camera key on line %d of %s. \n", line_number,
+                    filename);
+            ok = false;
+            break;
+        }
+        key.yaw_angle = yaw_degrees * (float)M_PI / 180;
+        int num_keys = array_length(*path);
+        array_push(*path, key);
+        if (array_length(*path) == num_keys) {
+            fprintf(stderr, "Error allocating memory for the keys of %s. \n", filename);
+            ok = false;
+        }
+    }
+    fclose(file);
+
+    if (array_length(*path) > 0) {
+        qsort(*path, array_length(*path), sizeof(camera_key_t), compare_keys);
+    }
+    return ok;
+}
+
+// Where the flight path has the camera at a frame, holding still before the
+// first key and after the last
+static camera_key_t camera_at(const camera_key_t *path, int frame) {
+    int num_keys = array_length((void *)path);
+    if (frame <= path[0].frame) {
+        return path[0];
+    }
+    if (frame >= path[num_keys - 1].frame) {
+        return path[num_keys - 1];
+    }
+
+    int k = 0;
+    while (path[k + 1].frame <= frame) {
+        k++;
+    }
+    const camera_key_t *a = &path[k];
+    const camera_key_t *b = &path[k + 1];
+    float t = (float)(frame - a->frame) / (b->frame - a->frame);
+
+    camera_key_t key = {.frame = frame};
+    key.position = vec3_add(a->position, vec3_mul(vec3_sub(b->position, a->position), t));
+    key.yaw_angle = a->yaw_angle + (b->yaw_angle - a->yaw_angle) * t;
+    return key;
+}
+
+// Set the camera and the worker's copy of the instance up for a frame
+static void pose_frame(const batch_t *batch, renderer_t *renderer,
+                       scene_instance_t *instance, int frame) {
+    const batch_options_t *options = batch->options;
+    if (array_length(options->path) > 0) {
+        camera_key_t key = camera_at(options->path, frame);
+        renderer_set_camera(renderer, key.position, key.yaw_angle);
+        return;
+    }
+
+    int turn_frame = frame % BATCH_TURNTABLE_FRAMES;
+    if (turn_frame < 0) {
+        turn_frame += BATCH_TURNTABLE_FRAMES;
+    }
+    instance->rotation.y = 2 * (float)M_PI * turn_frame / BATCH_TURNTABLE_FRAMES;
+    renderer_set_camera(renderer, batch->turntable_position, 0);
+}
+
+static void *batch_worker(void *arg) {
+    batch_t *batch = arg;
+    const batch_options_t *options = batch->options;
+
+    // The mesh and texture are shared, the instance is posed per frame so
+    // each worker has its own
+    scene_t scene = {.meshes = batch->scene->meshes, .materials = batch->scene->materials};
+    array_push(scene.instances, batch->scene->instances[0]);
+
+    renderer_t *renderer = malloc(sizeof(renderer_t));
+    if (!renderer || array_length(scene.instances) == 0 ||
+        !renderer_init(renderer, options->width, options->height, &scene)) {
+        free(renderer);
+        array_free(scene.instances);
+        pthread_mutex_lock(&batch->mutex);
+        batch->failed = true;
+        pthread_mutex_unlock(&batch->mutex);
+        return NULL;
+    }
+    renderer->render_method = options->render_method;
+
+    for (;;) {
+        pthread_mutex_lock(&batch->mutex);
+        int frame = batch->failed ? options->last_frame + 1 : batch->next_frame++;
+        pthread_mutex_unlock(&batch->mutex);
+        if (frame > options->last_frame) {
+            break;
+        }
+
+        double start = stats_now_ms();
+        pose_frame(batch, renderer, &scene.instances[0], frame);
+        renderer_forget_frames(renderer);
+        renderer_render_frame(renderer);
+
+        bool ok = true;
+        if (options->output) {
+            char filename[1024];
+            ok = image_pattern_filename(filename, sizeof(filename), options->output, frame);
+            if (!ok) {
+                fprintf(stderr, "Error writing frame %d: its file name is too long. \n",
+                        frame);
+            }
+            ok = ok && image_write(filename, renderer->color_buffer, renderer->render_width,
+                                   renderer->render_height, &batch->png);
+        }
+        batch->frame_ms[frame - options->first_frame] = stats_now_ms() - start;
+
+        if (!ok) {
+            pthread_mutex_lock(&batch->mutex);
+            batch->failed = true;
+            pthread_mutex_unlock(&batch->mutex);
+        }
+    }
+
+    renderer_destroy(renderer);
+    free(renderer);
+    array_free(scene.instances);
+    return NULL;
+}
+
+// The time under which a share p of the frames took, by nearest rank
+static float percentile(const float *sorted, int count, float p) {
+    int rank = (int)ceilf(p * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+bool batch_render(const batch_options_t *options) {
+    int num_frames = options->last_frame - options->first_frame + 1;
+    if (num_frames <= 0) {
+        fprintf(stderr, "No frames to render. \n");
+        return false;
+    }
+    if (options->output && !image_pattern_valid(options->output)) {
+        fprintf(stderr, "Error rendering to %s: expected one %%d for the frame number. \n",
+                options->output);
+        return false;
+    }
+
+    scene_t scene = {0};
+    int mesh = scene_add_mesh(&scene, options->mesh);
+    int material = options->texture ? scene_add_material(&scene, options->texture) : -1;
+    if (mesh < 0 || (options->texture && material < 0) ||
+        scene_add_instance(&scene, mesh, material, (vec3_t){0, 0, 0}) < 0) {
+        free_scene(&scene);
+        return false;
+    }
+
+    // Back the turntable camera off far enough for the mesh to stay in view
+    // whichever way it turns about its origin, given the 60 degree field of view
+    const mesh_t *model = &scene.meshes[mesh];
+    vec3_t center = vec3_div(vec3_add(model->bounds_min, model->bounds_max), 2);
+    float radius = vec3_length(center) +
+                   vec3_length(vec3_sub(model->bounds_max, model->bounds_min)) / 2;
+    float distance = radius / sinf((float)M_PI / 6) * TURNTABLE_MARGIN;
+
+    batch_t batch = {.options = options,
+                     .scene = &scene,
+                     .turntable_position = {0, center.y, -distance},
+                     .next_frame = options->first_frame};
+    batch.frame_ms = calloc(num_frames, sizeof(float));
+    if (!batch.frame_ms) {
+        free_scene(&scene);
+        return false;
+    }
+    pthread_mutex_init(&batch.mutex, NULL);
+
+    int num_threads = options->num_threads;
+    if (num_threads <= 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = num_cpus > 0 ? (int)num_cpus : 1;
+    }
+    if (num_threads > num_frames) {
+        num_threads = num_frames;
+    }
+    if (num_threads > BATCH_MAX_THREADS) {
+        num_threads = BATCH_MAX_THREADS;
+    }
+    // frames are already written in parallel, one per thread
+    batch.png = options->png;
+    if (num_threads > 1) {
+        batch.png.num_threads = 1;
+    }
+
+    double start = stats_now_ms();
+    pthread_t threads[BATCH_MAX_THREADS];
+    int num_started = 0;
+    while (num_started < num_threads &&
+           pthread_create(&threads[num_started], NULL, batch_worker, &batch) == 0) {
+        num_started++;
+    }
+    if (num_started == 0) {
+        batch_worker(&batch);
+    }
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = stats_now_ms() - start;
+
+    if (!batch.failed) {
+        qsort(batch.frame_ms, num_frames, sizeof(float), compare_floats);
+        printf("Rendered %d frames of %dx%d on %d threads in %.1f ms: %.1f fps\n",
+               num_frames, options->width, options->height,
+               num_started > 0 ? num_started : 1, elapsed, num_frames * 1000.0 / elapsed);
+        printf("    frame time: %.2f ms median, %.2f ms p90, %.2f ms p99, %.2f ms max\n",
+               percentile(batch.frame_ms, num_frames, 0.5f),
+               percentile(batch.frame_ms, num_frames, 0.9f),
+               percentile(batch.frame_ms, num_frames, 0.99f), batch.frame_ms[num_frames - 1]);
+    }
+
+    bool ok = !batch.failed;
+    pthread_mutex_destroy(&batch.mutex);
+    free(batch.frame_ms);
+    free_scene(&scene);
+    return ok;
+}
@@ -0,0 +1,59 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "draw.h"
+#include "png_write.h"
+#include "vector.h"
+#include <stdbool.h>
+
+// Turntables spin the mesh a full turn in this many frames
+#define BATCH_TURNTABLE_FRAMES 360
+
+// Where the camera is at a frame of a flight path. In between keys it moves
+// in a straight line and turns evenly
+typedef struct {
+    int frame;
+    vec3_t position;
+    float yaw_angle; // in radians
+} camera_key_t;
+
+typedef struct {
+    const char *mesh;    // OBJ file
+    const char *texture; // PNG file, or NULL for none
+    int width;
+    int height;
+    int first_frame;
+    int last_frame; // rendered too
+    enum render_method render_method;
+
+    // Keys of the camera's flight path, in frame order, as a dynamic array.
+    // Without any, the mesh spins on a turntable in front of the camera
+    camera_key_t *path;
+
+    int num_threads; // 0 for one per CPU
+
+    // Pattern of the file each frame is written to, with one %d for the frame
+    // number (see image_pattern_valid), ending in .ppm or .png; NULL to write
+    // none
+    const char *output;
+    // How .png frames are written. When frames are written on several threads
+    // at once, each file is written on one
+    png_options_t png;
+} batch_options_t;
+
+// Read a flight path, a key per line of the frame number, the camera
+// position and its yaw in degrees, into a dynamic array sorted by frame.
+// Lines starting with # are skipped. Returns false if the file couldn't be
+// read or had a malformed line
+bool batch_load_path(const char *filename, camera_key_t **path);
+
+// Render the frames of an animation of the mesh, spread over threads that each
+// draw whole frames with a renderer of their own, sharing the mesh and
+// texture. Each frame depends only on its number, so they come out the same
+// however many threads draw them. Prints the frames per second and the
+// percentiles of the time a frame took. Returns false if the mesh or texture
+// couldn't be loaded, the output pattern is invalid or a frame couldn't be
+// written
+bool batch_render(const batch_options_t *options);
+
+#endif
@@ -0,0 +1,398 @@
+#include "bench.h"
+#include "array.h"
+#include "file.h"
+#include "mesh.h"
+#include "meshlet.h"
+#include "obj.h"
+#include "png_write.h"
+#include "renderer.h"
+#include "scene.h"
+#include "stats.h"
+#include "texture.h"
+#include "upng.h"
+#include "vcache.h"
+#include "weld.h"
+#include <dirent.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_MIN_TIME_MS 200.0
+
+// Sample a square of texels rotated by angle around the texture center, one
+// texel per pixel, walking it in scanline order like the rasterizer does.
+// Returns the number of texels fetched per second
+static double bench_texel_fetch(const mip_level_t *level, float angle,
+                                uint32_t *checksum) {
+    // keep the rotated square inside the texture so no wrapping is needed
+    int size = (int)((level->width < level->height ? level->width : level->height) *
+                     0.7f);
+    float du_dx = cosf(angle), dv_dx = sinf(angle);
+    float du_dy = -sinf(angle), dv_dy = cosf(angle);
+    float u_start = level->width / 2.0f - (du_dx + du_dy) * size / 2.0f;
+    float v_start = level->height / 2.0f - (dv_dx + dv_dy) * size / 2.0f;
+
+    long long num_fetches = 0;
+    double start = stats_now_ms();
+    double elapsed = 0;
+    uint32_t sum = 0;
+
+    while (elapsed < BENCH_MIN_TIME_MS) {
+        for (int y = 0; y < size; y++) {
+            float u = u_start + du_dy * y;
+            float v = v_start + dv_dy * y;
+            for (int x = 0; x < size; x++) {
+                sum += level->texels[texture_texel_index(level, (int)u, (int)v)];
+                u += du_dx;
+                v += dv_dx;
+            }
+        }
+        num_fetches += (long long)size * size;
+        elapsed = stats_now_ms() - start;
+    }
+
+    *checksum += sum;
+    return num_fetches / (elapsed / 1000.0);
+}
+
+// Compare texel fetch throughput of the linear and tiled layouts for
+// triangles at different orientations in texture space
+int bench_texture_layout(const char *filename) {
+    texture_t linear, tiled;
+    if (!load_texture(&linear, filename, TEXTURE_LAYOUT_LINEAR) ||
+        !load_texture(&tiled, filename, TEXTURE_LAYOUT_TILED)) {
+        fprintf(stderr, "Error loading texture %s. \n", filename);
+        return 1;
+    }
+
+    printf("texel fetch throughput for %s (%dx%d)\n", filename,
+           linear.levels[0].width, linear.levels[0].height);
+    printf("%8s %16s %16s %8s\n", "angle", "linear Mtex/s", "tiled Mtex/s",
+           "speedup");
+
+    const int angles[] = {0, 30, 45, 60, 90};
+    uint32_t checksum = 0;
+    for (int i = 0; i < (int)(sizeof(angles) / sizeof(angles[0])); i++) {
+        float angle = angles[i] * (float)M_PI / 180.0f;
+        double linear_rate = bench_texel_fetch(&linear.levels[0], angle, &checksum);
+        double tiled_rate = bench_texel_fetch(&tiled.levels[0], angle, &checksum);
+        printf("%8d %16.1f %16.1f %7.2fx\n", angles[i], linear_rate / 1e6,
+               tiled_rate / 1e6, tiled_rate / linear_rate);
+    }
+    // printed so the fetches can't be optimized away
+    printf("checksum %08x\n", checksum);
+
+    free_texture(&linear);
+    free_texture(&tiled);
+    return 0;
+}
+
+// Read a whole file into memory, so decoding can be timed without the disk
+static unsigned char *bench_read_file(const char *path, long *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+
+    unsigned char *buffer = malloc(*size);
+    if (buffer != NULL && fread(buffer, 1, *size, file) != (size_t)*size) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+    return buffer;
+}
+
+static bool has_extension(const char *name, const char *extension) {
+    size_t length = strlen(name), extension_length = strlen(extension);
+    return length > extension_length &&
+           strcmp(name + length - extension_length, extension) == 0;
+}
+
+static bool is_png_file(const char *name) { return has_extension(name, ".png"); }
+
+static const char *SIMD_NAMES[] = {"none", "SSE2", "SSSE3"};
+
+// Decode a PNG file held in memory over and over with the given vector
+// instructions. Returns the number of decodes per second, 0 on error
+static double bench_decode(const unsigned char *data, long size, upng_simd *simd,
+                           unsigned *decoded_size, uint32_t *checksum) {
+    long num_decodes = 0;
+    double start = stats_now_ms();
+    double elapsed = 0;
+
+    while (elapsed < BENCH_MIN_TIME_MS) {
+        upng_t *png = upng_new_from_bytes(data, size);
+        if (png == NULL) {
+            return 0;
+        }
+        upng_set_simd(png, *simd);
+        *simd = upng_get_simd(png); // lowered to what the CPU supports
+        if (upng_decode(png) != UPNG_EOK) {
+            upng_free(png);
+            return 0;
+        }
+        *decoded_size = upng_get_size(png);
+        *checksum += upng_get_buffer(png)[*decoded_size / 2];
+        upng_free(png);
+        num_decodes++;
+        elapsed = stats_now_ms() - start;
+    }
+    return num_decodes / (elapsed / 1000.0);
+}
+
+// Decode every PNG file in dir from memory, repeatedly, and report the decode
+// throughput in MB/s of compressed input and of decoded pixels, with the
+// scanline filters undone by the vector code and by the scalar code
+int bench_png_decode(const char *dir) {
+    DIR *handle = opendir(dir);
+    if (handle == NULL) {
+        fprintf(stderr, "Error opening directory %s. \n", dir);
+        return 1;
+    }
+
+    printf("PNG decode throughput for %s\n", dir);
+    printf("%-20s %10s %10s %12s %12s %12s\n", "file", "size KB", "pixels KB",
+           "input MB/s", "output MB/s", "scalar MB/s");
+
+    upng_simd simd = UPNG_SIMD_SSSE3, scalar = UPNG_SIMD_NONE;
+    double total_in = 0, total_out = 0, total_time = 0, total_scalar_time = 0;
+    uint32_t checksum = 0;
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (!is_png_file(entry->d_name)) {
+            continue;
+        }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        long size;
+        unsigned char *data = bench_read_file(path, &size);
+        if (data == NULL) {
+            fprintf(stderr, "Error reading %s. \n", path);
+            continue;
+        }
+
+        unsigned decoded_size = 0;
+        double rate = bench_decode(data, size, &simd, &decoded_size, &checksum);
+        double scalar_rate =
+            bench_decode(data, size, &scalar, &decoded_size, &checksum);
+        free(data);
+        if (rate == 0 || scalar_rate == 0) {
+            fprintf(stderr, "Error decoding %s. \n", path);
+            continue;
+        }
+
+        printf("%-20s %10.1f %10.1f %12.1f %12.1f %12.1f\n", entry->d_name,
+               size / 1024.0, decoded_size / 1024.0, size * rate / 1e6,
+               decoded_size * rate / 1e6, decoded_size * scalar_rate / 1e6);
+
+        // totals weigh every file by its size, as if each was decoded once
+        total_in += size;
+        total_out += decoded_size;
+        total_time += 1.0 / rate;
+        total_scalar_time += 1.0 / scalar_rate;
+    }
+    closedir(handle);
+
+    if (total_time > 0) {
+        printf("%-20s %10.1f %10.1f %12.1f %12.1f %12.1f\n", "total", total_in / 1024.0,
+               total_out / 1024.0, total_in / 1e6 / total_time,
+               total_out / 1e6 / total_time, total_out / 1e6 / total_scalar_time);
+    }
+    printf("vector instructions: %s\n", SIMD_NAMES[simd]);
+    // printed so the decodes can't be optimized away
+    printf("checksum %08x\n", checksum);
+    return 0;
+}
+
+static uint32_t hash_bytes(const void *data, size_t size, uint32_t hash) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Parse an OBJ file with 1, 2, 4, ... threads and report the parse
+// throughput, checking that every thread count gives the same mesh
+int bench_obj_load(const char *filename) {
+    file_source_t file;
+    if (!file_source_open(&file, filename)) {
+        fprintf(stderr, "Error loading mesh %s. \n", filename);
+        return 1;
+    }
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = num_cpus > 4 ? (int)num_cpus : 4;
+    int saved_threads = obj_threads;
+    uint32_t serial_hash = 0;
+
+    printf("OBJ parse throughput for %s (%.1f MB, %ld CPUs)\n", filename,
+           file.size / 1e6, num_cpus);
+    printf("%8s %10s %10s %10s\n", "threads", "ms", "MB/s", "mesh");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        obj_threads = threads;
+        double best = 0;
+        uint32_t hash = 0;
+        double start = stats_now_ms();
+        while (stats_now_ms() - start < BENCH_MIN_TIME_MS * 5) {
+            mesh_t parsed = {.vertices = NULL, .faces = NULL};
+            double parse_start = stats_now_ms();
+            obj_parse(&parsed, (const char *)file.data, file.size);
+            double elapsed = stats_now_ms() - parse_start;
+            best = best == 0 || elapsed < best ? elapsed : best;
+
+            hash = hash_bytes(parsed.vertices,
+                              sizeof(vec3_t) * array_length(parsed.vertices), 2166136261u);
+            hash = hash_bytes(parsed.faces, sizeof(face_t) * array_length(parsed.faces),
+                              hash);
+            array_free(parsed.vertices);
+            array_free(parsed.faces);
+        }
+        if (threads == 1) {
+            serial_hash = hash;
+        }
+        printf("%8d %10.2f %10.1f %10s\n", threads, best, file.size / 1e6 / (best / 1000.0),
+               hash == serial_hash ? "same" : "DIFFERS");
+    }
+
+    obj_threads = saved_threads;
+    file_source_close(&file);
+    return 0;
+}
+
+// Weld every OBJ file in dir and report its vertex cache miss ratio before
+// and after the faces are reordered for the cache, across the whole mesh and
+// within meshlets as the loader does
+int bench_vertex_cache(const char *dir) {
+    DIR *handle = opendir(dir);
+    if (handle == NULL) {
+        fprintf(stderr, "Error opening directory %s. \n", dir);
+        return 1;
+    }
+
+    printf("Vertex cache miss ratio for %s, %d entry LRU cache\n", dir, VCACHE_SIZE);
+    printf("%-20s %10s %10s %10s %10s %10s %10s\n", "file", "faces", "vertices", "ACMR",
+           "reordered", "ms", "meshlets");
+
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (!has_extension(entry->d_name, ".obj")) {
+            continue;
+        }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        file_source_t file;
+        if (!file_source_open(&file, path)) {
+            fprintf(stderr, "Error loading mesh %s. \n", path);
+            continue;
+        }
+
+        mesh_t parsed = {.vertices = NULL, .faces = NULL};
+        obj_parse(&parsed, (const char *)file.data, file.size);
+        file_source_close(&file);
+
+        if (weld_mesh(&parsed)) {
+            float before = vcache_acmr(&parsed, VCACHE_SIZE);
+            double start = stats_now_ms();
+            if (!vcache_optimize(&parsed)) {
+                fprintf(stderr, "Error reordering mesh %s. \n", path);
+                free_mesh(&parsed);
+                continue;
+            }
+            double elapsed = stats_now_ms() - start;
+            float after = vcache_acmr(&parsed, VCACHE_SIZE);
+
+            // as loaded, with faces only reordered within their meshlets
+            if (!build_meshlets(&parsed) || !vcache_optimize(&parsed)) {
+                fprintf(stderr, "Error splitting mesh %s into meshlets. \n", path);
+                free_mesh(&parsed);
+                continue;
+            }
+            printf("%-20s %10d %10d %10.3f %10.3f %10.2f %10.3f\n", entry->d_name,
+                   array_length(parsed.faces), array_length(parsed.vertex_buffer), before,
+                   after, elapsed, vcache_acmr(&parsed, VCACHE_SIZE));
+        }
+        free_mesh(&parsed);
+    }
+    closedir(handle);
+    return 0;
+}
+
+// Render a 4K frame of a crowd and write it to filename as a PNG, stored and
+// fast compressed, with 1, 2, 4, ... threads. Reports the write throughput
+// and file size, checking that every thread count writes the same file
+int bench_png_write(const char *filename) {
+    scene_t scene = {0};
+    renderer_t *renderer = malloc(sizeof(renderer_t));
+    if (!renderer || !scene_add_crowd(&scene, 64) ||
+        !renderer_init(renderer, 3840, 2160, &scene)) {
+        free(renderer);
+        free_scene(&scene);
+        return 1;
+    }
+    renderer->render_method = RENDER_TEXTURED;
+    renderer_render_frame(renderer);
+    double raw_mb = renderer->width * renderer->height * 3 / 1e6;
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = num_cpus > 4 ? (int)num_cpus : 4;
+    static const enum png_compression LEVELS[] = {PNG_STORE, PNG_FAST};
+    static const char *LEVEL_NAMES[] = {"store", "fast"};
+
+    printf("PNG write throughput for a %dx%d frame (%.1f MB of RGB, %ld CPUs)\n",
+           renderer->width, renderer->height, raw_mb, num_cpus);
+    printf("%8s %8s %10s %10s %10s %10s\n", "level", "threads", "ms", "MB/s", "file MB",
+           "file");
+
+    int status = 0;
+    for (int level = 0; level < 2 && status == 0; level++) {
+        png_options_t png = {.compression = LEVELS[level]};
+        uint32_t serial_hash = 0;
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            png.num_threads = threads;
+            double best = 0;
+            double start = stats_now_ms();
+            while (stats_now_ms() - start < BENCH_MIN_TIME_MS * 5) {
+                double write_start = stats_now_ms();
+                if (!png_write(filename, renderer->color_buffer, renderer->width,
+                               renderer->height, &png)) {
+                    status = 1;
+                    break;
+                }
+                double elapsed = stats_now_ms() - write_start;
+                best = best == 0 || elapsed < best ? elapsed : best;
+            }
+
+            long size = 0;
+            unsigned char *data = status == 0 ? bench_read_file(filename, &size) : NULL;
+            if (!data) {
+                status = 1;
+                break;
+            }
+            uint32_t hash = hash_bytes(data, size, 2166136261u);
+            free(data);
+            if (threads == 1) {
+                serial_hash = hash;
+            }
+            printf("%8s %8d %10.2f %10.1f %10.2f %10s\n", LEVEL_NAMES[level], threads,
+                   best, raw_mb / (best / 1000.0), size / 1e6,
+                   hash == serial_hash ? "same" : "DIFFERS");
+        }
+    }
+
+    remove(filename);
+    renderer_destroy(renderer);
+    free(renderer);
+    free_scene(&scene);
+    return status;
+}
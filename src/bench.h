@@ -0,0 +1,10 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+int bench_texture_layout(const char *filename);
+int bench_png_decode(const char *dir);
+int bench_obj_load(const char *filename);
+int bench_vertex_cache(const char *dir);
+int bench_png_write(const char *filename);
+
+#endif
@@ -0,0 +1,240 @@
+#include "bvh.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every plane, as a mask of the planes a node still has to be tested against
+#define ALL_PLANES ((1 << NUM_PLANES) - 1)
+
+static float box_area(vec3_t min, vec3_t max) {
+    vec3_t size = vec3_sub(max, min);
+    return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static float axis_value(vec3_t v, int axis) {
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+// Fit a node's box around its instances, or around its children for an inner
+// node. Returns whether the box changed
+static bool fit_node(bvh_t *bvh, int index) {
+    bvh_node_t *node = &bvh->nodes[index];
+    vec3_t min, max;
+    if (node->right < 0) {
+        min = (vec3_t){INFINITY, INFINITY, INFINITY};
+        max = (vec3_t){-INFINITY, -INFINITY, -INFINITY};
+        for (int i = node->first; i < node->first + node->count; i++) {
+            const bvh_sphere_t *sphere = &bvh->bounds[bvh->items[i]];
+            min.x = fminf(min.x, sphere->center.x - sphere->radius);
+            min.y = fminf(min.y, sphere->center.y - sphere->radius);
+            min.z = fminf(min.z, sphere->center.z - sphere->radius);
+            max.x = fmaxf(max.x, sphere->center.x + sphere->radius);
+            max.y = fmaxf(max.y, sphere->center.y + sphere->radius);
+            max.z = fmaxf(max.z, sphere->center.z + sphere->radius);
+        }
+    } else {
+        const bvh_node_t *left = &bvh->nodes[index + 1];
+        const bvh_node_t *right = &bvh->nodes[node->right];
+        min = (vec3_t){fminf(left->min.x, right->min.x), fminf(left->min.y, right->min.y),
+                       fminf(left->min.z, right->min.z)};
+        max = (vec3_t){fmaxf(left->max.x, right->max.x), fmaxf(left->max.y, right->max.y),
+                       fmaxf(left->max.z, right->max.z)};
+    }
+
+    if (memcmp(&min, &node->min, sizeof(min)) == 0 &&
+        memcmp(&max, &node->max, sizeof(max)) == 0) {
+        return false;
+    }
+    bvh->area += box_area(min, max) - box_area(node->min, node->max);
+    node->min = min;
+    node->max = max;
+    return true;
+}
+
+// Build the subtree over items[first] up to first + count, splitting at the
+// middle of the centers' extent along its longest axis. Returns its root
+static int build_node(bvh_t *bvh, int parent, int first, int count, int depth) {
+    int index = bvh->num_nodes++;
+    bvh_node_t *node = &bvh->nodes[index];
+    *node = (bvh_node_t){.parent = parent, .right = -1, .first = first, .count = count};
+
+    if (count <= BVH_LEAF_SIZE) {
+        for (int i = first; i < first + count; i++) {
+            bvh->leaf_of[bvh->items[i]] = index;
+        }
+        return index;
+    }
+
+    vec3_t min = bvh->bounds[bvh->items[first]].center, max = min;
+    for (int i = first + 1; i < first + count; i++) {
+        vec3_t center = bvh->bounds[bvh->items[i]].center;
+        min.x = fminf(min.x, center.x);
+        min.y = fminf(min.y, center.y);
+        min.z = fminf(min.z, center.z);
+        max.x = fmaxf(max.x, center.x);
+        max.y = fmaxf(max.y, center.y);
+        max.z = fmaxf(max.z, center.z);
+    }
+    vec3_t size = vec3_sub(max, min);
+    int axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+    float middle = axis_value(min, axis) + axis_value(size, axis) / 2;
+
+    int split = first;
+    if (depth < BVH_MAX_DEPTH) {
+        for (int i = first; i < first + count; i++) {
+            if (axis_value(bvh->bounds[bvh->items[i]].center, axis) < middle) {
+                int item = bvh->items[i];
+                bvh->items[i] = bvh->items[split];
+                bvh->items[split++] = item;
+            }
+        }
+    }
+    // all the centers on one side, or too deep: split in two halves
+    if (split == first || split == first + count) {
+        split = first + count / 2;
+    }
+
+    build_node(bvh, index, first, split - first, depth + 1);
+    int right = build_node(bvh, index, split, first + count - split, depth + 1);
+    bvh->nodes[index].right = right;
+    return index;
+}
+
+static bool rebuild(bvh_t *bvh, const bvh_sphere_t *bounds, int count) {
+    free_bvh(bvh);
+    if (count == 0) {
+        return true;
+    }
+
+    // a binary tree with a leaf per instance at most
+    bvh->nodes = malloc(2 * count * sizeof(bvh_node_t));
+    bvh->items = malloc(count * sizeof(int));
+    bvh->leaf_of = malloc(count * sizeof(int));
+    bvh->bounds = malloc(count * sizeof(bvh_sphere_t));
+    if (!bvh->nodes || !bvh->items || !bvh->leaf_of || !bvh->bounds) {
+        free_bvh(bvh);
+        return false;
+    }
+
+    memcpy(bvh->bounds, bounds, count * sizeof(bvh_sphere_t));
+    for (int i = 0; i < count; i++) {
+        bvh->items[i] = i;
+    }
+    bvh->num_items = count;
+    build_node(bvh, -1, 0, count, 0);
+
+    // children follow their parent, so fitting backwards fits them first
+    for (int i = bvh->num_nodes - 1; i >= 0; i--) {
+        fit_node(bvh, i);
+    }
+    bvh->built_area = bvh->area;
+    return true;
+}
+
+bool bvh_update(bvh_t *bvh, const bvh_sphere_t *bounds, int count) {
+    if (count != bvh->num_items || !bvh->nodes) {
+        return rebuild(bvh, bounds, count);
+    }
+
+    // refit the leaf of each instance that moved, then its ancestors for as
+    // long as their boxes change
+    for (int i = 0; i < count; i++) {
+        if (memcmp(&bvh->bounds[i], &bounds[i], sizeof(bvh_sphere_t)) == 0) {
+            continue;
+        }
+        bvh->bounds[i] = bounds[i];
+        for (int node = bvh->leaf_of[i]; node >= 0 && fit_node(bvh, node);
+             node = bvh->nodes[node].parent) {
+        }
+    }
+
+    if (bvh->area > bvh->built_area * BVH_REBUILD_RATIO) {
+        return rebuild(bvh, bounds, count);
+    }
+    return true;
+}
+
+int bvh_cull(const bvh_t *bvh, const plane_t planes[NUM_PLANES], int *visible,
+             int *num_visible) {
+    *num_visible = 0;
+    if (bvh->num_nodes == 0) {
+        return 0;
+    }
+
+    // nodes still to visit, each with the planes it may cross. Each level
+    // adds one node at most, and past BVH_MAX_DEPTH nodes halve their count
+    struct {
+        int node;
+        int planes;
+    } stack[BVH_MAX_DEPTH + 34];
+    int stack_size = 0;
+    stack[stack_size++].node = 0;
+    stack[0].planes = ALL_PLANES;
+    int visited = 0;
+
+    while (stack_size > 0) {
+        stack_size--;
+        int index = stack[stack_size].node;
+        int mask = stack[stack_size].planes;
+        const bvh_node_t *node = &bvh->nodes[index];
+        visited++;
+
+        // a box is outside a plane if even its corner farthest along the
+        // normal is, and inside it if even the nearest one is
+        vec3_t center = vec3_mul(vec3_add(node->min, node->max), 0.5f);
+        vec3_t extent = vec3_mul(vec3_sub(node->max, node->min), 0.5f);
+        bool outside = false;
+        for (int plane = 0; plane < NUM_PLANES && !outside; plane++) {
+            if (!(mask & (1 << plane))) {
+                continue;
+            }
+            vec3_t normal = planes[plane].normal;
+            float distance = vec3_dot(vec3_sub(center, planes[plane].point), normal);
+            float reach = extent.x * fabsf(normal.x) + extent.y * fabsf(normal.y) +
+                          extent.z * fabsf(normal.z);
+            if (distance < -reach) {
+                outside = true;
+            } else if (distance >= reach) {
+                mask &= ~(1 << plane);
+            }
+        }
+        if (outside) {
+            continue;
+        }
+
+        if (mask == 0) {
+            memcpy(&visible[*num_visible], &bvh->items[node->first],
+                   node->count * sizeof(int));
+            *num_visible += node->count;
+        } else if (node->right >= 0) {
+            stack[stack_size].node = node->right;
+            stack[stack_size++].planes = mask;
+            stack[stack_size].node = index + 1;
+            stack[stack_size++].planes = mask;
+        } else {
+            // a leaf across a plane: test its instances against the planes
+            // it crosses
+            for (int i = node->first; i < node->first + node->count; i++) {
+                const bvh_sphere_t *sphere = &bvh->bounds[bvh->items[i]];
+                bool inside = true;
+                for (int plane = 0; plane < NUM_PLANES && inside; plane++) {
+                    inside = !(mask & (1 << plane)) ||
+                             vec3_dot(vec3_sub(sphere->center, planes[plane].point),
+                                      planes[plane].normal) >= -sphere->radius;
+                }
+                if (inside) {
+                    visible[(*num_visible)++] = bvh->items[i];
+                }
+            }
+        }
+    }
+    return visited;
+}
+
+void free_bvh(bvh_t *bvh) {
+    free(bvh->nodes);
+    free(bvh->items);
+    free(bvh->leaf_of);
+    free(bvh->bounds);
+    memset(bvh, 0, sizeof(*bvh));
+}
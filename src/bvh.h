@@ -0,0 +1,61 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "clipping.h"
+#include "vector.h"
+#include <stdbool.h>
+
+// Instances per leaf, at most
+#define BVH_LEAF_SIZE 4
+
+// Deeper than this, nodes are split by count rather than space, so a tight
+// cluster of instances can't make the tree arbitrarily deep
+#define BVH_MAX_DEPTH 40
+
+// Refitting keeps the tree's topology, which gets looser as instances move
+// away from where they were built. Once the boxes add up to this much more
+// surface than when built, the tree is rebuilt instead
+#define BVH_REBUILD_RATIO 2.0f
+
+typedef struct {
+    vec3_t center;
+    float radius;
+} bvh_sphere_t;
+
+// Nodes are stored depth first, so the first child of an inner node follows
+// it, and the instances under any node are a run of items
+typedef struct {
+    vec3_t min;
+    vec3_t max;
+    int parent; // -1 for the root
+    int right;  // second child of an inner node, -1 for a leaf
+    int first;  // the node's instances are items[first] up to first + count
+    int count;
+} bvh_node_t;
+
+typedef struct {
+    bvh_node_t *nodes;
+    int num_nodes;
+    int *items;           // instance indices
+    int *leaf_of;         // leaf node of each instance
+    bvh_sphere_t *bounds; // of each instance, as of the last build or refit
+    int num_items;
+    float area;       // surface area of all the nodes' boxes
+    float built_area; // and as it was when the tree was built
+} bvh_t;
+
+// Bring the tree up to date with the world space bounds of count instances.
+// The tree is rebuilt if the number of instances changed or refitting has
+// let it grow too loose; otherwise only the boxes above the instances that
+// moved are refit. Returns false if out of memory
+bool bvh_update(bvh_t *bvh, const bvh_sphere_t *bounds, int count);
+
+// Write the instances whose spheres may reach inside the world space planes
+// to visible, walking down only the nodes that straddle a plane: those
+// inside every plane are taken whole. Returns the number of nodes visited
+int bvh_cull(const bvh_t *bvh, const plane_t planes[NUM_PLANES], int *visible,
+             int *num_visible);
+
+void free_bvh(bvh_t *bvh);
+
+#endif
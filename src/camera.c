@@ -1,6 +1,18 @@
 #include "camera.h"
+#include "matrix.h"
 
-camera_t camera = {.position = {0, 0, 0},
-                   .direction = {0, 0, 1},
-                   .forward_velocity = {0, 0, 0},
-                   .yaw_angle = 0.0};
\ No newline at end of file
+camera_t camera_new(void) {
+    camera_t camera = {.position = {0, 0, 0},
+                       .direction = {0, 0, 1},
+                       .forward_velocity = {0, 0, 0},
+                       .yaw_angle = 0.0};
+    return camera;
+}
+
+void camera_update_direction(camera_t *camera) {
+    vec3_t target = {0, 0, 1};
+
+    mat4_t camera_yaw_rotation = mat4_make_rotation_y(camera->yaw_angle);
+    camera->direction =
+        vec3_from_vec4(mat4_mul_vec4(camera_yaw_rotation, vec4_from_vec3(target)));
+}
@@ -10,6 +10,10 @@ typedef struct {
     float yaw_angle;
 } camera_t;
 
-extern camera_t camera;
+// A camera at the origin looking down +z
+camera_t camera_new(void);
 
-#endif
\ No newline at end of file
+// Point the camera's direction along its yaw angle
+void camera_update_direction(camera_t *camera);
+
+#endif
@@ -3,9 +3,6 @@
 #include "texture.h"
 #include "vector.h"
 
-#define NUM_PLANES 6
-plane_t frustum_planes[NUM_PLANES];
-
 ///////////////////////////////////////////////////////////////////////////////
 // Frustum planes are defined by a point and a normal vector
 ///////////////////////////////////////////////////////////////////////////////
@@ -28,7 +25,8 @@ plane_t frustum_planes[NUM_PLANES];
 //           \|/
 //
 ///////////////////////////////////////////////////////////////////////////////
-void init_frustum_planes(float fovx, float fovy, float z_near, float z_far) {
+void init_frustum_planes(plane_t frustum_planes[NUM_PLANES], float fovx, float fovy,
+                         float z_near, float z_far) {
     float cos_half_fovx = cos(fovx / 2);
     float sin_half_fovx = sin(fovx / 2);
     float cos_half_fovy = cos(fovy / 2);
@@ -74,7 +72,13 @@ polygon_t create_polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t t
 
 float float_lerp(float a, float b, float t) { return a + t * (b - a); }
 
-void clip_polygon_againt_plane(polygon_t *polygon, int plane) {
+void clip_polygon_againt_plane(polygon_t *polygon, const plane_t frustum_planes[NUM_PLANES],
+                               int plane) {
+    // nothing left after an earlier plane
+    if (polygon->num_vertices == 0) {
+        return;
+    }
+
     vec3_t plane_point = frustum_planes[plane].point;
     vec3_t plane_normal = frustum_planes[plane].normal;
 
@@ -137,13 +141,47 @@ void clip_polygon_againt_plane(polygon_t *polygon, int plane) {
     polygon->num_vertices = num_inside_vertices;
 }
 
-void clip_polygon(polygon_t *polygon) {
-    clip_polygon_againt_plane(polygon, LEFT_FRUSTUM_PLANE);
-    clip_polygon_againt_plane(polygon, RIGHT_FRUSTUM_PLANE);
-    clip_polygon_againt_plane(polygon, TOP_FRUSTUM_PLANE);
-    clip_polygon_againt_plane(polygon, BOTTOM_FRUSTUM_PLANE);
-    clip_polygon_againt_plane(polygon, FAR_FRUSTUM_PLANE);
-    clip_polygon_againt_plane(polygon, NEAR_FRUSTUM_PLANE);
+void clip_polygon(polygon_t *polygon, const plane_t frustum_planes[NUM_PLANES]) {
+    clip_polygon_againt_plane(polygon, frustum_planes, LEFT_FRUSTUM_PLANE);
+    clip_polygon_againt_plane(polygon, frustum_planes, RIGHT_FRUSTUM_PLANE);
+    clip_polygon_againt_plane(polygon, frustum_planes, TOP_FRUSTUM_PLANE);
+    clip_polygon_againt_plane(polygon, frustum_planes, BOTTOM_FRUSTUM_PLANE);
+    clip_polygon_againt_plane(polygon, frustum_planes, FAR_FRUSTUM_PLANE);
+    clip_polygon_againt_plane(polygon, frustum_planes, NEAR_FRUSTUM_PLANE);
+}
+
+bool sphere_outside_frustum(const plane_t frustum_planes[NUM_PLANES], vec3_t center,
+                            float radius) {
+    for (int plane = 0; plane < NUM_PLANES; plane++) {
+        vec3_t plane_point = frustum_planes[plane].point;
+        vec3_t plane_normal = frustum_planes[plane].normal;
+        if (vec3_dot(vec3_sub(center, plane_point), plane_normal) < -radius) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The inverse of the view matrix [R | t] is [R^T | -R^T t]
+static vec3_t view_to_world(mat4_t view_matrix, vec3_t v, bool is_point) {
+    if (is_point) {
+        v = vec3_sub(v, vec3_new(view_matrix.m[0][3], view_matrix.m[1][3],
+                                 view_matrix.m[2][3]));
+    }
+    vec3_t world = {
+        view_matrix.m[0][0] * v.x + view_matrix.m[1][0] * v.y + view_matrix.m[2][0] * v.z,
+        view_matrix.m[0][1] * v.x + view_matrix.m[1][1] * v.y + view_matrix.m[2][1] * v.z,
+        view_matrix.m[0][2] * v.x + view_matrix.m[1][2] * v.y + view_matrix.m[2][2] * v.z};
+    return world;
+}
+
+void frustum_planes_in_world(const plane_t frustum_planes[NUM_PLANES], mat4_t view_matrix,
+                             plane_t planes[NUM_PLANES]) {
+    for (int plane = 0; plane < NUM_PLANES; plane++) {
+        planes[plane].point = view_to_world(view_matrix, frustum_planes[plane].point, true);
+        planes[plane].normal =
+            view_to_world(view_matrix, frustum_planes[plane].normal, false);
+    }
 }
 
 void triangles_from_polygon(polygon_t *polygon, triangle_t triangles[],
@@ -1,13 +1,17 @@
 #ifndef CLIPPING_H
 #define CLIPPING_H
 
+#include "matrix.h"
 #include "texture.h"
 #include "triangle.h"
 #include "vector.h"
+#include <stdbool.h>
 
 #define MAX_NUM_POLY_VERTICES 10
 #define MAX_NUM_POLY_TRIANGLES 10
 
+#define NUM_PLANES 6
+
 enum {
     LEFT_FRUSTUM_PLANE,
     RIGHT_FRUSTUM_PLANE,
@@ -28,12 +32,24 @@ typedef struct {
     int num_vertices;
 } polygon_t;
 
-void init_frustum_planes(float fovx, float fovy, float z_near, float z_far);
+// The frustum planes of a camera at the origin looking down +z, in camera space
+void init_frustum_planes(plane_t frustum_planes[NUM_PLANES], float fovx, float fovy,
+                         float z_near, float z_far);
 
 polygon_t create_polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t t0,
                                        tex2_t t1, tex2_t t2);
 
-void clip_polygon(polygon_t *polygon);
+void clip_polygon(polygon_t *polygon, const plane_t frustum_planes[NUM_PLANES]);
+
+// Whether a camera space sphere lies entirely outside one of the frustum
+// planes, so anything inside it would be clipped away
+bool sphere_outside_frustum(const plane_t frustum_planes[NUM_PLANES], vec3_t center,
+                            float radius);
+
+// The frustum planes moved into world space, for a camera whose view matrix
+// is a rotation and a translation, as mat4_look_at makes
+void frustum_planes_in_world(const plane_t frustum_planes[NUM_PLANES], mat4_t view_matrix,
+                             plane_t planes[NUM_PLANES]);
 
 void triangles_from_polygon(polygon_t *polygon, triangle_t triangles[],
                             int *num_triangles);
@@ -1,4 +1,6 @@
 #include "display.h"
+#include "pixel.h"
+#include "renderer.h"
 
 #include <SDL2/SDL.h>
 #include <stdbool.h>
@@ -6,13 +8,29 @@
 #include <stdio.h>
 
 SDL_Window *window = NULL;
-SDL_Renderer *renderer = NULL;
-uint32_t *color_buffer = NULL;
+SDL_Renderer *sdl_renderer = NULL;
 SDL_Texture *color_buffer_texture = NULL;
+uint32_t color_buffer_format = SDL_PIXELFORMAT_ARGB8888;
 
 int window_width = 800;
 int window_height = 600;
-float *z_buffer = NULL;
+
+// The first format in the renderer's list that one of our pixel formats can be
+// written to as is; renderers list their native formats first. The X formats
+// just ignore the alpha byte
+static uint32_t preferred_color_buffer_format(void) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(sdl_renderer, &info) == 0) {
+        for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+            uint32_t format = info.texture_formats[i];
+            if (format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_RGB888 ||
+                format == SDL_PIXELFORMAT_ABGR8888 || format == SDL_PIXELFORMAT_BGR888) {
+                return format;
+            }
+        }
+    }
+    return SDL_PIXELFORMAT_ARGB8888;
+}
 
 bool initialize_window(void) {
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
@@ -35,91 +53,39 @@ bool initialize_window(void) {
         return false;
     }
 
-    renderer = SDL_CreateRenderer(window, -1, 0);
-    if (!renderer) {
+    sdl_renderer = SDL_CreateRenderer(window, -1, 0);
+    if (!sdl_renderer) {
         fprintf(stderr, "Error creating SDL renderer. \n");
         return false;
     }
 
-    SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
-
-    return true;
-}
-
-void render_color_buffer(void) {
-    SDL_UpdateTexture(color_buffer_texture, NULL, color_buffer,
-                      (int)(window_width * sizeof(uint32_t)));
-    SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
-}
-
-void clear_color_buffer(color_t color) {
-    for (int y = 0; y < window_height; y++) {
-        for (int x = 0; x < window_width; x++) {
-            color_buffer[(window_width * y) + x] = color;
-        }
-    }
-}
-
-void clear_z_buffer() {
-    for (int y = 0; y < window_height; y++) {
-        for (int x = 0; x < window_width; x++) {
-            z_buffer[(window_width * y) + x] = 1.0;
-        }
-    }
-}
-
-void draw_grid(uint32_t gridColor) {
-    for (int y = 0; y < window_height; y += 10) {
-        for (int x = 0; x < window_width; x += 10) {
-            color_buffer[(window_width * y) + x] = gridColor;
-        }
-    }
-}
+    // draw in the renderer's own format, so uploading frames needs no conversion
+    color_buffer_format = preferred_color_buffer_format();
+    pixel_format = color_buffer_format == SDL_PIXELFORMAT_ABGR8888 ||
+                           color_buffer_format == SDL_PIXELFORMAT_BGR888
+                       ? PIXEL_FORMAT_ABGR8888
+                       : PIXEL_FORMAT_ARGB8888;
+    printf("Color buffer format %s\n", SDL_GetPixelFormatName(color_buffer_format));
 
-void draw_pixel(int x, int y, color_t color) {
-    if (x >= 0 && x < window_width && y >= 0 && y < window_height) {
-        color_buffer[(window_width * y) + x] = color;
-    }
-}
-
-void draw_rect(int x, int y, int width, int height, color_t color) {
-    for (int i = 0; i < width; i++) {
-        for (int j = 0; j < height; j++) {
-            int current_x = x + i;
-            int current_y = y + j;
-            draw_pixel(current_x, current_y, color);
-        }
-    }
-}
-
-void draw_line(int x0, int y0, int x1, int y1, color_t color) {
-    int delta_x = (x1 - x0);
-    int delta_y = (y1 - y0);
-
-    int longest_side = abs(delta_x) >= (abs(delta_y)) ? abs(delta_x) : abs(delta_y);
-
-    // find how much we should increment both x and y each step
-    float x_inc = delta_x / (float)longest_side;
-    float y_inc = delta_y / (float)longest_side;
+    SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
 
-    float current_x = x0;
-    float current_y = y0;
+    // smooth out the upscale when rendering below the window resolution
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
 
-    for (int i = 0; i <= longest_side; i++) {
-        draw_pixel(round(current_x), round(current_y), color);
-        current_x += x_inc;
-        current_y += y_inc;
-    }
+    return true;
 }
 
-void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, color_t color) {
-    draw_line(x0, y0, x1, y1, color);
-    draw_line(x1, y1, x2, y2, color);
-    draw_line(x2, y2, x0, y0, color);
+void render_color_buffer(const renderer_t *renderer) {
+    // upload only the area that was drawn and let SDL upscale it to the window
+    int render_width = renderer->render_width;
+    SDL_Rect render_area = {0, 0, render_width, renderer->render_height};
+    SDL_UpdateTexture(color_buffer_texture, &render_area, renderer->color_buffer,
+                      (int)(render_width * sizeof(uint32_t)));
+    SDL_RenderCopy(sdl_renderer, color_buffer_texture, &render_area, NULL);
 }
 
 void destroy_window(void) {
-    SDL_DestroyRenderer(renderer);
+    SDL_DestroyRenderer(sdl_renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
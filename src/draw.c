@@ -0,0 +1,75 @@
+#include "draw.h"
+#include "renderer.h"
+#include <math.h>
+#include <stdlib.h>
+
+void clear_color_buffer(renderer_t *renderer, color_t color) {
+    int render_width = renderer->render_width;
+    for (int y = 0; y < renderer->render_height; y++) {
+        for (int x = 0; x < render_width; x++) {
+            renderer->color_buffer[(render_width * y) + x] = color;
+        }
+    }
+}
+
+void clear_z_buffer(renderer_t *renderer) {
+    int render_width = renderer->render_width;
+    for (int y = 0; y < renderer->render_height; y++) {
+        for (int x = 0; x < render_width; x++) {
+            renderer->z_buffer[(render_width * y) + x] = 1.0;
+        }
+    }
+}
+
+void draw_grid(renderer_t *renderer, uint32_t gridColor) {
+    int render_width = renderer->render_width;
+    for (int y = 0; y < renderer->render_height; y += 10) {
+        for (int x = 0; x < render_width; x += 10) {
+            renderer->color_buffer[(render_width * y) + x] = gridColor;
+        }
+    }
+}
+
+void draw_pixel(renderer_t *renderer, int x, int y, color_t color) {
+    int render_width = renderer->render_width;
+    if (x >= 0 && x < render_width && y >= 0 && y < renderer->render_height) {
+        renderer->color_buffer[(render_width * y) + x] = color;
+    }
+}
+
+void draw_rect(renderer_t *renderer, int x, int y, int width, int height, color_t color) {
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < height; j++) {
+            int current_x = x + i;
+            int current_y = y + j;
+            draw_pixel(renderer, current_x, current_y, color);
+        }
+    }
+}
+
+void draw_line(renderer_t *renderer, int x0, int y0, int x1, int y1, color_t color) {
+    int delta_x = (x1 - x0);
+    int delta_y = (y1 - y0);
+
+    int longest_side = abs(delta_x) >= (abs(delta_y)) ? abs(delta_x) : abs(delta_y);
+
+    // find how much we should increment both x and y each step
+    float x_inc = delta_x / (float)longest_side;
+    float y_inc = delta_y / (float)longest_side;
+
+    float current_x = x0;
+    float current_y = y0;
+
+    for (int i = 0; i <= longest_side; i++) {
+        draw_pixel(renderer, round(current_x), round(current_y), color);
+        current_x += x_inc;
+        current_y += y_inc;
+    }
+}
+
+void draw_triangle(renderer_t *renderer, int x0, int y0, int x1, int y1, int x2, int y2,
+                   color_t color) {
+    draw_line(renderer, x0, y0, x1, y1, color);
+    draw_line(renderer, x1, y1, x2, y2, color);
+    draw_line(renderer, x2, y2, x0, y0, color);
+}
@@ -0,0 +1,32 @@
+#ifndef DRAW_H
+#define DRAW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t color_t;
+
+// The context everything is drawn through, defined in renderer.h
+typedef struct renderer renderer_t;
+
+enum cull_method { CULL_NONE, CULL_BACKFACE };
+
+enum render_method {
+    RENDER_WIRE,
+    RENDER_WIRE_VERTEX,
+    RENDER_FILL_TRIANGLE,
+    RENDER_FILL_TRIANGLE_WIRE,
+    RENDER_TEXTURED,
+    RENDER_TEXTURED_WIRE
+};
+
+void draw_grid(renderer_t *renderer, uint32_t gridColor);
+void draw_rect(renderer_t *renderer, int x, int y, int width, int height, color_t color);
+void draw_pixel(renderer_t *renderer, int x, int y, color_t color);
+void draw_line(renderer_t *renderer, int x0, int y0, int x1, int y1, color_t color);
+void draw_triangle(renderer_t *renderer, int x0, int y0, int x1, int y1, int x2, int y2,
+                   color_t color);
+void clear_color_buffer(renderer_t *renderer, color_t color);
+void clear_z_buffer(renderer_t *renderer);
+
+#endif
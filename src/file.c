@@ -0,0 +1,109 @@
+#include "file.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FILE_SOURCE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef FILE_SOURCE_MMAP
+static bool map_file(file_source_t *source, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    // empty files can't be mapped, and pipes or devices have no size to map
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    // loaders read front to back, so let the kernel read ahead aggressively
+    madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+    source->data = data;
+    source->size = (size_t)info.st_size;
+    source->mapped = true;
+    return true;
+}
+#endif
+
+static bool read_file(file_source_t *source, const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    size_t capacity = 64 * 1024;
+    size_t size = 0;
+    unsigned char *data = malloc(capacity);
+
+    // read in growing chunks, the size isn't known up front for pipes
+    while (data != NULL) {
+        size += fread(data + size, 1, capacity - size, file);
+        if (size < capacity) {
+            break;
+        }
+        unsigned char *grown = realloc(data, capacity * 2);
+        if (grown == NULL) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = grown;
+        capacity *= 2;
+    }
+
+    bool ok = data != NULL && !ferror(file);
+    fclose(file);
+    if (!ok) {
+        free(data);
+        return false;
+    }
+
+    source->data = data;
+    source->size = size;
+    source->mapped = false;
+    return true;
+}
+
+bool file_source_open(file_source_t *source, const char *filename) {
+    source->data = NULL;
+    source->size = 0;
+    source->mapped = false;
+
+#ifdef FILE_SOURCE_MMAP
+    if (map_file(source, filename)) {
+        return true;
+    }
+#endif
+    return read_file(source, filename);
+}
+
+void file_source_close(file_source_t *source) {
+#ifdef FILE_SOURCE_MMAP
+    if (source->mapped) {
+        munmap((void *)source->data, source->size);
+    } else {
+        free((void *)source->data);
+    }
+#else
+    free((void *)source->data);
+#endif
+    source->data = NULL;
+    source->size = 0;
+    source->mapped = false;
+}
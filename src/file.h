@@ -0,0 +1,19 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The whole contents of a file, read only. The file is memory mapped where
+// possible, so loaders parse straight out of the page cache; otherwise it is
+// read into a heap buffer
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    bool mapped;
+} file_source_t;
+
+bool file_source_open(file_source_t *source, const char *filename);
+void file_source_close(file_source_t *source);
+
+#endif
@@ -0,0 +1,80 @@
+#include "headless.h"
+#include "image.h"
+#include "resolution.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Write out or hand over the frame in the color buffer
+static bool output_frame(renderer_t *renderer, const headless_options_t *options,
+                         int frame) {
+    if (options->on_frame && !options->on_frame(renderer, frame, options->user)) {
+        return false;
+    }
+    if (!options->output) {
+        return true;
+    }
+    char filename[1024];
+    if (!image_pattern_filename(filename, sizeof(filename), options->output, frame)) {
+        fprintf(stderr, "Error writing frame %d: its file name is too long. \n", frame);
+        return false;
+    }
+    return image_write(filename, renderer->color_buffer, renderer->render_width,
+                       renderer->render_height, &options->png);
+}
+
+bool headless_render(scene_t *scene, const headless_options_t *options) {
+    if (options->output && !image_pattern_valid(options->output)) {
+        fprintf(stderr, "Error rendering to %s: expected one %%d for the frame number. \n",
+                options->output);
+        return false;
+    }
+
+    renderer_t *renderer = malloc(sizeof(renderer_t));
+    if (!renderer || !renderer_init(renderer, options->width, options->height, scene)) {
+        free(renderer);
+        return false;
+    }
+    renderer->render_method = options->render_method;
+    renderer->pipeline.pipelined = options->pipelined;
+    renderer->print_stats = true;
+
+    // Fixed steps rather than the clock, so the frames come out the same
+    // however fast they are drawn
+    float delta_time = 1.0f / FPS;
+    double start = stats_now_ms();
+    bool ok = true;
+    int num_rendered = 0;
+
+    renderer_submit_frame(renderer);
+    pipeline_sync(&renderer->pipeline);
+    for (int frame = 0; frame < options->num_frames && ok; frame++) {
+        bool more = frame + 1 < options->num_frames;
+
+        // When pipelined, the geometry of the next frame is built while this
+        // one is drawn; otherwise only once it is finished
+        if (more && renderer->pipeline.pipelined) {
+            scene_animate(scene, delta_time);
+            renderer_submit_frame(renderer);
+        }
+
+        renderer_draw_frame(renderer);
+        ok = output_frame(renderer, options, frame);
+        renderer_finish_frame(renderer);
+        num_rendered++;
+
+        if (more && !renderer->pipeline.pipelined) {
+            scene_animate(scene, delta_time);
+            renderer_submit_frame(renderer);
+        }
+    }
+
+    double elapsed = stats_now_ms() - start;
+    printf("Rendered %d frames of %dx%d in %.1f ms: %.1f fps\n", num_rendered,
+           options->width, options->height, elapsed,
+           elapsed > 0 ? num_rendered * 1000.0 / elapsed : 0.0);
+
+    renderer_destroy(renderer);
+    free(renderer);
+    return ok;
+}
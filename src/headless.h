@@ -0,0 +1,37 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "png_write.h"
+#include "renderer.h"
+#include "scene.h"
+#include <stdbool.h>
+
+// Called with each frame rendered headless, left in the renderer's color
+// buffer, render_width pixels a row. Returns false to stop rendering
+typedef bool (*headless_frame_t)(const renderer_t *renderer, int frame, void *user);
+
+typedef struct {
+    int width;
+    int height;
+    int num_frames;
+    enum render_method render_method;
+    bool pipelined;
+
+    // Pattern of the file each frame is written to, with one %d for the frame
+    // number (see image_pattern_valid), ending in .ppm or .png; NULL to write
+    // none
+    const char *output;
+    png_options_t png; // how .png frames are written
+
+    headless_frame_t on_frame; // NULL to call none
+    void *user;
+} headless_options_t;
+
+// Render frames of the scene into memory, with no window or display, as fast
+// as they can be drawn. The scene is animated as the viewer animates it, a
+// frame at a time at the viewer's frame rate. Returns false if the renderer
+// couldn't be set up, the output pattern is invalid, a frame couldn't be
+// written or on_frame stopped it
+bool headless_render(scene_t *scene, const headless_options_t *options);
+
+#endif
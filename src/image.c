@@ -0,0 +1,74 @@
+#include "image.h"
+#include "pixel.h"
+#include "png_write.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool has_extension(const char *filename, const char *extension) {
+    size_t length = strlen(filename);
+    size_t extension_length = strlen(extension);
+    return length >= extension_length &&
+           strcmp(filename + length - extension_length, extension) == 0;
+}
+
+// A binary PPM is a short text header followed by the RGB bytes of the rows
+static bool ppm_write(const char *filename, const uint32_t *pixels, int width,
+                      int height) {
+    FILE *file = fopen(filename, "wb");
+    uint8_t *row = malloc((size_t)width * 3);
+    bool ok = file && row && fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+    for (int y = 0; ok && y < height; y++) {
+        pixels_to_rgb(row, &pixels[(size_t)width * y], width);
+        ok = fwrite(row, 3, width, file) == (size_t)width;
+    }
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error writing %s. \n", filename);
+    }
+    free(row);
+    return ok;
+}
+
+bool image_write(const char *filename, const uint32_t *pixels, int width, int height,
+                 const png_options_t *png) {
+    if (has_extension(filename, ".png")) {
+        return png_write(filename, pixels, width, height, png);
+    }
+    if (has_extension(filename, ".ppm")) {
+        return ppm_write(filename, pixels, width, height);
+    }
+    fprintf(stderr, "Error writing %s: only .ppm and .png images are written. \n",
+            filename);
+    return false;
+}
+
+bool image_pattern_valid(const char *pattern) {
+    int conversions = 0;
+    for (const char *c = pattern; *c != '\0'; c++) {
+        if (*c != '%' || *++c == '%') {
+            continue;
+        }
+        c += *c == '0';
+        for (int digits = 0; isdigit((unsigned char)*c); digits++) {
+            if (digits == 2) {
+                return false;
+            }
+            c++;
+        }
+        if (*c != 'd') {
+            return false;
+        }
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+bool image_pattern_filename(char *filename, size_t size, const char *pattern, int frame) {
+    // only ever a checked pattern, whose one conversion takes the int
+    int length = snprintf(filename, size, pattern, frame);
+    return length >= 0 && (size_t)length < size;
+}
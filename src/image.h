@@ -0,0 +1,24 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "png_write.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Write width x height pixels in the pixel format, width a row, to a binary
+// PPM or a PNG file, picked by the file name's extension, PNGs with the
+// options or NULL for the defaults. Returns false if the file couldn't be
+// written
+bool image_write(const char *filename, const uint32_t *pixels, int width, int height,
+                 const png_options_t *png);
+
+// Whether pattern names numbered frames: exactly one %d, optionally with a 0
+// flag and a width of up to two digits, and no other % but %%
+bool image_pattern_valid(const char *pattern);
+
+// Write the name of frame's file, from a pattern image_pattern_valid
+// accepts. Returns false if the name doesn't fit in size bytes
+bool image_pattern_filename(char *filename, size_t size, const char *pattern, int frame);
+
+#endif
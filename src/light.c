@@ -1,9 +1,8 @@
 #include "light.h"
 #include <stdint.h>
 
-light_t light = {.direction = {0, 0, 1}};
-
-// Change color based on a percentage factor to represent light intensity
+// Change color based on a percentage factor to represent light intensity. Red
+// and blue are scaled alike, so this works in either pixel format
 uint32_t light_apply_intensity(uint32_t original_color, float percentage_factor) {
     if (percentage_factor < 0)
         percentage_factor = 0;
@@ -8,8 +8,6 @@ typedef struct {
     vec3_t direction;
 } light_t;
 
-extern light_t light;
-
 uint32_t light_apply_intensity(uint32_t original_color, float percentage_factor);
 
 #endif
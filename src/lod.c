@@ -0,0 +1,448 @@
+#include "lod.h"
+#include "array.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sum of squared distances to a set of planes, as the symmetric matrix
+// xx xy xz xd yy yz yd zz zd dd
+typedef struct {
+    double a[10];
+} quadric_t;
+
+typedef struct {
+    float cost;
+    uint32_t from; // the vertex that goes away
+    uint32_t to;   // the neighbour it is merged into
+} collapse_t;
+
+// Simplification state carried from one level to the next
+typedef struct {
+    const mesh_t *mesh;
+    uint32_t *indices;
+    int num_triangles;
+    quadric_t *quadrics;
+    bool *locked;
+    uint32_t *merged_into; // what each full detail vertex has become
+    float error;
+
+    // scratch for each pass
+    int *first_triangle;
+    int *vertex_triangles;
+    int *touched;
+    uint32_t *remap;
+    collapse_t *collapses;
+} simplifier_t;
+
+static vec3_t vertex_position(const simplifier_t *simplifier, uint32_t v) {
+    return simplifier->mesh->vertex_buffer[v].position;
+}
+
+static void quadric_add_plane(quadric_t *q, vec3_t n, double d) {
+    q->a[0] += n.x * n.x;
+    q->a[1] += n.x * n.y;
+    q->a[2] += n.x * n.z;
+    q->a[3] += n.x * d;
+    q->a[4] += n.y * n.y;
+    q->a[5] += n.y * n.z;
+    q->a[6] += n.y * d;
+    q->a[7] += n.z * n.z;
+    q->a[8] += n.z * d;
+    q->a[9] += d * d;
+}
+
+static double quadric_error(const quadric_t *q, vec3_t p) {
+    const double *a = q->a;
+    double error = a[0] * p.x * p.x + 2 * a[1] * p.x * p.y + 2 * a[2] * p.x * p.z +
+                   2 * a[3] * p.x + a[4] * p.y * p.y + 2 * a[5] * p.y * p.z +
+                   2 * a[6] * p.y + a[7] * p.z * p.z + 2 * a[8] * p.z + a[9];
+    return error > 0 ? error : 0;
+}
+
+static vec3_t triangle_normal(vec3_t a, vec3_t b, vec3_t c) {
+    return vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+}
+
+static int compare_collapses(const void *a, const void *b) {
+    float cost_a = ((const collapse_t *)a)->cost, cost_b = ((const collapse_t *)b)->cost;
+    return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+static int compare_edges(const void *a, const void *b) {
+    uint64_t edge_a = *(const uint64_t *)a, edge_b = *(const uint64_t *)b;
+    return (edge_a > edge_b) - (edge_a < edge_b);
+}
+
+// Lock the vertices of every edge that doesn't have exactly two faces. The
+// vertex buffer is welded by texture coordinate too, so this takes in the
+// UV seams as well as the open borders of the mesh
+static bool lock_borders(simplifier_t *simplifier) {
+    int num_edges = simplifier->num_triangles * 3;
+    uint64_t *edges = malloc((num_edges + 1) * sizeof(uint64_t));
+    if (!edges) {
+        return false;
+    }
+    for (int i = 0; i < num_edges; i++) {
+        uint32_t a = simplifier->indices[i];
+        uint32_t b = simplifier->indices[i % 3 == 2 ? i - 2 : i + 1];
+        edges[i] = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+    }
+    qsort(edges, num_edges, sizeof(uint64_t), compare_edges);
+
+    for (int i = 0; i < num_edges;) {
+        int run = 1;
+        while (i + run < num_edges && edges[i + run] == edges[i]) {
+            run++;
+        }
+        if (run != 2) {
+            simplifier->locked[edges[i] >> 32] = true;
+            simplifier->locked[edges[i] & 0xFFFFFFFFu] = true;
+        }
+        i += run;
+    }
+    free(edges);
+    return true;
+}
+
+// Index the faces around each vertex: those of vertex v are
+// vertex_triangles[first_triangle[v]] up to first_triangle[v + 1]
+static void build_vertex_triangles(simplifier_t *simplifier) {
+    int num_vertices = array_length(simplifier->mesh->vertex_buffer);
+    int num_indices = simplifier->num_triangles * 3;
+    const uint32_t *indices = simplifier->indices;
+    int *first = simplifier->first_triangle;
+
+    memset(first, 0, (num_vertices + 1) * sizeof(int));
+    for (int i = 0; i < num_indices; i++) {
+        first[indices[i] + 1]++;
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        first[v + 1] += first[v];
+    }
+    for (int i = 0; i < num_indices; i++) {
+        simplifier->vertex_triangles[first[indices[i]]++] = i / 3;
+    }
+    for (int v = num_vertices; v > 0; v--) {
+        first[v] = first[v - 1];
+    }
+    first[0] = 0;
+}
+
+// Whether moving vertex from onto vertex to would turn any face around it
+// over or squash it flat, leaving out the faces that vanish with the edge
+static bool collapse_flips(const simplifier_t *simplifier, uint32_t from, uint32_t to) {
+    vec3_t target = vertex_position(simplifier, to);
+    for (int k = simplifier->first_triangle[from]; k < simplifier->first_triangle[from + 1];
+         k++) {
+        const uint32_t *corners = &simplifier->indices[simplifier->vertex_triangles[k] * 3];
+        if (corners[0] == to || corners[1] == to || corners[2] == to) {
+            continue;
+        }
+        vec3_t before[3], after[3];
+        for (int j = 0; j < 3; j++) {
+            before[j] = vertex_position(simplifier, corners[j]);
+            after[j] = corners[j] == from ? target : before[j];
+        }
+        vec3_t old_normal = triangle_normal(before[0], before[1], before[2]);
+        vec3_t new_normal = triangle_normal(after[0], after[1], after[2]);
+        float new_length = vec3_length(new_normal);
+        if (vec3_dot(old_normal, new_normal) <= 0 ||
+            new_length <= 1e-6f * vec3_length(old_normal)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Distance from p to the triangle abc, after Ericson's closest point on a
+// triangle in Real-Time Collision Detection
+static float point_triangle_distance(vec3_t p, vec3_t a, vec3_t b, vec3_t c) {
+    vec3_t ab = vec3_sub(b, a), ac = vec3_sub(c, a), ap = vec3_sub(p, a);
+    float d1 = vec3_dot(ab, ap), d2 = vec3_dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) {
+        return vec3_length(ap);
+    }
+    vec3_t bp = vec3_sub(p, b);
+    float d3 = vec3_dot(ab, bp), d4 = vec3_dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) {
+        return vec3_length(bp);
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        return vec3_length(vec3_sub(ap, vec3_mul(ab, d1 / (d1 - d3))));
+    }
+    vec3_t cp = vec3_sub(p, c);
+    float d5 = vec3_dot(ab, cp), d6 = vec3_dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) {
+        return vec3_length(cp);
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        return vec3_length(vec3_sub(ap, vec3_mul(ac, d2 / (d2 - d6))));
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        return vec3_length(vec3_sub(bp, vec3_mul(vec3_sub(c, b), w)));
+    }
+    float denominator = 1 / (va + vb + vc);
+    vec3_t closest = vec3_add(a, vec3_add(vec3_mul(ab, vb * denominator),
+                                          vec3_mul(ac, vc * denominator)));
+    return vec3_length(vec3_sub(p, closest));
+}
+
+// How far the full detail vertices are from the simplified surface: each
+// from the nearest face around the vertex it was merged into. The quadrics
+// only order the collapses; summed over every plane they gather, they
+// overstate the error by far
+static float measure_error(simplifier_t *simplifier) {
+    int num_vertices = array_length(simplifier->mesh->vertex_buffer);
+    build_vertex_triangles(simplifier);
+
+    float error = 0;
+    for (int v = 0; v < num_vertices; v++) {
+        uint32_t merged = simplifier->merged_into[v];
+        vec3_t p = vertex_position(simplifier, v);
+        float distance = vec3_length(vec3_sub(p, vertex_position(simplifier, merged)));
+        for (int k = simplifier->first_triangle[merged];
+             k < simplifier->first_triangle[merged + 1]; k++) {
+            const uint32_t *corners =
+                &simplifier->indices[simplifier->vertex_triangles[k] * 3];
+            distance = fminf(distance, point_triangle_distance(
+                                           p, vertex_position(simplifier, corners[0]),
+                                           vertex_position(simplifier, corners[1]),
+                                           vertex_position(simplifier, corners[2])));
+        }
+        error = fmaxf(error, distance);
+    }
+    return error;
+}
+
+// One pass of collapses, cheapest first, none touching a face another one
+// in the pass has changed. Returns the number of collapses made
+static int simplify_pass(simplifier_t *simplifier, int target_triangles, int pass) {
+    int num_vertices = array_length(simplifier->mesh->vertex_buffer);
+    int num_triangles = simplifier->num_triangles;
+    const uint32_t *indices = simplifier->indices;
+    build_vertex_triangles(simplifier);
+    const int *first = simplifier->first_triangle;
+
+    int num_collapses = 0;
+    for (int i = 0; i < num_triangles * 3; i++) {
+        uint32_t from = indices[i];
+        if (simplifier->locked[from]) {
+            continue;
+        }
+        for (int j = 1; j < 3; j++) {
+            uint32_t to = indices[(i / 3) * 3 + (i % 3 + j) % 3];
+            if (to != from) {
+                simplifier->collapses[num_collapses++] = (collapse_t){
+                    (float)quadric_error(&simplifier->quadrics[from],
+                                         vertex_position(simplifier, to)),
+                    from, to};
+            }
+        }
+    }
+    qsort(simplifier->collapses, num_collapses, sizeof(collapse_t), compare_collapses);
+
+    for (int v = 0; v < num_vertices; v++) {
+        simplifier->remap[v] = v;
+    }
+    int remaining = num_triangles;
+    int made = 0;
+    for (int c = 0; c < num_collapses && remaining > target_triangles; c++) {
+        collapse_t collapse = simplifier->collapses[c];
+        if (simplifier->touched[collapse.from] == pass ||
+            simplifier->touched[collapse.to] == pass ||
+            collapse_flips(simplifier, collapse.from, collapse.to)) {
+            continue;
+        }
+
+        for (int k = first[collapse.from]; k < first[collapse.from + 1]; k++) {
+            const uint32_t *corners = &indices[simplifier->vertex_triangles[k] * 3];
+            remaining -= corners[0] == collapse.to || corners[1] == collapse.to ||
+                         corners[2] == collapse.to;
+            for (int j = 0; j < 3; j++) {
+                simplifier->touched[corners[j]] = pass;
+            }
+        }
+        simplifier->touched[collapse.to] = pass;
+        simplifier->remap[collapse.from] = collapse.to;
+
+        quadric_t *target = &simplifier->quadrics[collapse.to];
+        for (int k = 0; k < 10; k++) {
+            target->a[k] += simplifier->quadrics[collapse.from].a[k];
+        }
+        made++;
+    }
+
+    for (int v = 0; v < num_vertices; v++) {
+        simplifier->merged_into[v] = simplifier->remap[simplifier->merged_into[v]];
+    }
+
+    // move the faces onto the merged vertices, dropping those left flat
+    int kept = 0;
+    for (int t = 0; t < num_triangles; t++) {
+        uint32_t a = simplifier->remap[indices[t * 3]];
+        uint32_t b = simplifier->remap[indices[t * 3 + 1]];
+        uint32_t c = simplifier->remap[indices[t * 3 + 2]];
+        if (a != b && b != c && a != c) {
+            simplifier->indices[kept * 3] = a;
+            simplifier->indices[kept * 3 + 1] = b;
+            simplifier->indices[kept * 3 + 2] = c;
+            kept++;
+        }
+    }
+    simplifier->num_triangles = kept;
+    return made;
+}
+
+bool build_lods(mesh_t *mesh) {
+    int num_vertices = array_length(mesh->vertex_buffer);
+    int num_triangles = array_length(mesh->index_buffer) / 3;
+
+    simplifier_t simplifier = {.mesh = mesh, .num_triangles = num_triangles};
+    simplifier.indices = malloc((num_triangles * 3 + 1) * sizeof(uint32_t));
+    simplifier.quadrics = calloc(num_vertices + 1, sizeof(quadric_t));
+    simplifier.locked = calloc(num_vertices + 1, sizeof(bool));
+    simplifier.first_triangle = malloc((num_vertices + 1) * sizeof(int));
+    simplifier.vertex_triangles = malloc((num_triangles * 3 + 1) * sizeof(int));
+    simplifier.touched = calloc(num_vertices + 1, sizeof(int));
+    simplifier.remap = malloc((num_vertices + 1) * sizeof(uint32_t));
+    simplifier.merged_into = malloc((num_vertices + 1) * sizeof(uint32_t));
+    simplifier.collapses = malloc((num_triangles * 6 + 1) * sizeof(collapse_t));
+
+    // every level's indices, full detail first
+    uint32_t *levels = malloc((num_triangles * 3 + 1) * sizeof(uint32_t));
+    int num_level_indices = num_triangles * 3;
+    mesh_lod_t *lods = NULL;
+
+    bool ok = simplifier.indices && simplifier.quadrics && simplifier.locked &&
+              simplifier.first_triangle && simplifier.vertex_triangles &&
+              simplifier.touched && simplifier.remap && simplifier.merged_into &&
+              simplifier.collapses && levels &&
+              num_vertices > 0;
+    if (ok) {
+        for (int i = 0; i < num_triangles * 3; i++) {
+            simplifier.indices[i] = levels[i] = mesh_index(mesh, i);
+        }
+        for (int v = 0; v < num_vertices; v++) {
+            simplifier.merged_into[v] = v;
+        }
+        ok = lock_borders(&simplifier);
+    }
+
+    if (ok) {
+        // each vertex starts with the planes of the faces around it
+        for (int t = 0; t < num_triangles; t++) {
+            const uint32_t *corners = &simplifier.indices[t * 3];
+            vec3_t a = vertex_position(&simplifier, corners[0]);
+            vec3_t normal = triangle_normal(a, vertex_position(&simplifier, corners[1]),
+                                            vertex_position(&simplifier, corners[2]));
+            float length = vec3_length(normal);
+            if (length == 0) {
+                continue;
+            }
+            normal = vec3_div(normal, length);
+            for (int j = 0; j < 3; j++) {
+                quadric_add_plane(&simplifier.quadrics[corners[j]], normal,
+                                  -vec3_dot(normal, a));
+            }
+        }
+
+        mesh_lod_t full = {
+            .first_index = 0, .num_triangles = num_triangles, .num_vertices = num_vertices};
+        array_push(lods, full);
+        ok = array_length(lods) == 1;
+
+        int pass = 0;
+        while (ok && array_length(lods) < LOD_MAX_LEVELS) {
+            int previous = simplifier.num_triangles;
+            int target = (int)(previous * LOD_REDUCTION);
+            if (target < LOD_MIN_TRIANGLES) {
+                break;
+            }
+            while (simplifier.num_triangles > target &&
+                   simplify_pass(&simplifier, target, ++pass) > 0) {
+            }
+            if (simplifier.num_triangles > previous * LOD_MIN_REDUCTION) {
+                break;
+            }
+            // never less than the level before, so coarser is never closer
+            simplifier.error = fmaxf(simplifier.error, measure_error(&simplifier));
+
+            // append the level after the ones before it
+            int num_indices = num_level_indices + simplifier.num_triangles * 3;
+            uint32_t *grown = realloc(levels, num_indices * sizeof(uint32_t));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            levels = grown;
+            memcpy(&levels[num_level_indices], simplifier.indices,
+                   simplifier.num_triangles * 3 * sizeof(uint32_t));
+            mesh_lod_t lod = {.first_index = num_level_indices,
+                              .num_triangles = simplifier.num_triangles,
+                              .num_vertices = num_vertices,
+                              .error = simplifier.error};
+            int num_lods = array_length(lods);
+            array_push(lods, lod);
+            ok = array_length(lods) > num_lods;
+            num_level_indices += simplifier.num_triangles * 3;
+        }
+    }
+
+    void *index_buffer = ok ? array_hold(NULL, num_level_indices, mesh->index_size) : NULL;
+    if (index_buffer) {
+        for (int i = 0; i < num_level_indices; i++) {
+            if (mesh->index_size == 2) {
+                ((uint16_t *)index_buffer)[i] = (uint16_t)levels[i];
+            } else {
+                ((uint32_t *)index_buffer)[i] = levels[i];
+            }
+        }
+        array_free(mesh->index_buffer);
+        array_free(mesh->lods);
+        mesh->index_buffer = index_buffer;
+        mesh->lods = lods;
+    } else {
+        ok = false;
+        array_free(lods);
+    }
+
+    free(simplifier.indices);
+    free(simplifier.quadrics);
+    free(simplifier.locked);
+    free(simplifier.first_triangle);
+    free(simplifier.vertex_triangles);
+    free(simplifier.touched);
+    free(simplifier.remap);
+    free(simplifier.merged_into);
+    free(simplifier.collapses);
+    free(levels);
+    return ok;
+}
+
+int lod_select(const mesh_t *mesh, int current, float pixels_per_unit,
+               float error_pixels) {
+    int num_lods = array_length(mesh->lods);
+    if (num_lods == 0) {
+        return 0;
+    }
+    if (current >= num_lods) {
+        current = num_lods - 1;
+    }
+
+    // go finer while the current level's error shows, coarser while the next
+    // one's would hardly show
+    while (current > 0 && mesh->lods[current].error * pixels_per_unit >
+                              error_pixels * (1 + LOD_HYSTERESIS)) {
+        current--;
+    }
+    while (current + 1 < num_lods && mesh->lods[current + 1].error * pixels_per_unit <
+                                         error_pixels * (1 - LOD_HYSTERESIS)) {
+        current++;
+    }
+    return current;
+}
@@ -0,0 +1,36 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "mesh.h"
+#include <stdbool.h>
+
+// Full detail plus up to this many simplified levels, each with about half
+// the triangles of the one before
+#define LOD_MAX_LEVELS 6
+#define LOD_REDUCTION 0.5f
+
+// A level that can't get below this share of the one before it is not kept;
+// the chain stops there
+#define LOD_MIN_REDUCTION 0.9f
+#define LOD_MIN_TRIANGLES 16
+
+// A level is switched to once its error, projected on screen, drops this far
+// below the threshold, and away from once it rises this far above it, so a
+// mesh hovering at the threshold doesn't keep popping between levels
+#define LOD_HYSTERESIS 0.25f
+
+// On screen error a level is allowed, in pixels, unless set otherwise
+#define LOD_ERROR_PIXELS 1.0f
+
+// Append simplified copies of the mesh's faces to its index buffer with
+// quadric error edge collapses, and describe them in mesh->lods. Vertices on
+// UV seams and open borders never move, so seams stay where they were.
+// Returns false if out of memory, leaving the mesh as it was
+bool build_lods(mesh_t *mesh);
+
+// The level to draw, given the level drawn last, how many pixels a model unit
+// covers at the mesh's distance and the on screen error allowed
+int lod_select(const mesh_t *mesh, int current, float pixels_per_unit,
+               float error_pixels);
+
+#endif
@@ -1,83 +1,94 @@
 #include "array.h"
+#include "batch.h"
+#include "bench.h"
 #include "camera.h"
-#include "clipping.h"
-#include "display.h"
-#include "light.h"
-#include "matrix.h"
-#include "mesh.h"
-#include "texture.h"
-#include "triangle.h"
-#include "upng.h"
+#include "headless.h"
+#include "image.h"
+#include "png_write.h"
+#include "renderer.h"
+#include "resolution.h"
+#include "scene.h"
+#include "stream.h"
 #include "vector.h"
+#ifndef HEADLESS_ONLY
+#include "display.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_keycode.h>
 #include <SDL2/SDL_pixels.h>
+#endif
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-//  Array of triangles that should be rendered frame by frame
-#define MAX_NUM_TRIANGLES 10000
-triangle_t triangles_to_render[MAX_NUM_TRIANGLES];
-int num_triangles_to_render = 0;
-
-mat4_t proj_matrix;
-
-enum cull_method cull_method;
-enum render_method render_method;
+#include <string.h>
 
 bool is_running = NULL;
 
 int previous_frame_time = 0;
 float delta_time = 0;
 
-void setup(void) {
-    // Initialize render mode and triangle culling method
-    render_method = RENDER_WIRE;
-    cull_method = CULL_BACKFACE;
+// Instances in the crowd scene, 0 for a single f22
+int crowd_size = 0;
 
-    // Allocate the required bytes in memory for
-    // the color buffer
-    color_buffer =
-        (uint32_t *)malloc(sizeof(uint32_t) * window_width * window_height);
-    z_buffer = (float *)malloc(sizeof(float) * window_width * window_height);
+// How to render, from the command line. Headless when given a size
+headless_options_t options = {.num_frames = 100, .render_method = RENDER_WIRE};
 
-    if (!color_buffer) {
-        fprintf(stderr, "Error allocating memory "
-                        "for color_buffer. \n");
-    }
+// A batch of frames of one mesh to render across threads, when given one. Its
+// size, mode and output are taken from the options above
+batch_options_t batch = {.last_frame = BATCH_TURNTABLE_FRAMES - 1};
 
-    color_buffer_texture =
-        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                          SDL_TEXTUREACCESS_STREAMING, window_width, window_height);
+// Raw frames of a headless render to pipe to an encoder, when given a path
+const char *stream_path = NULL;
+enum stream_format stream_format = STREAM_RGBA;
+bool stream_drop_frames = false;
+stream_t stream;
 
-    // Initialize the perspective projection matrix
-    float aspecty = (float)window_height / (float)window_width;
-    float aspectx = (float)window_width / (float)window_height;
-    float fovy = M_PI / 3.0; // the same as 180/3, or 60 degrees
-    float fovx = atan(tan(fovy / 2) * aspectx) * 2.0;
+// The scene the viewer shows, and the renderer drawing it into the window
+scene_t scene;
+renderer_t renderer;
 
-    float znear = 0.1;
-    float zfar = 100.0;
-    proj_matrix = mat4_make_perspective(fovy, aspecty, znear, zfar);
+// Queue each headless frame on the stream
+bool stream_frame(const renderer_t *renderer, int frame, void *user) {
+    return stream_push_frame(user, renderer->color_buffer);
+}
 
-    // initialize frustum planes
-    init_frustum_planes(fovx, fovy, znear, zfar);
+void load_scene(void) {
+    // load a single f22 in front of the camera, or a crowd of aircraft
+    if (crowd_size > 0) {
+        if (!scene_add_crowd(&scene, crowd_size)) {
+            fprintf(stderr, "Error loading the crowd. \n");
+        }
+    } else {
+        int f22 = scene_add_mesh(&scene, "./assets/f22.obj");
+        int material = scene_add_material(&scene, "./assets/f22.png");
+        if (f22 >= 0) {
+            scene_add_instance(&scene, f22, material, (vec3_t){0, 0, 4.0f});
+        }
+    }
+}
 
-    // manually load the hardcoded texture data from the literal static array
-    // mesh_texture = (uint32_t *)REDBRICK_TEXTURE;
-    // texture_width = 64;
-    // texture_height = 64;
+// The viewer, left out of HEADLESS_ONLY builds, which have no SDL
+#ifndef HEADLESS_ONLY
+bool setup(void) {
+    color_buffer_texture =
+        SDL_CreateTexture(sdl_renderer, color_buffer_format,
+                          SDL_TEXTUREACCESS_STREAMING, window_width, window_height);
 
-    // loads the cube values into the mesh data structure
-    load_obj_file_data("./assets/f22.obj");
-    load_png_texture_data("./assets/f22.png");
+    load_scene();
 
     previous_frame_time = SDL_GetTicks();
+
+    if (!renderer_init(&renderer, window_width, window_height, &scene)) {
+        return false;
+    }
+    renderer.render_method = options.render_method;
+    renderer.pipeline.pipelined = options.pipelined;
+    renderer.print_stats = true;
+    return true;
 }
 
 void process_input(void) {
+    camera_t *camera = &renderer.camera;
     SDL_Event event;
     SDL_PollEvent(&event);
 
@@ -91,48 +102,83 @@ void process_input(void) {
             is_running = false;
             break;
         case SDLK_1:
-            render_method = RENDER_WIRE;
+            renderer.render_method = RENDER_WIRE;
             break;
         case SDLK_2:
-            render_method = RENDER_WIRE_VERTEX;
+            renderer.render_method = RENDER_WIRE_VERTEX;
             break;
         case SDLK_3:
-            render_method = RENDER_FILL_TRIANGLE;
+            renderer.render_method = RENDER_FILL_TRIANGLE;
             break;
         case SDLK_4:
-            render_method = RENDER_FILL_TRIANGLE_WIRE;
+            renderer.render_method = RENDER_FILL_TRIANGLE_WIRE;
             break;
         case SDLK_5:
-            render_method = RENDER_TEXTURED;
+            renderer.render_method = RENDER_TEXTURED;
             break;
         case SDLK_6:
-            render_method = RENDER_TEXTURED_WIRE;
+            renderer.render_method = RENDER_TEXTURED_WIRE;
             break;
         case SDLK_x:
-            cull_method = CULL_BACKFACE;
+            renderer.cull_method = CULL_BACKFACE;
             break;
         case SDLK_z:
-            cull_method = CULL_NONE;
+            renderer.cull_method = CULL_NONE;
+            break;
+        case SDLK_m:
+            renderer.mipmapping = !renderer.mipmapping;
+            printf("Mipmapping %s\n", renderer.mipmapping ? "on" : "off");
+            break;
+        case SDLK_c:
+            renderer.count_texture_fetches = !renderer.count_texture_fetches;
+            break;
+        case SDLK_r:
+            renderer.dynamic_resolution = !renderer.dynamic_resolution;
+            printf("Dynamic resolution %s\n", renderer.dynamic_resolution ? "on" : "off");
+            break;
+        case SDLK_b:
+            renderer.meshlet_culling = !renderer.meshlet_culling;
+            printf("Meshlet culling %s\n", renderer.meshlet_culling ? "on" : "off");
+            break;
+        case SDLK_l:
+            renderer.lod_enabled = !renderer.lod_enabled;
+            printf("Levels of detail %s\n", renderer.lod_enabled ? "on" : "off");
+            break;
+        case SDLK_LEFTBRACKET:
+            renderer.lod_error_pixels *= 0.5f;
+            printf("Level of detail error %.3g pixels\n", renderer.lod_error_pixels);
+            break;
+        case SDLK_RIGHTBRACKET:
+            renderer.lod_error_pixels *= 2.0f;
+            printf("Level of detail error %.3g pixels\n", renderer.lod_error_pixels);
+            break;
+        case SDLK_v:
+            renderer.bvh_culling = !renderer.bvh_culling;
+            printf("Instance tree culling %s\n", renderer.bvh_culling ? "on" : "off");
+            break;
+        case SDLK_p:
+            renderer.pipeline.pipelined = !renderer.pipeline.pipelined;
+            printf("Pipelined frames %s\n", renderer.pipeline.pipelined ? "on" : "off");
             break;
         case SDLK_UP:
-            camera.position.y += 1.0 * delta_time;
+            camera->position.y += 1.0 * delta_time;
             break;
         case SDLK_DOWN:
-            camera.position.y -= 1.0 * delta_time;
+            camera->position.y -= 1.0 * delta_time;
             break;
         case SDLK_w:
-            camera.forward_velocity = vec3_mul(camera.direction, 2.0 * delta_time);
-            camera.position = vec3_add(camera.position, camera.forward_velocity);
+            camera->forward_velocity = vec3_mul(camera->direction, 2.0 * delta_time);
+            camera->position = vec3_add(camera->position, camera->forward_velocity);
             break;
         case SDLK_s:
-            camera.forward_velocity = vec3_mul(camera.direction, 2.0 * delta_time);
-            camera.position = vec3_sub(camera.position, camera.forward_velocity);
+            camera->forward_velocity = vec3_mul(camera->direction, 2.0 * delta_time);
+            camera->position = vec3_sub(camera->position, camera->forward_velocity);
             break;
         case SDLK_a:
-            camera.yaw_angle += 1.0 * delta_time;
+            camera->yaw_angle += 1.0 * delta_time;
             break;
         case SDLK_d:
-            camera.yaw_angle -= 1.0 * delta_time;
+            camera->yaw_angle -= 1.0 * delta_time;
             break;
 
         default:
@@ -154,260 +200,164 @@ void update(void) {
 
     previous_frame_time = SDL_GetTicks();
 
-    num_triangles_to_render = 0;
-
-    // Change the mesh scale, rotation, and translation values per animation frame
-    mesh.rotation.x += 0.01 * delta_time;
-    mesh.rotation.y += 0.01 * delta_time;
-    mesh.rotation.z += 0.01 * delta_time;
-    // mesh.translation.x += 0.01;
-    mesh.translation.z = 4.0f;
-
-    vec3_t target = {0, 0, 1};
-
-    mat4_t camera_yaw_rotation = mat4_make_rotation_y(camera.yaw_angle);
-    camera.direction =
-        vec3_from_vec4(mat4_mul_vec4(camera_yaw_rotation, vec4_from_vec3(target)));
-
-    target = vec3_add(camera.position, camera.direction);
-
-    vec3_t up_direction = {0, 1, 0};
-    mat4_t view_matrix = mat4_look_at(camera.position, target, up_direction);
-
-    // Create scale, rotation, and translation matrices that will be used to
-    // multiply the mesh vertices
-    mat4_t scale_matrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-    mat4_t translation_matrix = mat4_make_translation(
-        mesh.translation.x, mesh.translation.y, mesh.translation.z);
-    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh.rotation.x);
-    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh.rotation.y);
-    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh.rotation.z);
-
-    int num_faces = array_length(mesh.faces);
-
-    //  loop all triangles faces
-    for (int i = 0; i < num_faces; i++) {
-
-        face_t mesh_face = mesh.faces[i];
-
-        vec3_t face_vertices[3];
-        face_vertices[0] = mesh.vertices[mesh_face.a];
-        face_vertices[1] = mesh.vertices[mesh_face.b];
-        face_vertices[2] = mesh.vertices[mesh_face.c];
-
-        // loop all three vertices of this current face and apply
-        // transformations
-        vec4_t transformed_vertices[3];
-
-        // Loop all three vertices of this current face and apply transformations
-        for (int j = 0; j < 3; j++) {
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-
-            // create a World Matrix combining scale, rotation, and translation to
-            // place the vector in the "world"
-
-            mat4_t world_matrix = mat4_identity();
-
-            //  order matters: First scale, then rotate, then translate
-            // [T]*[R]*[S]*v
-            //
-            world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-            world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-
-            transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-
-            // multiply the view matrix by the vector to transform the scene to
-            // camera space
-            transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+    // Change the instances' rotation values per animation frame
+    scene_animate(&scene, delta_time);
 
-            // Save transformed vertex in the array of transformed vertices
-            transformed_vertices[j] = transformed_vertex;
-        }
+    camera_update_direction(&renderer.camera);
+    renderer_submit_frame(&renderer);
+}
 
-        // Check Backface Culling Algorithm (5)
-        vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]);
-        vec3_t vector_b = vec3_from_vec4(transformed_vertices[1]);
-        vec3_t vector_c = vec3_from_vec4(transformed_vertices[2]);
+void render(void) {
+    renderer_draw_frame(&renderer);
 
-        // 1. Find vectors B-A and C-A
-        vec3_t vector_ab = vec3_sub(vector_b, vector_a);
-        vec3_t vector_ac = vec3_sub(vector_c, vector_a);
-        vec3_normalize(&vector_ab);
-        vec3_normalize(&vector_ac);
+    render_color_buffer(&renderer);
+    SDL_RenderPresent(sdl_renderer);
 
-        // 2. Take their cross product and find the perpendicular normal N
-        vec3_t normal = vec3_cross(vector_ab, vector_ac);
+    renderer_finish_frame(&renderer);
+}
 
-        // normalize the face normal vector
-        vec3_normalize(&normal);
+// Free the memory that was dynamically allocated
+void free_resources(void) {
+    renderer_destroy(&renderer);
+    free_scene(&scene);
+}
+#endif
 
-        vec3_t origin = {0, 0, 0};
-        vec3_t camera_ray = vec3_sub(origin, vector_a);
+//
 
-        // 4. Take the Dot Product between normal N and the Camera Ray
-        float dot_normal_camera = vec3_dot(normal, camera_ray);
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench-texture") == 0) {
+        return bench_texture_layout(argc > 2 ? argv[2] : "./assets/crab.png");
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-png") == 0) {
+        return bench_png_decode(argc > 2 ? argv[2] : "./assets");
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-obj") == 0) {
+        return bench_obj_load(argc > 2 ? argv[2] : "./assets/drone.obj");
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-vcache") == 0) {
+        return bench_vertex_cache(argc > 2 ? argv[2] : "./assets");
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-png-write") == 0) {
+        return bench_png_write(argc > 2 ? argv[2] : "./bench.png");
+    }
 
-        // 5. If this dot product is less than zero, then do not display the face
-        if (cull_method == CULL_BACKFACE) {
-            if (dot_normal_camera < 0) {
-                // cull face by bypassing the rest of the function
-                continue;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--crowd") == 0 && has_value) {
+            crowd_size = atoi(argv[++i]);
+        } else if (strcmp(arg, "--headless") == 0 && has_value) {
+            // render offscreen at WIDTHxHEIGHT, without SDL
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0) {
+                fprintf(stderr, "Expected a size like 1920x1080 after --headless. \n");
+                return 1;
             }
-        }
-
-        // clipping
-        polygon_t polygon = create_polygon_from_triangle(
-            vec3_from_vec4(transformed_vertices[0]),
-            vec3_from_vec4(transformed_vertices[1]),
-            vec3_from_vec4(transformed_vertices[2]), mesh_face.a_uv, mesh_face.b_uv,
-            mesh_face.c_uv);
-        clip_polygon(&polygon);
-
-        triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLES];
-        int num_triangles_after_clipping = 0;
-
-        triangles_from_polygon(&polygon, triangles_after_clipping,
-                               &num_triangles_after_clipping);
-
-        for (int t = 0; t < num_triangles_after_clipping; t++) {
-            triangle_t triangle_after_clipping = triangles_after_clipping[t];
-
-            // Loop all three vertices to perform projection
-            vec4_t projected_points[3];
-            for (int j = 0; j < 3; j++) {
-                // project current vertex
-                projected_points[j] = mat4_mul_vec4_project(
-                    proj_matrix, triangle_after_clipping.points[j]);
-
-                // scale into the view
-                projected_points[j].x *= (window_width / 2.0);
-                projected_points[j].y *= (window_height / 2.0);
-
-                // Invert the Y values because our obj comes with it's Y Values
-                // flipped
-                projected_points[j].y *= -1;
-
-                // translate projected points to the middle of the screen.
-                projected_points[j].x += (window_width / 2.0);
-                projected_points[j].y += (window_height / 2.0);
+        } else if (strcmp(arg, "--frames") == 0 && has_value) {
+            options.num_frames = atoi(argv[++i]);
+        } else if (strcmp(arg, "--output") == 0 && has_value) {
+            options.output = argv[++i];
+            if (!image_pattern_valid(options.output)) {
+                fprintf(stderr, "Expected a file name with one %%d for the frame number, "
+                                "like frame%%04d.png, after --output. \n");
+                return 1;
             }
-
-            // Calculate the shade intensity based on how aligned is the face normal
-            // and the light ray
-            float light_intensity_factor = -vec3_dot(normal, light.direction);
-
-            uint32_t triangle_color =
-                light_apply_intensity(mesh_face.color, light_intensity_factor);
-
-            triangle_t triangle_to_render = {
-                .points =
-                    {
-
-                        {projected_points[0].x, projected_points[0].y,
-                         projected_points[0].z, projected_points[0].w},
-                        {projected_points[1].x, projected_points[1].y,
-                         projected_points[1].z, projected_points[1].w},
-                        {projected_points[2].x, projected_points[2].y,
-                         projected_points[2].z, projected_points[2].w}
-
-                    },
-                .texcoords = {{triangle_after_clipping.texcoords[0].u,
-                               triangle_after_clipping.texcoords[0].v},
-                              {triangle_after_clipping.texcoords[1].u,
-                               triangle_after_clipping.texcoords[1].v},
-                              {triangle_after_clipping.texcoords[2].u,
-                               triangle_after_clipping.texcoords[2].v}},
-                .color = triangle_color
-
-            };
-
-            //  save the projected triangle in the array of triangles to render.
-            if (num_triangles_to_render < MAX_NUM_TRIANGLES) {
-                triangles_to_render[num_triangles_to_render++] = triangle_to_render;
+        } else if (strcmp(arg, "--mode") == 0 && has_value) {
+            // numbered as the keys that pick them
+            int mode = atoi(argv[++i]);
+            if (mode < 1 || mode > RENDER_TEXTURED_WIRE + 1) {
+                fprintf(stderr, "Expected a render mode from 1 to 6 after --mode. \n");
+                return 1;
+            }
+            options.render_method = mode - 1;
+        } else if (strcmp(arg, "--pipelined") == 0) {
+            options.pipelined = true;
+        } else if (strcmp(arg, "--png") == 0 && has_value) {
+            const char *compression = argv[++i];
+            if (strcmp(compression, "store") == 0) {
+                options.png.compression = PNG_STORE;
+            } else if (strcmp(compression, "fast") == 0) {
+                options.png.compression = PNG_FAST;
+            } else {
+                fprintf(stderr, "Expected store or fast after --png. \n");
+                return 1;
             }
+        } else if (strcmp(arg, "--stream") == 0 && has_value) {
+            // raw frames to a file or named pipe, or stdout given -
+            stream_path = argv[++i];
+        } else if (strcmp(arg, "--stream-format") == 0 && has_value) {
+            const char *format = argv[++i];
+            if (strcmp(format, "rgba") == 0) {
+                stream_format = STREAM_RGBA;
+            } else if (strcmp(format, "yuv420") == 0) {
+                stream_format = STREAM_YUV420;
+            } else {
+                fprintf(stderr, "Expected rgba or yuv420 after --stream-format. \n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--drop-frames") == 0) {
+            stream_drop_frames = true;
+        } else if (strcmp(arg, "--batch") == 0 && i + 2 < argc) {
+            batch.mesh = argv[++i];
+            batch.texture = argv[++i];
+        } else if (strcmp(arg, "--range") == 0 && has_value) {
+            if (sscanf(argv[++i], "%d:%d", &batch.first_frame, &batch.last_frame) != 2) {
+                fprintf(stderr, "Expected frames like 0:359 after --range. \n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--path") == 0 && has_value) {
+            if (!batch_load_path(argv[++i], &batch.path)) {
+                return 1;
+            }
+        } else if (strcmp(arg, "--threads") == 0 && has_value) {
+            batch.num_threads = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown option %s. \n", arg);
+            return 1;
         }
     }
-}
 
-void render(void) {
-    draw_grid(0xFF404040);
-
-    // loop all projected triangles and render them
-    for (int i = 0; i < num_triangles_to_render; i++) {
-        triangle_t triangle = triangles_to_render[i];
-
-        if (render_method == RENDER_WIRE_VERTEX) {
-            draw_rect(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6,
-                      0xFFFFFF00);
-            draw_rect(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6,
-                      0xFFFFFF00);
-            draw_rect(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6,
-                      0xFFFFFF00);
-        }
-
-        if (render_method == RENDER_TEXTURED ||
-            render_method == RENDER_TEXTURED_WIRE) {
-            draw_textured_triangle(
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z,
-                triangle.points[0].w, triangle.texcoords[0].u,
-                triangle.texcoords[0].v, // vertex A
-                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z,
-                triangle.points[1].w, triangle.texcoords[1].u,
-                triangle.texcoords[1].v, // vertex B
-                triangle.points[2].x, triangle.points[2].y, triangle.points[2].z,
-                triangle.points[2].w, triangle.texcoords[2].u,
-                triangle.texcoords[2].v, // vertex C
-                mesh_texture);
-        }
-        if (render_method == RENDER_WIRE_VERTEX ||
-            render_method == RENDER_FILL_TRIANGLE_WIRE ||
-            render_method == RENDER_WIRE) {
-            draw_triangle(
+    if (batch.mesh) {
+        batch.width = options.width > 0 ? options.width : 1280;
+        batch.height = options.height > 0 ? options.height : 720;
+        batch.render_method = options.render_method;
+        batch.output = options.output;
+        batch.png = options.png;
+        bool ok = batch_render(&batch);
+        array_free(batch.path);
+        return ok ? 0 : 1;
+    }
 
-                triangle.points[0].x, triangle.points[0].y, triangle.points[1].x,
-                triangle.points[1].y, triangle.points[2].x, triangle.points[2].y,
-                0xFFFFFFFF
+    if (stream_path && options.width <= 0) {
+        fprintf(stderr, "Streaming needs a size, given with --headless. \n");
+        return 1;
+    }
 
-            );
+    if (options.width > 0) {
+        // opened first, so nothing printed while loading lands in the frames
+        if (stream_path) {
+            if (!stream_open(&stream, stream_path, stream_format, options.width,
+                             options.height, stream_drop_frames)) {
+                return 1;
+            }
+            options.on_frame = stream_frame;
+            options.user = &stream;
         }
 
-        if (render_method == RENDER_FILL_TRIANGLE ||
-            render_method == RENDER_FILL_TRIANGLE_WIRE) {
-            draw_filled_triangle(
-
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z,
-                triangle.points[0].w, triangle.points[1].x, triangle.points[1].y,
-                triangle.points[1].z, triangle.points[1].w, triangle.points[2].x,
-                triangle.points[2].y, triangle.points[2].z, triangle.points[2].w,
-                triangle.color
-
-            );
+        load_scene();
+        bool ok = headless_render(&scene, &options);
+        free_scene(&scene);
+        if (stream_path) {
+            stream_close(&stream);
         }
+        return ok ? 0 : 1;
     }
 
-    render_color_buffer();
-
-    clear_color_buffer(0xFF000000);
-    clear_z_buffer();
-
-    SDL_RenderPresent(renderer);
-}
-
-// Free the memory that was dynamically allocated
-void free_resources(void) {
-    array_free(mesh.faces);
-    array_free(mesh.vertices);
-    free(color_buffer);
-    free(z_buffer);
-    upng_free(png_texture);
-}
-
-//
-
-int main(void) {
+#ifdef HEADLESS_ONLY
+    fprintf(stderr, "Built without the viewer, expected --headless WIDTHxHEIGHT. \n");
+    return 1;
+#else
     is_running = initialize_window();
 
     if (!is_running) {
@@ -415,7 +365,9 @@ int main(void) {
     }
 
     // game loop
-    setup();
+    if (!setup()) {
+        return 1;
+    }
 
     while (is_running) {
         process_input();
@@ -426,4 +378,5 @@ int main(void) {
     destroy_window();
     free_resources();
     return 0;
+#endif
 }
@@ -1,16 +1,18 @@
 #include "mesh.h"
 #include "array.h"
+#include "file.h"
+#include "lod.h"
+#include "mesh_cache.h"
+#include "meshlet.h"
+#include "obj.h"
+#include "stats.h"
+#include "vcache.h"
+#include "weld.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-mesh_t mesh = {.vertices = NULL,
-               .faces = NULL,
-               .rotation = {0, 0, 0},
-               .scale = {1.0, 1.0, 1.0},
-               .translation = {0, 0, 0}};
-
 vec3_t cube_vertices[N_CUBE_VERTICES] = {
     {.x = -1, .y = -1, .z = -1}, // 0
     {.x = -1, .y = 1, .z = -1},  // 1
@@ -44,72 +46,199 @@ face_t cube_faces[N_CUBE_FACES] = {
     { .a = 5, .b = 0, .c = 3, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF }
 };
 
-void load_cube_mesh_data(void)
+void load_cube_mesh_data(mesh_t *mesh)
 {
     for (int i = 0; i < N_CUBE_VERTICES; i++)
     {
         vec3_t cube_vertice = cube_vertices[i];
-        array_push(mesh.vertices, cube_vertice);
+        array_push(mesh->vertices, cube_vertice);
     }
     for (int i = 0; i < N_CUBE_FACES; i++)
     {
         face_t cube_face = cube_faces[i];
-        array_push(mesh.faces, cube_face);
+        array_push(mesh->faces, cube_face);
+    }
+    if (array_length(mesh->vertices) != N_CUBE_VERTICES ||
+        array_length(mesh->faces) != N_CUBE_FACES)
+    {
+        fprintf(stderr, "Error allocating memory for the cube mesh. \n");
+        return;
+    }
+    mesh_compute_bounds(mesh);
+    if (!weld_mesh(mesh))
+    {
+        fprintf(stderr, "Error welding the cube mesh. \n");
+        return;
+    }
+    if (!build_lods(mesh))
+    {
+        fprintf(stderr, "Error simplifying the cube mesh. \n");
+    }
+    if (!build_meshlets(mesh))
+    {
+        fprintf(stderr, "Error splitting the cube mesh into meshlets. \n");
+    }
+    if (!vcache_optimize(mesh))
+    {
+        fprintf(stderr, "Error reordering the cube mesh for the vertex cache. \n");
     }
 }
 
-void load_obj_file_data(char *filename)
+bool load_obj_file_data(mesh_t *mesh, const char *filename)
 {
-    FILE *file;
+    double start = stats_now_ms();
+
+    // the arrays of a cached mesh point into its read only mapping, and can't
+    // grow
+    if (mesh->cached)
+    {
+        fprintf(stderr, "Error loading mesh %s: can't append to a mesh loaded from its "
+                        "cache. \n",
+                filename);
+        return false;
+    }
 
-    file = fopen(filename, "r");
+    if (mesh_cache_load(mesh, filename))
+    {
+        printf("Loaded %s from its cache: %d vertices, %d faces in %.2f ms\n", filename,
+               array_length(mesh->vertices), array_length(mesh->faces),
+               stats_now_ms() - start);
+        return true;
+    }
 
-    char line[1024];
+    file_source_t file;
+    if (!file_source_open(&file, filename))
+    {
+        fprintf(stderr, "Error loading mesh %s. \n", filename);
+        return false;
+    }
 
-    tex2_t *texcoords = NULL;
+    // only a mesh holding nothing but this file can be cached
+    bool cacheable = mesh->vertices == NULL && mesh->faces == NULL;
 
-    while (fgets(line, 1024, file))
+    enum obj_result result = obj_parse(mesh, (const char *)file.data, file.size);
+    if (result == OBJ_OUT_OF_MEMORY)
     {
-        // vertex information
-        if (strncmp(line, "v  ", 2) == 0)
+        fprintf(stderr, "Error allocating memory for mesh %s. \n", filename);
+        file_source_close(&file);
+        return false;
+    }
+    bool parsed = result == OBJ_OK;
+    if (!parsed)
+    {
+        fprintf(stderr, "Error parsing mesh %s, malformed faces were left out. \n",
+                filename);
+    }
+    mesh_compute_bounds(mesh);
+    float acmr_before = 0, acmr_after = 0;
+    if (weld_mesh(mesh))
+    {
+        // simplify the faces into levels of detail, group neighbouring faces
+        // of each level into meshlets, then reorder the faces of each meshlet
+        // so shared vertices are reused while still cached
+        acmr_before = vcache_acmr(mesh, VCACHE_SIZE);
+        if (!build_lods(mesh))
         {
-            vec3_t vertex;
-            sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-            array_push(mesh.vertices, vertex);
+            fprintf(stderr, "Error simplifying mesh %s. \n", filename);
+            parsed = false;
         }
-
-        //  texture coordinate information
-        if (strncmp(line, "vt ", 3) == 0)
+        if (!build_meshlets(mesh))
         {
-            tex2_t texcoord;
-            sscanf(line, "vt %f %f", &texcoord.u, &texcoord.v);
-            array_push(texcoords, texcoord);
+            fprintf(stderr, "Error splitting mesh %s into meshlets. \n", filename);
+            parsed = false;
         }
-
-        // face information
-        if (strncmp(line, "f  ", 2) == 0)
+        if (!vcache_optimize(mesh))
         {
-            int vertex_indices[3];
-            int texture_indices[3];
-            int normal_indeces[3];
-            sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &vertex_indices[0],
-                   &texture_indices[0], &normal_indeces[0], &vertex_indices[1],
-                   &texture_indices[1], &normal_indeces[1], &vertex_indices[2],
-                   &texture_indices[2], &normal_indeces[2]
-
-            );
-            face_t face = {.a = vertex_indices[0] -1,
-                           .b = vertex_indices[1] -1,
-                           .c = vertex_indices[2] -1,
-                           .a_uv = texcoords[texture_indices[0] -1],
-                           .b_uv = texcoords[texture_indices[1] -1],
-                           .c_uv = texcoords[texture_indices[2] -1],
-                           .color = 0xFFFFFFFF};
-            array_push(mesh.faces, face);
+            fprintf(stderr, "Error reordering mesh %s for the vertex cache. \n", filename);
+            parsed = false;
         }
+        acmr_after = vcache_acmr(mesh, VCACHE_SIZE);
     }
-    array_free(texcoords);
+    else
+    {
+        fprintf(stderr, "Error welding mesh %s. \n", filename);
+        parsed = false;
+    }
+
+    double elapsed = stats_now_ms() - start;
+    printf("Loaded %s: %d vertices, %d faces in %.2f ms (%.1f MB/s)\n", filename,
+           array_length(mesh->vertices), array_length(mesh->faces), elapsed,
+           file.size / 1e6 / (elapsed > 0 ? elapsed / 1000.0 : 1));
+
+    // what the frame loop reads for the faces, before and after welding
+    long face_bytes = array_length(mesh->faces) * (long)sizeof(face_t) +
+                      array_length(mesh->vertices) * (long)sizeof(vec3_t);
+    long welded_bytes = array_length(mesh->vertex_buffer) * (long)sizeof(mesh_vertex_t) +
+                        array_length(mesh->index_buffer) * (long)mesh->index_size;
+    printf("Welded into %d vertices with %d-bit indices: %.1f KB instead of %.1f KB\n",
+           array_length(mesh->vertex_buffer), mesh->index_size * 8, welded_bytes / 1024.0,
+           face_bytes / 1024.0);
+    printf("Reordered faces for the vertex cache: ACMR %.3f -> %.3f\n", acmr_before,
+           acmr_after);
+    printf("Split into %d meshlets\n", array_length(mesh->meshlets));
+    printf("Levels of detail:");
+    for (int i = 0; i < array_length(mesh->lods); i++)
+    {
+        printf(" %u faces (error %.4f)", mesh->lods[i].num_triangles, mesh->lods[i].error);
+    }
+    printf("\n");
 
     // Close the file
-    fclose(file);
+    file_source_close(&file);
+
+    // a failed write only costs the next load a parse
+    if (parsed && cacheable && !mesh_cache_write(mesh, filename))
+    {
+        fprintf(stderr, "Could not write the cache of mesh %s. \n", filename);
+    }
+    return true;
+}
+
+void mesh_compute_bounds(mesh_t *mesh)
+{
+    int num_vertices = array_length(mesh->vertices);
+    if (num_vertices == 0)
+    {
+        mesh->bounds_min = mesh->bounds_max = (vec3_t){0, 0, 0};
+        return;
+    }
+
+    vec3_t min = mesh->vertices[0];
+    vec3_t max = mesh->vertices[0];
+    for (int i = 1; i < num_vertices; i++)
+    {
+        vec3_t v = mesh->vertices[i];
+        min.x = v.x < min.x ? v.x : min.x;
+        min.y = v.y < min.y ? v.y : min.y;
+        min.z = v.z < min.z ? v.z : min.z;
+        max.x = v.x > max.x ? v.x : max.x;
+        max.y = v.y > max.y ? v.y : max.y;
+        max.z = v.z > max.z ? v.z : max.z;
+    }
+    mesh->bounds_min = min;
+    mesh->bounds_max = max;
+}
+
+void free_mesh(mesh_t *mesh)
+{
+    if (mesh->cached)
+    {
+        file_source_close(&mesh->cache);
+        mesh->cached = false;
+    }
+    else
+    {
+        array_free(mesh->faces);
+        array_free(mesh->vertices);
+        array_free(mesh->vertex_buffer);
+        array_free(mesh->index_buffer);
+        array_free(mesh->meshlets);
+        array_free(mesh->lods);
+    }
+    mesh->faces = NULL;
+    mesh->vertices = NULL;
+    mesh->vertex_buffer = NULL;
+    mesh->index_buffer = NULL;
+    mesh->meshlets = NULL;
+    mesh->lods = NULL;
 }
@@ -1,8 +1,11 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include "file.h"
 #include "triangle.h"
 #include "vector.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 #define N_CUBE_VERTICES 8
 #define N_CUBE_FACES (6 * 2) // 6 cube faces, 2 triangles per face
@@ -10,18 +13,74 @@
 extern vec3_t cube_vertices[N_CUBE_VERTICES];
 extern face_t cube_faces[N_CUBE_FACES];
 
+// One corner of the welded geometry. Faces that share a position, texture
+// coordinate and color share the vertex; a triangle takes its color from its
+// first vertex
+typedef struct {
+    vec3_t position;
+    tex2_t uv;
+    color_t color;
+} mesh_vertex_t;
+
+// A run of consecutive triangles of the index buffer, culled as a whole.
+// Every point of it lies in the bounding sphere and every face normal in the
+// cone around cone_axis
+typedef struct {
+    uint32_t first_index;
+    uint32_t num_triangles;
+    vec3_t center;
+    float radius;
+    vec3_t cone_axis;
+    float cone_cutoff; // sine of the cone's half angle, above 1 for no cone
+} meshlet_t;
+
+// One level of detail: a run of the index buffer and of the meshlets, with
+// how far, in model units, its surface may stray from the full detail mesh
+typedef struct {
+    uint32_t first_index;
+    uint32_t num_triangles;
+    uint32_t first_meshlet;
+    uint32_t num_meshlets;
+    uint32_t num_vertices; // the level only uses this prefix of the vertex buffer
+    float error;
+} mesh_lod_t;
+
 // define a struct for dynamic sized mesh
 typedef struct {
     vec3_t *vertices;   // dynamic array of vertices
     face_t *faces;      // dynamic array of faces
-    vec3_t rotation;    // x y z rotation values
-    vec3_t scale;       // scale with x, y, and z values
-    vec3_t translation; // translation with x, y and z values
+    vec3_t bounds_min;  // bounding box of the vertices, in model space
+    vec3_t bounds_max;
+
+    // the faces welded into indexed geometry, which is what gets drawn: a
+    // dynamic array of distinct corners and one of three indices per face,
+    // 16-bit when there are few enough vertices and 32-bit otherwise
+    mesh_vertex_t *vertex_buffer;
+    void *index_buffer;
+    int index_size;
+    meshlet_t *meshlets; // dynamic array covering the index buffer in order
+    mesh_lod_t *lods;    // dynamic array, full detail first
+
+    // set when the arrays point into a mapped mesh cache rather than being
+    // allocated; they are then read only
+    bool cached;
+    file_source_t cache;
 } mesh_t;
 
-extern mesh_t mesh;
+// Load the built-in cube into an empty mesh
+void load_cube_mesh_data(mesh_t *mesh);
+// Load into an empty mesh, or append to one holding allocated arrays, not one
+// loaded from its cache; meshes are placed in the world by the scene
+// instances that draw them. Returns false if the file couldn't be opened or
+// parsed for lack of memory, or the mesh was loaded from its cache
+bool load_obj_file_data(mesh_t *mesh, const char *filename);
+void mesh_compute_bounds(mesh_t *mesh);
+void free_mesh(mesh_t *mesh);
 
-void load_cube_mesh_data(void);
-void load_obj_file_data(char *filename);
+// Index i of the index buffer
+static inline uint32_t mesh_index(const mesh_t *mesh, int i) {
+    return mesh->index_size == 2 ? ((const uint16_t *)mesh->index_buffer)[i]
+                                 : ((const uint32_t *)mesh->index_buffer)[i];
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,268 @@
+#include "mesh_cache.h"
+#include "array.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MESH_CACHE_MAGIC "MESHBIN"
+#define MESH_CACHE_BYTE_ORDER 0x01020304u
+
+// Sections start on a cache line, each preceded by the length prefix of
+// array.h, so the mapped sections can be used as mesh arrays as they are
+#define MESH_CACHE_ALIGNMENT 64
+#define ARRAY_PREFIX_SIZE (2 * sizeof(int))
+
+// The arrays of a mesh, in the order they are stored
+enum mesh_cache_section {
+    SECTION_POSITIONS,
+    SECTION_FACES,
+    SECTION_VERTEX_BUFFER,
+    SECTION_INDEX_BUFFER,
+    SECTION_MESHLETS,
+    SECTION_LODS,
+    NUM_SECTIONS
+};
+
+typedef struct {
+    uint64_t offset; // of the first item, after its array prefix
+    uint32_t count;
+    uint32_t item_size;
+} mesh_cache_section_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // MESH_CACHE_BYTE_ORDER as written by this machine
+
+    // the OBJ file the cache was built from
+    uint64_t source_size;
+    int64_t source_mtime;
+
+    mesh_cache_section_t sections[NUM_SECTIONS];
+    uint64_t file_size;
+
+    vec3_t bounds_min;
+    vec3_t bounds_max;
+
+    uint32_t checksum; // of all the sections
+} mesh_cache_header_t;
+
+static char *cache_filename(const char *obj_filename) {
+    size_t length = strlen(obj_filename);
+    char *filename = malloc(length + sizeof(MESH_CACHE_EXTENSION));
+    if (filename) {
+        memcpy(filename, obj_filename, length);
+        memcpy(filename + length, MESH_CACHE_EXTENSION, sizeof(MESH_CACHE_EXTENSION));
+    }
+    return filename;
+}
+
+static bool source_info(const char *obj_filename, uint64_t *size, int64_t *mtime) {
+    struct stat info;
+    if (stat(obj_filename, &info) != 0) {
+        return false;
+    }
+    *size = (uint64_t)info.st_size;
+    *mtime = (int64_t)info.st_mtime;
+    return true;
+}
+
+// Hash 4 bytes at a time, then whatever is left of a 16-bit index buffer
+static uint32_t checksum_section(const void *data, size_t size, uint32_t hash) {
+    const uint8_t *bytes = data;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        uint32_t word;
+        memcpy(&word, &bytes[i], sizeof(word));
+        hash = (hash ^ word) * 16777619u;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t checksum_sections(const mesh_cache_section_t *sections,
+                                  const void *const *data) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        hash = checksum_section(data[i], (size_t)sections[i].count * sections[i].item_size,
+                                hash);
+    }
+    return hash;
+}
+
+static uint64_t section_end(const mesh_cache_section_t *section) {
+    return section->offset + (uint64_t)section->count * section->item_size;
+}
+
+static uint64_t section_offset(uint64_t end) {
+    uint64_t offset = end + ARRAY_PREFIX_SIZE;
+    return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static bool valid_header(const mesh_cache_header_t *header, size_t file_size,
+                         uint64_t source_size, int64_t source_mtime) {
+    if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MESH_CACHE_VERSION ||
+        header->byte_order != MESH_CACHE_BYTE_ORDER ||
+        header->source_size != source_size || header->source_mtime != source_mtime ||
+        header->file_size != file_size) {
+        return false;
+    }
+
+    const mesh_cache_section_t *sections = header->sections;
+    uint32_t index_size = sections[SECTION_INDEX_BUFFER].item_size;
+    if (sections[SECTION_POSITIONS].item_size != sizeof(vec3_t) ||
+        sections[SECTION_FACES].item_size != sizeof(face_t) ||
+        sections[SECTION_VERTEX_BUFFER].item_size != sizeof(mesh_vertex_t) ||
+        sections[SECTION_MESHLETS].item_size != sizeof(meshlet_t) ||
+        sections[SECTION_LODS].item_size != sizeof(mesh_lod_t) ||
+        (index_size != 2 && index_size != 4)) {
+        return false;
+    }
+
+    // the sections have to be where the writer puts them
+    uint64_t end = sizeof(*header);
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        if (sections[i].offset != section_offset(end) || sections[i].count > INT32_MAX) {
+            return false;
+        }
+        end = section_end(&sections[i]);
+    }
+    return end <= file_size;
+}
+
+bool mesh_cache_load(mesh_t *mesh, const char *obj_filename) {
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (mesh->vertices || mesh->faces ||
+        !source_info(obj_filename, &source_size, &source_mtime)) {
+        return false;
+    }
+
+    char *filename = cache_filename(obj_filename);
+    file_source_t cache;
+    bool opened = filename && file_source_open(&cache, filename);
+    free(filename);
+    if (!opened) {
+        return false;
+    }
+
+    const mesh_cache_header_t *header = (const mesh_cache_header_t *)cache.data;
+    if (cache.size < sizeof(*header) ||
+        !valid_header(header, cache.size, source_size, source_mtime)) {
+        file_source_close(&cache);
+        return false;
+    }
+
+    void *data[NUM_SECTIONS];
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        data[i] = header->sections[i].count
+                      ? (void *)(cache.data + header->sections[i].offset)
+                      : NULL;
+    }
+    if (checksum_sections(header->sections, (const void *const *)data) != header->checksum) {
+        file_source_close(&cache);
+        return false;
+    }
+
+    // The arrays stay in the mapping, which the mesh keeps open. They are
+    // read only: nothing may push to them
+    mesh->vertices = data[SECTION_POSITIONS];
+    mesh->faces = data[SECTION_FACES];
+    mesh->vertex_buffer = data[SECTION_VERTEX_BUFFER];
+    mesh->index_buffer = data[SECTION_INDEX_BUFFER];
+    mesh->index_size = header->sections[SECTION_INDEX_BUFFER].item_size;
+    mesh->meshlets = data[SECTION_MESHLETS];
+    mesh->lods = data[SECTION_LODS];
+    mesh->bounds_min = header->bounds_min;
+    mesh->bounds_max = header->bounds_max;
+    mesh->cache = cache;
+    mesh->cached = true;
+    return true;
+}
+
+static bool write_section(FILE *file, uint64_t *position,
+                          const mesh_cache_section_t *section, const void *data) {
+    static const uint8_t padding[MESH_CACHE_ALIGNMENT] = {0};
+    // capacity and length, as in array.h
+    int prefix[2] = {(int)section->count, (int)section->count};
+
+    size_t padding_size = section->offset - ARRAY_PREFIX_SIZE - *position;
+    bool ok = fwrite(padding, 1, padding_size, file) == padding_size &&
+              fwrite(prefix, sizeof(prefix), 1, file) == 1 &&
+              (section->count == 0 ||
+               fwrite(data, section->item_size, section->count, file) == section->count);
+    *position = section_end(section);
+    return ok;
+}
+
+bool mesh_cache_write(const mesh_t *mesh, const char *obj_filename) {
+    mesh_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    if (!source_info(obj_filename, &header.source_size, &header.source_mtime)) {
+        return false;
+    }
+
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.byte_order = MESH_CACHE_BYTE_ORDER;
+
+    const void *data[NUM_SECTIONS] = {mesh->vertices, mesh->faces, mesh->vertex_buffer,
+                                      mesh->index_buffer, mesh->meshlets, mesh->lods};
+    uint32_t counts[NUM_SECTIONS] = {
+        array_length(mesh->vertices), array_length(mesh->faces),
+        array_length(mesh->vertex_buffer), array_length(mesh->index_buffer),
+        array_length(mesh->meshlets), array_length(mesh->lods)};
+    uint32_t item_sizes[NUM_SECTIONS] = {sizeof(vec3_t), sizeof(face_t),
+                                         sizeof(mesh_vertex_t), mesh->index_size,
+                                         sizeof(meshlet_t), sizeof(mesh_lod_t)};
+    uint64_t end = sizeof(header);
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        header.sections[i].offset = section_offset(end);
+        header.sections[i].count = counts[i];
+        header.sections[i].item_size = item_sizes[i];
+        end = section_end(&header.sections[i]);
+    }
+    header.file_size = end;
+    header.bounds_min = mesh->bounds_min;
+    header.bounds_max = mesh->bounds_max;
+    header.checksum = checksum_sections(header.sections, data);
+
+    // write to a temporary file and rename it into place, so a reader never
+    // maps a half written cache
+    char *filename = cache_filename(obj_filename);
+    if (!filename) {
+        return false;
+    }
+    size_t length = strlen(filename);
+    char *temporary = malloc(length + sizeof(".tmp"));
+    if (!temporary) {
+        free(filename);
+        return false;
+    }
+    memcpy(temporary, filename, length);
+    memcpy(temporary + length, ".tmp", sizeof(".tmp"));
+
+    FILE *file = fopen(temporary, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        uint64_t position = sizeof(header);
+        ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        for (int i = 0; i < NUM_SECTIONS && ok; i++) {
+            ok = write_section(file, &position, &header.sections[i], data[i]);
+        }
+        ok = fclose(file) == 0 && ok;
+        ok = ok && rename(temporary, filename) == 0;
+        if (!ok) {
+            remove(temporary);
+        }
+    }
+
+    free(temporary);
+    free(filename);
+    return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mesh.h"
+#include <stdbool.h>
+
+// A parsed and welded mesh is written in a binary format next to its OBJ
+// file, as <file>.obj.mesh, and later loads map it straight into the mesh
+// instead of parsing the OBJ again. The cache is rebuilt whenever the OBJ's size or
+// modification time no longer match the ones it was built from
+#define MESH_CACHE_EXTENSION ".mesh"
+#define MESH_CACHE_VERSION 6
+
+// Point an empty mesh at the mapped arrays of the cache of obj_filename.
+// Returns false if there is no valid, up to date cache
+bool mesh_cache_load(mesh_t *mesh, const char *obj_filename);
+
+// Write the mesh as the cache of obj_filename
+bool mesh_cache_write(const mesh_t *mesh, const char *obj_filename);
+
+#endif
@@ -0,0 +1,257 @@
+#include "meshlet.h"
+#include "array.h"
+#include "weld.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cones wider than this (normals more than about 84 degrees from the axis)
+// could hardly ever be culled, so they aren't kept
+#define MESHLET_MIN_CONE_DOT 0.1f
+#define MESHLET_NO_CONE 2.0f
+
+// How much a triangle facing away from the meshlet so far counts against
+// it, in vertices it would add: up to two for one facing the opposite way
+#define MESHLET_CONE_WEIGHT 1.0f
+
+// The face normal as the geometry stage computes it for backface culling,
+// or a zero vector for a degenerate face
+static vec3_t face_normal(vec3_t a, vec3_t b, vec3_t c) {
+    vec3_t normal = vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+    float length = vec3_length(normal);
+    return length > 0 ? vec3_div(normal, length) : (vec3_t){0, 0, 0};
+}
+
+static void finish_meshlet(const mesh_t *mesh, meshlet_t *meshlet) {
+    const mesh_vertex_t *vertices = mesh->vertex_buffer;
+    uint32_t end = meshlet->first_index + meshlet->num_triangles * 3;
+
+    // the sphere around the bounding box of the meshlet's corners
+    vec3_t min = vertices[mesh_index(mesh, meshlet->first_index)].position;
+    vec3_t max = min;
+    for (uint32_t i = meshlet->first_index; i < end; i++) {
+        vec3_t p = vertices[mesh_index(mesh, i)].position;
+        min = (vec3_t){fminf(min.x, p.x), fminf(min.y, p.y), fminf(min.z, p.z)};
+        max = (vec3_t){fmaxf(max.x, p.x), fmaxf(max.y, p.y), fmaxf(max.z, p.z)};
+    }
+    meshlet->center = vec3_mul(vec3_add(min, max), 0.5f);
+    meshlet->radius = 0;
+    for (uint32_t i = meshlet->first_index; i < end; i++) {
+        float distance =
+            vec3_length(vec3_sub(vertices[mesh_index(mesh, i)].position, meshlet->center));
+        meshlet->radius = fmaxf(meshlet->radius, distance);
+    }
+
+    // the cone axis is the average normal; a degenerate face has no normal
+    // to bound, and is drawn whichever way it faces, so it rules out a cone
+    vec3_t normals[MESHLET_MAX_TRIANGLES];
+    vec3_t axis = {0, 0, 0};
+    bool has_cone = true;
+    for (uint32_t t = 0; t < meshlet->num_triangles; t++) {
+        uint32_t i = meshlet->first_index + t * 3;
+        normals[t] = face_normal(vertices[mesh_index(mesh, i)].position,
+                                 vertices[mesh_index(mesh, i + 1)].position,
+                                 vertices[mesh_index(mesh, i + 2)].position);
+        has_cone = has_cone && vec3_length(normals[t]) > 0;
+        axis = vec3_add(axis, normals[t]);
+    }
+
+    float length = vec3_length(axis);
+    float min_dot = 1;
+    if (has_cone && length > 0) {
+        axis = vec3_div(axis, length);
+        for (uint32_t t = 0; t < meshlet->num_triangles; t++) {
+            min_dot = fminf(min_dot, vec3_dot(axis, normals[t]));
+        }
+    }
+    meshlet->cone_axis = axis;
+    meshlet->cone_cutoff = has_cone && length > 0 && min_dot > MESHLET_MIN_CONE_DOT
+                               ? sqrtf(1 - min_dot * min_dot)
+                               : MESHLET_NO_CONE;
+}
+
+bool build_meshlets(mesh_t *mesh) {
+    int num_vertices = array_length(mesh->vertex_buffer);
+    int num_triangles = array_length(mesh->index_buffer) / 3;
+
+    int num_positions = 0;
+    int *position_of = weld_position_ids(mesh, &num_positions);
+    int *first_triangle = malloc((num_positions + 1) * sizeof(int));
+    int *position_triangles = malloc((num_triangles * 3 + 1) * sizeof(int));
+    int *triangles_left = calloc(num_positions + 1, sizeof(int));
+    int *vertex_meshlet = malloc((num_vertices + 1) * sizeof(int));
+    int *position_meshlet = malloc((num_positions + 1) * sizeof(int));
+    bool *assigned = calloc(num_triangles + 1, sizeof(bool));
+    vec3_t *normals = malloc((num_triangles + 1) * sizeof(vec3_t));
+    uint32_t *indices = malloc((num_triangles * 3 + 1) * sizeof(uint32_t));
+    bool ok = position_of && first_triangle && position_triangles && triangles_left &&
+              vertex_meshlet && position_meshlet && assigned && normals && indices;
+
+    meshlet_t *meshlets = NULL;
+    if (ok) {
+        for (int v = 0; v < num_vertices; v++) {
+            vertex_meshlet[v] = -1;
+        }
+        for (int p = 0; p < num_positions; p++) {
+            position_meshlet[p] = -1;
+        }
+        for (int t = 0; t < num_triangles; t++) {
+            normals[t] = face_normal(mesh->vertex_buffer[mesh_index(mesh, t * 3)].position,
+                                     mesh->vertex_buffer[mesh_index(mesh, t * 3 + 1)].position,
+                                     mesh->vertex_buffer[mesh_index(mesh, t * 3 + 2)].position);
+        }
+    }
+
+    // Each level of detail is split on its own, so its meshlets are a run of
+    // the meshlet array as its faces are of the index buffer
+    int num_lods = array_length(mesh->lods);
+    int num_emitted = 0;
+    for (int l = 0; ok && l < (num_lods > 0 ? num_lods : 1); l++) {
+        int range_start = num_lods > 0 ? (int)mesh->lods[l].first_index / 3 : 0;
+        int range_end =
+            num_lods > 0 ? range_start + (int)mesh->lods[l].num_triangles : num_triangles;
+        if (num_lods > 0) {
+            mesh->lods[l].first_meshlet = array_length(meshlets);
+        }
+
+        // the triangles around each position; those put in a meshlet are
+        // moved past the end of the list, so only ones left are scanned
+        memset(triangles_left, 0, num_positions * sizeof(int));
+        for (int i = range_start * 3; i < range_end * 3; i++) {
+            triangles_left[position_of[mesh_index(mesh, i)]]++;
+        }
+        first_triangle[0] = 0;
+        for (int p = 0; p < num_positions; p++) {
+            first_triangle[p + 1] = first_triangle[p] + triangles_left[p];
+            triangles_left[p] = 0;
+        }
+        for (int i = range_start * 3; i < range_end * 3; i++) {
+            int p = position_of[mesh_index(mesh, i)];
+            position_triangles[first_triangle[p] + triangles_left[p]++] = i / 3;
+        }
+
+        // Grow each meshlet from the first triangle left, one neighbouring
+        // triangle at a time: the one adding the fewest vertices, and among
+        // those the one facing most like the meshlet so far
+        int positions[MESHLET_MAX_TRIANGLES * 3];
+        for (int seed = range_start; ok && seed < range_end; seed++) {
+            if (assigned[seed]) {
+                continue;
+            }
+
+            int current = array_length(meshlets);
+            meshlet_t meshlet = {.first_index = num_emitted * 3};
+            int num_meshlet_vertices = 0, num_meshlet_positions = 0;
+            vec3_t normal_sum = {0, 0, 0};
+            int next = seed;
+
+            while (next >= 0) {
+                assigned[next] = true;
+                for (int j = 0; j < 3; j++) {
+                    uint32_t v = mesh_index(mesh, next * 3 + j);
+                    int p = position_of[v];
+                    int *list = &position_triangles[first_triangle[p]];
+                    for (int k = 0; k < triangles_left[p]; k++) {
+                        if (list[k] == next) {
+                            list[k] = list[--triangles_left[p]];
+                            break;
+                        }
+                    }
+                    indices[num_emitted * 3 + j] = v;
+                    if (vertex_meshlet[v] != current) {
+                        vertex_meshlet[v] = current;
+                        num_meshlet_vertices++;
+                    }
+                    if (position_meshlet[p] != current) {
+                        position_meshlet[p] = current;
+                        positions[num_meshlet_positions++] = p;
+                    }
+                }
+                num_emitted++;
+                meshlet.num_triangles++;
+                normal_sum = vec3_add(normal_sum, normals[next]);
+                if (meshlet.num_triangles == MESHLET_MAX_TRIANGLES) {
+                    break;
+                }
+
+                float length = vec3_length(normal_sum);
+                vec3_t direction =
+                    length > 0 ? vec3_div(normal_sum, length) : (vec3_t){0, 0, 0};
+                float best_score = 0;
+                next = -1;
+                for (int k = 0; k < num_meshlet_positions; k++) {
+                    int p = positions[k];
+                    if (triangles_left[p] == 0) {
+                        // nothing more to grow into from here
+                        positions[k--] = positions[--num_meshlet_positions];
+                        continue;
+                    }
+                    const int *list = &position_triangles[first_triangle[p]];
+                    for (int n = 0; n < triangles_left[p]; n++) {
+                        int t = list[n];
+                        int new_vertices = 0;
+                        for (int j = 0; j < 3; j++) {
+                            uint32_t v = mesh_index(mesh, t * 3 + j);
+                            bool repeated = (j > 0 && v == mesh_index(mesh, t * 3)) ||
+                                            (j > 1 && v == mesh_index(mesh, t * 3 + 1));
+                            new_vertices += vertex_meshlet[v] != current && !repeated;
+                        }
+                        if (num_meshlet_vertices + new_vertices > MESHLET_MAX_VERTICES) {
+                            continue;
+                        }
+                        float score = new_vertices + MESHLET_CONE_WEIGHT *
+                                                         (1 - vec3_dot(direction, normals[t]));
+                        if (next < 0 || score < best_score) {
+                            best_score = score;
+                            next = t;
+                        }
+                    }
+                }
+            }
+            array_push(meshlets, meshlet);
+            ok = array_length(meshlets) > current;
+        }
+
+        if (num_lods > 0) {
+            mesh->lods[l].num_meshlets = array_length(meshlets) - mesh->lods[l].first_meshlet;
+        }
+    }
+
+    if (ok) {
+        // the index buffer now runs through the meshlets in order
+        for (int i = 0; i < num_triangles * 3; i++) {
+            if (mesh->index_size == 2) {
+                ((uint16_t *)mesh->index_buffer)[i] = (uint16_t)indices[i];
+            } else {
+                ((uint32_t *)mesh->index_buffer)[i] = indices[i];
+            }
+        }
+        for (int m = 0; m < array_length(meshlets); m++) {
+            finish_meshlet(mesh, &meshlets[m]);
+        }
+        array_free(mesh->meshlets);
+        mesh->meshlets = meshlets;
+    } else {
+        array_free(meshlets);
+    }
+
+    free(position_of);
+    free(first_triangle);
+    free(position_triangles);
+    free(triangles_left);
+    free(vertex_meshlet);
+    free(position_meshlet);
+    free(assigned);
+    free(normals);
+    free(indices);
+    return ok;
+}
+
+bool meshlet_backfacing(const meshlet_t *meshlet, vec3_t center, float radius,
+                        vec3_t cone_axis) {
+    // every point of the sphere is behind every plane the cone's normals
+    // allow, as seen from the origin
+    return vec3_dot(center, cone_axis) >=
+           meshlet->cone_cutoff * vec3_length(center) + radius;
+}
@@ -0,0 +1,22 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "mesh.h"
+#include <stdbool.h>
+
+// Meshlets are grown from neighbouring faces facing roughly the same way, up
+// to these limits, so their spheres are tight and their normal cones narrow
+#define MESHLET_MAX_TRIANGLES 128
+#define MESHLET_MAX_VERTICES 64
+
+// Split the mesh's faces into meshlets, reordering the index buffer so each
+// one is a run of it. Each level of detail gets meshlets of its own. Returns
+// false if out of memory, leaving the mesh as it was
+bool build_meshlets(mesh_t *mesh);
+
+// Whether every face of a meshlet faces away from a camera at the origin,
+// given its bounding sphere and cone axis in camera space
+bool meshlet_backfacing(const meshlet_t *meshlet, vec3_t center, float radius,
+                        vec3_t cone_axis);
+
+#endif
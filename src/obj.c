@@ -0,0 +1,490 @@
+#include "obj.h"
+#include "array.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Files are only split up when every thread gets at least this much of them
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+#define OBJ_MAX_CHUNKS 64
+
+// A face as written in the file, with its polygon already split into a
+// triangle. Indices are 0-based; negative OBJ indices count back from the last
+// vertex parsed, so those are kept relative to the start of the chunk of the
+// file they were parsed from, until all chunks have been counted
+typedef struct {
+    int v[3];
+    int vt[3];
+    unsigned char relative; // bit i set: v[i] is chunk relative, bit 3 + i: vt[i]
+    bool has_texcoords;
+} obj_face_t;
+
+// Where the chunks of a file are concatenated into
+typedef struct {
+    vec3_t *vertices;  // the file's vertices, inside the mesh
+    face_t *faces;     // the file's faces, inside the mesh
+    tex2_t *texcoords; // all texture coordinates of the file
+    int first_vertex;  // index of the file's first vertex in the mesh
+    int num_vertices;
+    int num_texcoords;
+} obj_output_t;
+
+// A stretch of whole lines of the file, parsed on its own thread
+typedef struct {
+    const char *start;
+    const char *end;
+
+    vec3_t *vertices;
+    tex2_t *texcoords;
+    obj_face_t *faces;
+    bool ok;
+    bool out_of_memory;
+
+    // where the chunk's elements go in the whole file, summed up from the
+    // chunks before it
+    int vertex_offset;
+    int texcoord_offset;
+    int face_offset;
+    const obj_output_t *output;
+} obj_chunk_t;
+
+int obj_threads = 0;
+
+// Append value to one of a chunk's arrays, noting when there was no memory
+#define chunk_push(chunk, array, value)                                             \
+    do {                                                                            \
+        int length_ = array_length(array);                                          \
+        array_push(array, value);                                                   \
+        if (array_length(array) == length_) {                                       \
+            (chunk)->out_of_memory = true;                                          \
+        }                                                                           \
+    } while (0)
+
+// Powers of ten that are exact in a float and in a double
+static const float FLOAT_POWERS_OF_10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                           1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+static const double DOUBLE_POWERS_OF_10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static bool is_space(char c) { return c == ' ' || c == '\t'; }
+
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char *skip_line(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+// Parse a decimal floating point number, always with '.' as the decimal point
+// whatever the locale. Returns the end of the number, or p if there is none
+static const char *parse_float(const char *p, const char *end, float *value) {
+    const char *start = p;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int num_digits = 0;
+    int exponent = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+
+    // up to 19 significant digits fit the mantissa, the rest only scale it
+    const char *digits = p;
+    while (p < end && is_digit(*p)) {
+        if (num_digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            num_digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && is_digit(*p)) {
+            if (num_digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                num_digits += mantissa != 0;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p == digits || (p == digits + 1 && *digits == '.')) {
+        *value = 0;
+        return start;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *exponent_start = p++;
+        bool negative_exponent = false;
+        int e = 0;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative_exponent = *p++ == '-';
+        }
+        if (p < end && is_digit(*p)) {
+            while (p < end && is_digit(*p)) {
+                if (e < 10000) {
+                    e = e * 10 + (*p - '0');
+                }
+                p++;
+            }
+            exponent += negative_exponent ? -e : e;
+        } else {
+            p = exponent_start;
+        }
+    }
+
+    // A mantissa and a power of ten both exact in a float give a correctly
+    // rounded float in one multiply or divide, which covers the usual six
+    // decimal places of exporters. Longer numbers go through double
+    float result;
+    if (mantissa == 0) {
+        result = 0;
+    } else if (mantissa <= (1 << 24) && exponent >= -10 && exponent <= 10) {
+        result = exponent < 0 ? (float)mantissa / FLOAT_POWERS_OF_10[-exponent]
+                              : (float)mantissa * FLOAT_POWERS_OF_10[exponent];
+    } else if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        result = (float)(exponent < 0 ? (double)mantissa / DOUBLE_POWERS_OF_10[-exponent]
+                                      : (double)mantissa * DOUBLE_POWERS_OF_10[exponent]);
+    } else {
+        result = (float)((double)mantissa * pow(10.0, exponent));
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+// Parse a decimal integer. Returns the end of the number, or p if there is none
+static const char *parse_int(const char *p, const char *end, int *value) {
+    const char *start = p;
+    bool negative = false;
+    int result = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    if (p == end || !is_digit(*p)) {
+        *value = 0;
+        return start;
+    }
+    while (p < end && is_digit(*p)) {
+        if (result < 100000000) {
+            result = result * 10 + (*p - '0');
+        }
+        p++;
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+// Turn an OBJ index into a 0-based one. Negative indices count back from the
+// count elements parsed so far in this chunk, which makes them relative
+static int obj_index(int index, int count, bool *relative) {
+    *relative = index < 0;
+    return index < 0 ? count + index : index - 1;
+}
+
+// Parse one "v", "v/vt", "v//vn" or "v/vt/vn" corner of a face into the
+// corner-th indices of face. Returns the end of the corner, or p if there is none
+static const char *parse_corner(const char *p, const char *end, const obj_chunk_t *chunk,
+                                obj_face_t *face, int corner, bool *has_texcoords) {
+    int v, vt = 0, vn;
+    bool relative;
+
+    const char *next = parse_int(p, end, &v);
+    if (next == p || v == 0) {
+        return p;
+    }
+    p = next;
+    if (p < end && *p == '/') {
+        p = parse_int(p + 1, end, &vt);
+        if (p < end && *p == '/') {
+            p = parse_int(p + 1, end, &vn);
+        }
+    }
+
+    face->v[corner] = obj_index(v, array_length(chunk->vertices), &relative);
+    face->relative |= relative << corner;
+    if (vt != 0) {
+        face->vt[corner] = obj_index(vt, array_length(chunk->texcoords), &relative);
+        face->relative |= relative << (3 + corner);
+    } else {
+        face->vt[corner] = 0;
+        *has_texcoords = false;
+    }
+    return p;
+}
+
+// Parse the face line after its "f", as a fan of triangles around the first
+// corner
+static void parse_face(const char *p, const char *end, obj_chunk_t *chunk) {
+    obj_face_t face = {.relative = 0};
+    bool has_texcoords = true;
+    int num_corners = 0;
+
+    while (true) {
+        p = skip_spaces(p, end);
+        int corner = num_corners < 3 ? num_corners : 2;
+        const char *next = parse_corner(p, end, chunk, &face, corner, &has_texcoords);
+        if (next == p) {
+            break;
+        }
+        p = next;
+        num_corners++;
+
+        if (num_corners >= 3) {
+            face.has_texcoords = has_texcoords;
+            chunk_push(chunk, chunk->faces, face);
+
+            // the next triangle shares the first corner and this one
+            face.v[1] = face.v[2];
+            face.vt[1] = face.vt[2];
+            face.relative = (face.relative & ~((1 << 1) | (1 << 4))) |
+                            ((face.relative >> 1) & ((1 << 1) | (1 << 4)));
+            face.relative &= ~((1 << 2) | (1 << 5));
+        }
+    }
+
+    // a face needs at least three corners, and nothing else on its line
+    p = skip_spaces(p, end);
+    if (num_corners < 3 || (p < end && *p != '\n' && *p != '\r' && *p != '#')) {
+        chunk->ok = false;
+    }
+}
+
+// Parse the lines of a chunk
+static void *parse_chunk(void *arg) {
+    obj_chunk_t *chunk = arg;
+    const char *p = chunk->start;
+    const char *end = chunk->end;
+
+    while (p < end) {
+        p = skip_spaces(p, end);
+        size_t left = end - p;
+
+        if (left >= 2 && p[0] == 'v' && is_space(p[1])) {
+            vec3_t vertex;
+            p = skip_spaces(p + 2, end);
+            p = skip_spaces(parse_float(p, end, &vertex.x), end);
+            p = skip_spaces(parse_float(p, end, &vertex.y), end);
+            p = parse_float(p, end, &vertex.z);
+            chunk_push(chunk, chunk->vertices, vertex);
+        } else if (left >= 3 && p[0] == 'v' && p[1] == 't' && is_space(p[2])) {
+            tex2_t texcoord;
+            p = skip_spaces(p + 3, end);
+            p = skip_spaces(parse_float(p, end, &texcoord.u), end);
+            p = parse_float(p, end, &texcoord.v);
+            chunk_push(chunk, chunk->texcoords, texcoord);
+        } else if (left >= 2 && p[0] == 'f' && is_space(p[1])) {
+            parse_face(p + 2, end, chunk);
+        }
+
+        // anything else (normals, groups, materials, comments) is skipped
+        p = skip_line(p, end);
+    }
+    return NULL;
+}
+
+// Copy a chunk's vertices to the mesh and its faces, with indices made absolute
+// and texture coordinates looked up
+static void *resolve_chunk(void *arg) {
+    obj_chunk_t *chunk = arg;
+    const obj_output_t *output = chunk->output;
+
+    if (chunk->vertices) {
+        memcpy(&output->vertices[chunk->vertex_offset], chunk->vertices,
+               sizeof(vec3_t) * array_length(chunk->vertices));
+    }
+
+    face_t *faces = &output->faces[chunk->face_offset];
+    for (int i = 0; i < array_length(chunk->faces); i++) {
+        const obj_face_t *face = &chunk->faces[i];
+        int v[3];
+        tex2_t uv[3] = {{0, 0}, {0, 0}, {0, 0}};
+        bool valid = true;
+
+        for (int k = 0; k < 3; k++) {
+            v[k] = face->v[k] + ((face->relative >> k) & 1 ? chunk->vertex_offset : 0);
+            valid = valid && v[k] >= 0 && v[k] < output->num_vertices;
+            if (face->has_texcoords) {
+                int vt = face->vt[k] +
+                         ((face->relative >> (3 + k)) & 1 ? chunk->texcoord_offset : 0);
+                if (vt >= 0 && vt < output->num_texcoords) {
+                    uv[k] = output->texcoords[vt];
+                } else {
+                    valid = false;
+                }
+            }
+        }
+
+        // keep broken faces as degenerate triangles, which never draw
+        if (!valid) {
+            v[0] = v[1] = v[2] = 0;
+            chunk->ok = false;
+        }
+
+        faces[i] = (face_t){.a = output->first_vertex + v[0],
+                            .b = output->first_vertex + v[1],
+                            .c = output->first_vertex + v[2],
+                            .a_uv = uv[0],
+                            .b_uv = uv[1],
+                            .c_uv = uv[2],
+                            .color = 0xFFFFFFFF};
+    }
+    return NULL;
+}
+
+// Run work on every chunk, each on its own thread but the last, which runs on
+// the calling thread. Chunks whose thread can't be started run there too
+static void run_chunks(obj_chunk_t *chunks, int num_chunks, void *(*work)(void *)) {
+    pthread_t threads[OBJ_MAX_CHUNKS];
+    bool started[OBJ_MAX_CHUNKS];
+
+    for (int i = 0; i < num_chunks - 1; i++) {
+        started[i] = pthread_create(&threads[i], NULL, work, &chunks[i]) == 0;
+    }
+    work(&chunks[num_chunks - 1]);
+    for (int i = 0; i < num_chunks - 1; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            work(&chunks[i]);
+        }
+    }
+}
+
+// Split the file into chunks of whole lines, one per thread. Returns the
+// number of chunks
+static int split_chunks(obj_chunk_t *chunks, const char *data, size_t size) {
+    int num_chunks = obj_threads;
+    if (num_chunks <= 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t max_chunks = size / OBJ_MIN_CHUNK_SIZE;
+        num_chunks = num_cpus > 0 ? (int)num_cpus : 1;
+        if ((size_t)num_chunks > max_chunks) {
+            num_chunks = max_chunks > 0 ? (int)max_chunks : 1;
+        }
+    }
+    if (num_chunks > OBJ_MAX_CHUNKS) {
+        num_chunks = OBJ_MAX_CHUNKS;
+    }
+
+    const char *start = data;
+    const char *end = data + size;
+    for (int i = 0; i < num_chunks; i++) {
+        // end each chunk after the first newline at or past its even share
+        const char *split = i == num_chunks - 1 ? end : data + size * (i + 1) / num_chunks;
+        if (split > start && split < end) {
+            split = skip_line(split - 1, end);
+        } else if (split < start) {
+            split = start;
+        }
+        chunks[i] = (obj_chunk_t){.start = start, .end = split, .ok = true};
+        start = split;
+    }
+    return num_chunks;
+}
+
+// Append the chunks to the mesh. A prefix sum over the chunks gives each one
+// its place in the file, then they are copied there in parallel
+static enum obj_result add_chunks(mesh_t *mesh, obj_chunk_t *chunks, int num_chunks) {
+    obj_output_t output = {.first_vertex = array_length(mesh->vertices)};
+    int num_faces = 0;
+    long long total_vertices = output.first_vertex, total_faces = array_length(mesh->faces);
+    for (int i = 0; i < num_chunks; i++) {
+        if (chunks[i].out_of_memory) {
+            return OBJ_OUT_OF_MEMORY;
+        }
+        total_vertices += array_length(chunks[i].vertices);
+        total_faces += array_length(chunks[i].faces);
+    }
+    // the mesh counts its vertices and faces in ints
+    if (total_vertices > INT_MAX || total_faces > INT_MAX) {
+        return OBJ_OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+        chunks[i].vertex_offset = output.num_vertices;
+        chunks[i].texcoord_offset = output.num_texcoords;
+        chunks[i].face_offset = num_faces;
+        chunks[i].output = &output;
+        output.num_vertices += array_length(chunks[i].vertices);
+        output.num_texcoords += array_length(chunks[i].texcoords);
+        num_faces += array_length(chunks[i].faces);
+    }
+
+    // faces can use texture coordinates from any chunk, so those are gathered
+    // before the faces are resolved
+    output.texcoords =
+        malloc(sizeof(tex2_t) * (output.num_texcoords > 0 ? output.num_texcoords : 1));
+    if (!output.texcoords) {
+        return OBJ_OUT_OF_MEMORY;
+    }
+    for (int i = 0; i < num_chunks; i++) {
+        if (chunks[i].texcoords) {
+            memcpy(&output.texcoords[chunks[i].texcoord_offset], chunks[i].texcoords,
+                   sizeof(tex2_t) * array_length(chunks[i].texcoords));
+        }
+    }
+
+    // the mesh is left as it was if there is no room for the file in it
+    if (output.num_vertices > 0) {
+        vec3_t *vertices = array_hold(mesh->vertices, output.num_vertices, sizeof(vec3_t));
+        if (!vertices) {
+            free(output.texcoords);
+            return OBJ_OUT_OF_MEMORY;
+        }
+        mesh->vertices = vertices;
+    }
+    if (num_faces > 0) {
+        face_t *faces = array_hold(mesh->faces, num_faces, sizeof(face_t));
+        if (!faces) {
+            array_truncate(mesh->vertices, output.first_vertex);
+            free(output.texcoords);
+            return OBJ_OUT_OF_MEMORY;
+        }
+        mesh->faces = faces;
+    }
+    output.vertices = &mesh->vertices[output.first_vertex];
+    output.faces = &mesh->faces[array_length(mesh->faces) - num_faces];
+
+    run_chunks(chunks, num_chunks, resolve_chunk);
+
+    bool ok = true;
+    for (int i = 0; i < num_chunks; i++) {
+        ok = ok && chunks[i].ok;
+    }
+    free(output.texcoords);
+    return ok ? OBJ_OK : OBJ_MALFORMED;
+}
+
+static void free_chunk(obj_chunk_t *chunk) {
+    array_free(chunk->vertices);
+    array_free(chunk->texcoords);
+    array_free(chunk->faces);
+}
+
+enum obj_result obj_parse(mesh_t *mesh, const char *data, size_t size) {
+    obj_chunk_t chunks[OBJ_MAX_CHUNKS];
+    int num_chunks = split_chunks(chunks, data, size);
+
+    run_chunks(chunks, num_chunks, parse_chunk);
+    enum obj_result result = add_chunks(mesh, chunks, num_chunks);
+
+    for (int i = 0; i < num_chunks; i++) {
+        free_chunk(&chunks[i]);
+    }
+    return result;
+}
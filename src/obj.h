@@ -0,0 +1,25 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include "mesh.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Threads to parse files with, 0 for one per CPU. Files are split into chunks
+// of whole lines that are parsed in parallel; the mesh comes out the same
+// whatever the number of threads
+extern int obj_threads;
+
+enum obj_result {
+    OBJ_OK,
+    OBJ_MALFORMED,     // malformed faces were left in as degenerate triangles
+    OBJ_OUT_OF_MEMORY, // the mesh was left as it was
+};
+
+// Parse the Wavefront OBJ text in data, appending its vertices and faces to
+// the mesh, which must not have been loaded from its cache. Faces may be
+// given as v, v/vt, v//vn or v/vt/vn, with negative indices counting back
+// from the last vertex; polygons are split into triangle fans
+enum obj_result obj_parse(mesh_t *mesh, const char *data, size_t size);
+
+#endif
@@ -0,0 +1,153 @@
+#include "pipeline.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Triangles a frame first has room for
+#define INITIAL_TRIANGLES_CAPACITY 10000
+
+static void geometry_stage(pipeline_t *pipeline, frame_t *frame) {
+    double start = stats_now_ms();
+    pipeline->run_geometry(pipeline->context, frame);
+    frame->geometry_ms = stats_now_ms() - start;
+}
+
+static void *geometry_worker(void *arg) {
+    pipeline_t *pipeline = arg;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    for (;;) {
+        while (!pipeline->job_pending && !pipeline->shutting_down) {
+            pthread_cond_wait(&pipeline->job_posted, &pipeline->mutex);
+        }
+        if (pipeline->shutting_down) {
+            break;
+        }
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        geometry_stage(pipeline, &pipeline->frames[1 - pipeline->current]);
+
+        pthread_mutex_lock(&pipeline->mutex);
+        pipeline->job_pending = false;
+        pthread_cond_signal(&pipeline->job_done);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+    return NULL;
+}
+
+bool pipeline_init(pipeline_t *pipeline, geometry_stage_t geometry, void *context,
+                   int render_width, int render_height) {
+    *pipeline = (pipeline_t){.run_geometry = geometry, .context = context};
+    for (int i = 0; i < 2; i++) {
+        pipeline->frames[i].render_width = render_width;
+        pipeline->frames[i].render_height = render_height;
+        pipeline->frames[i].submit_time = stats_now_ms();
+    }
+
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->job_posted, NULL);
+    pthread_cond_init(&pipeline->job_done, NULL);
+    if (pthread_create(&pipeline->worker, NULL, geometry_worker, pipeline) != 0) {
+        fprintf(stderr, "Error creating the geometry thread. \n");
+        pthread_mutex_destroy(&pipeline->mutex);
+        pthread_cond_destroy(&pipeline->job_posted);
+        pthread_cond_destroy(&pipeline->job_done);
+        return false;
+    }
+    return true;
+}
+
+frame_t *pipeline_next_frame(pipeline_t *pipeline) {
+    return &pipeline->frames[1 - pipeline->current];
+}
+
+frame_t *pipeline_current_frame(pipeline_t *pipeline) {
+    return &pipeline->frames[pipeline->current];
+}
+
+// Kick off the geometry stage for the next frame. The snapshot in
+// pipeline_next_frame() must be filled in before calling this
+void pipeline_submit(pipeline_t *pipeline) {
+    frame_t *frame = pipeline_next_frame(pipeline);
+    frame->submit_time = stats_now_ms();
+
+    if (!pipeline->pipelined) {
+        geometry_stage(pipeline, frame);
+        pipeline->current = 1 - pipeline->current;
+        return;
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->job_pending = true;
+    pipeline->in_flight = true;
+    pthread_cond_signal(&pipeline->job_posted);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+// Wait for the geometry stage in flight, if any, and make its frame the
+// current one for the raster stage
+void pipeline_sync(pipeline_t *pipeline) {
+    if (!pipeline->in_flight) {
+        return;
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    while (pipeline->job_pending) {
+        pthread_cond_wait(&pipeline->job_done, &pipeline->mutex);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    pipeline->in_flight = false;
+    pipeline->current = 1 - pipeline->current;
+}
+
+void pipeline_destroy(pipeline_t *pipeline) {
+    pipeline_sync(pipeline);
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->shutting_down = true;
+    pthread_cond_signal(&pipeline->job_posted);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    pthread_join(pipeline->worker, NULL);
+    pthread_mutex_destroy(&pipeline->mutex);
+    pthread_cond_destroy(&pipeline->job_posted);
+    pthread_cond_destroy(&pipeline->job_done);
+
+    for (int i = 0; i < 2; i++) {
+        free(pipeline->frames[i].triangles_to_render);
+        free(pipeline->frames[i].instances);
+        pipeline->frames[i] = (frame_t){0};
+    }
+}
+
+bool frame_snapshot_instances(frame_t *frame, const scene_instance_t *instances, int count) {
+    if (count > frame->instances_capacity) {
+        scene_instance_t *grown =
+            realloc(frame->instances, count * sizeof(scene_instance_t));
+        if (!grown) {
+            frame->num_instances = 0;
+            return false;
+        }
+        frame->instances = grown;
+        frame->instances_capacity = count;
+    }
+    if (count > 0) {
+        memcpy(frame->instances, instances, count * sizeof(scene_instance_t));
+    }
+    frame->num_instances = count;
+    return true;
+}
+
+bool frame_grow_triangles(frame_t *frame) {
+    int capacity = frame->triangles_capacity > 0 ? frame->triangles_capacity * 2
+                                                 : INITIAL_TRIANGLES_CAPACITY;
+    triangle_t *grown = realloc(frame->triangles_to_render, capacity * sizeof(triangle_t));
+    if (!grown) {
+        return false;
+    }
+    frame->triangles_to_render = grown;
+    frame->triangles_capacity = capacity;
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "camera.h"
+#include "scene.h"
+#include "triangle.h"
+#include "vector.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+// Everything the geometry stage of one frame reads and writes. There are two
+// of them, so the raster stage can draw frame N out of one while the geometry
+// of frame N+1 is built into the other
+typedef struct {
+    triangle_t *triangles_to_render; // grown as needed, never shrunk
+    int num_triangles_to_render;
+    int triangles_capacity;
+
+    // instances of the scene, and how many of them were culled whole
+    int num_instances;
+    int instances_outside;
+    int bvh_nodes_visited; // nodes of the instance tree culled through
+
+    // meshlets of the instances drawn, and how many of them were culled whole
+    int num_meshlets;
+    int meshlets_outside;
+    int meshlets_backfacing;
+
+    // average level of detail of the instances drawn, faces of their meshlets
+    // that weren't culled, and the faces of them all at full detail
+    float lod_level;
+    int triangles_submitted;
+    int full_triangles;
+
+    // camera, instances and resolution snapshotted when the frame was
+    // submitted
+    camera_t camera;
+    scene_instance_t *instances;
+    int instances_capacity;
+    int render_width;
+    int render_height;
+
+    double submit_time; // when the snapshot was taken, in ms
+    float geometry_ms;  // how long the geometry stage took
+    float raster_ms;    // how long the raster stage took
+} frame_t;
+
+// Builds the geometry of a frame, given the context the pipeline was made with
+typedef void (*geometry_stage_t)(void *context, frame_t *frame);
+
+typedef struct {
+    // When pipelined, the geometry stage runs on its own thread one frame
+    // ahead of the raster stage; otherwise both run back to back on the
+    // calling thread
+    bool pipelined;
+
+    // frames[current] is read by the raster stage, the other one is written
+    // by the geometry stage
+    frame_t frames[2];
+    int current;
+
+    geometry_stage_t run_geometry;
+    void *context;
+
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_posted;
+    pthread_cond_t job_done;
+    bool job_pending;
+    bool in_flight;
+    bool shutting_down;
+} pipeline_t;
+
+bool pipeline_init(pipeline_t *pipeline, geometry_stage_t geometry_stage, void *context,
+                   int render_width, int render_height);
+frame_t *pipeline_next_frame(pipeline_t *pipeline);
+frame_t *pipeline_current_frame(pipeline_t *pipeline);
+void pipeline_submit(pipeline_t *pipeline);
+void pipeline_sync(pipeline_t *pipeline);
+void pipeline_destroy(pipeline_t *pipeline);
+
+// Copy the scene's instances into the frame's snapshot, and make room for
+// more triangles. Both return false if out of memory
+bool frame_snapshot_instances(frame_t *frame, const scene_instance_t *instances, int count);
+bool frame_grow_triangles(frame_t *frame);
+
+// Append a triangle to the frame, dropping it if there is no memory for it
+static inline void frame_push_triangle(frame_t *frame, const triangle_t *triangle) {
+    if (frame->num_triangles_to_render == frame->triangles_capacity &&
+        !frame_grow_triangles(frame)) {
+        return;
+    }
+    frame->triangles_to_render[frame->num_triangles_to_render++] = *triangle;
+}
+
+#endif
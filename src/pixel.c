@@ -0,0 +1,292 @@
+#include "pixel.h"
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PIXEL_SSSE3
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+enum pixel_format pixel_format = PIXEL_FORMAT_ARGB8888;
+
+static void pixels_from_rgba_scalar(uint32_t *pixels, const uint8_t *rgba, int count,
+                                    int components) {
+    bool argb = pixel_format == PIXEL_FORMAT_ARGB8888;
+    for (int i = 0; i < count; i++) {
+        const uint8_t *pixel = &rgba[i * components];
+        uint32_t alpha = components == 4 ? pixel[3] : 0xFF;
+        uint32_t red = argb ? pixel[0] << 16 : pixel[0];
+        uint32_t blue = argb ? pixel[2] : pixel[2] << 16;
+        pixels[i] = red | (pixel[1] << 8) | blue | (alpha << 24);
+    }
+}
+
+#ifdef PIXEL_SSSE3
+// Shuffle 4 pixels at a time into place. Returns how many pixels were done,
+// the rest is left to the scalar loop
+__attribute__((target("ssse3"))) static int
+pixels_from_rgba_ssse3(uint32_t *pixels, const uint8_t *rgba, int count,
+                       int components) {
+    // source byte of each destination byte, -1 for the alpha of RGB pixels
+    static const int8_t SHUFFLES[2][2][16] = {
+        // RGB8
+        {{2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1},
+         {0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1}},
+        // RGBA8
+        {{2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15},
+         {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}},
+    };
+    __m128i shuffle = _mm_loadu_si128(
+        (const __m128i *)SHUFFLES[components == 4][pixel_format == PIXEL_FORMAT_ABGR8888]);
+    __m128i alpha = components == 4 ? _mm_setzero_si128() : _mm_set1_epi32((int)0xFF000000);
+
+    // 4 RGB pixels are only 12 bytes, stop early enough for the 16 byte loads
+    int last = components == 4 ? count - 4 : count - 6;
+    int i = 0;
+    for (; i <= last; i += 4) {
+        __m128i source = _mm_loadu_si128((const __m128i *)&rgba[i * components]);
+        __m128i result = _mm_or_si128(_mm_shuffle_epi8(source, shuffle), alpha);
+        _mm_storeu_si128((__m128i *)&pixels[i], result);
+    }
+    return i;
+}
+
+// Swap red and blue of 4 ARGB8888 pixels at a time
+__attribute__((target("ssse3"))) static int
+pixels_to_rgba_ssse3(uint8_t *rgba, const uint32_t *pixels, int count) {
+    const __m128i shuffle =
+        _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i source = _mm_loadu_si128((const __m128i *)&pixels[i]);
+        _mm_storeu_si128((__m128i *)&rgba[i * 4], _mm_shuffle_epi8(source, shuffle));
+    }
+    return i;
+}
+#endif
+
+void pixels_from_rgba(uint32_t *pixels, const uint8_t *rgba, int count,
+                      int components) {
+    int done = 0;
+#ifdef PIXEL_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        done = pixels_from_rgba_ssse3(pixels, rgba, count, components);
+    }
+#endif
+    pixels_from_rgba_scalar(pixels + done, rgba + done * components, count - done,
+                            components);
+}
+
+#ifdef PIXEL_SSSE3
+// Pack 4 pixels at a time into 12 bytes, storing 16 with the last 4 written
+// over by the next pixels. Returns how many pixels were done
+__attribute__((target("ssse3"))) static int
+pixels_to_rgb_ssse3(uint8_t *rgb, const uint32_t *pixels, int count) {
+    __m128i shuffle =
+        pixel_format == PIXEL_FORMAT_ARGB8888
+            ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+            : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    // the 16 byte stores of the last 4 pixels need 4 bytes after them
+    int i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i source = _mm_loadu_si128((const __m128i *)&pixels[i]);
+        _mm_storeu_si128((__m128i *)&rgb[i * 3], _mm_shuffle_epi8(source, shuffle));
+    }
+    return i;
+}
+#endif
+
+void pixels_to_rgb(uint8_t *rgb, const uint32_t *pixels, int count) {
+    bool argb = pixel_format == PIXEL_FORMAT_ARGB8888;
+    int i = 0;
+#ifdef PIXEL_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        i = pixels_to_rgb_ssse3(rgb, pixels, count);
+    }
+#endif
+    for (; i < count; i++) {
+        uint32_t pixel = pixels[i];
+        uint8_t *out = &rgb[i * 3];
+        out[0] = argb ? (uint8_t)(pixel >> 16) : (uint8_t)pixel;
+        out[1] = (uint8_t)(pixel >> 8);
+        out[2] = argb ? (uint8_t)pixel : (uint8_t)(pixel >> 16);
+    }
+}
+
+void pixels_to_rgba(uint8_t *rgba, const uint32_t *pixels, int count) {
+    // the bytes of ABGR8888 are already RGBA in memory on little endian
+    if (pixel_format == PIXEL_FORMAT_ABGR8888) {
+        memcpy(rgba, pixels, (size_t)count * 4);
+        return;
+    }
+
+    int i = 0;
+#ifdef PIXEL_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        i = pixels_to_rgba_ssse3(rgba, pixels, count);
+    }
+#endif
+    for (; i < count; i++) {
+        uint32_t pixel = pixels[i];
+        uint8_t *out = &rgba[i * 4];
+        out[0] = (uint8_t)(pixel >> 16);
+        out[1] = (uint8_t)(pixel >> 8);
+        out[2] = (uint8_t)pixel;
+        out[3] = (uint8_t)(pixel >> 24);
+    }
+}
+
+// BT.601 limited range, in 8 bits of fixed point
+static inline uint8_t luma(int r, int g, int b) {
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t blue_chroma(int r, int g, int b) {
+    return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t red_chroma(int r, int g, int b) {
+    return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// Convert the pixels of two rows from x on, the second row repeating the
+// first at the bottom edge of odd heights
+static void rows_to_yuv420_scalar(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                                  const uint32_t *row0, const uint32_t *row1, int x,
+                                  int width) {
+    int red_shift = pixel_format == PIXEL_FORMAT_ARGB8888 ? 16 : 0;
+    int blue_shift = 16 - red_shift;
+    for (; x < width; x += 2) {
+        // the right column repeats the left at the edge of odd widths
+        int x1 = x + 1 < width ? x + 1 : x;
+        uint32_t quad[4] = {row0[x], row0[x1], row1[x], row1[x1]};
+        int r_sum = 0, g_sum = 0, b_sum = 0;
+        for (int k = 0; k < 4; k++) {
+            int r = (quad[k] >> red_shift) & 0xFF;
+            int g = (quad[k] >> 8) & 0xFF;
+            int b = (quad[k] >> blue_shift) & 0xFF;
+            r_sum += r;
+            g_sum += g;
+            b_sum += b;
+
+            uint8_t *y = k < 2 ? y0 : y1;
+            int column = k % 2 == 0 ? x : x1;
+            if (y) {
+                y[column] = luma(r, g, b);
+            }
+        }
+        int r = (r_sum + 2) >> 2, g = (g_sum + 2) >> 2, b = (b_sum + 2) >> 2;
+        u[x / 2] = blue_chroma(r, g, b);
+        v[x / 2] = red_chroma(r, g, b);
+    }
+}
+
+#ifdef PIXEL_SSSE3
+// Split 8 pixels into 16-bit red, green and blue
+static inline void unpack_pixels(const uint32_t *pixels, __m128i red_shift,
+                                 __m128i blue_shift, __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i lo = _mm_loadu_si128((const __m128i *)pixels);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(pixels + 4));
+    *r = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(lo, red_shift), mask),
+                         _mm_and_si128(_mm_srl_epi32(hi, red_shift), mask));
+    *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask),
+                         _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+    *b = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(lo, blue_shift), mask),
+                         _mm_and_si128(_mm_srl_epi32(hi, blue_shift), mask));
+}
+
+// Luma of 8 pixels. The sum stays under 65536, so it is taken unsigned
+static inline __m128i luma_sse2(__m128i r, __m128i g, __m128i b) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+    sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+    return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+// One chroma of 8 averaged pixels, in signed 16 bits
+static inline __m128i chroma_sse2(__m128i r, __m128i g, __m128i b, short kr, short kg,
+                                  short kb) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+    sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+    return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+// Sum the 2x2 blocks of 16 pixels over two rows into 8 values
+static inline __m128i sum_quads(__m128i a0, __m128i a1, __m128i b0, __m128i b1) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i lo = _mm_madd_epi16(_mm_add_epi16(a0, b0), ones);
+    __m128i hi = _mm_madd_epi16(_mm_add_epi16(a1, b1), ones);
+    return _mm_packs_epi32(lo, hi);
+}
+
+static inline __m128i average_quads(__m128i a0, __m128i a1, __m128i b0, __m128i b1) {
+    __m128i sum = sum_quads(a0, a1, b0, b1);
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+// Convert 16 pixels at a time of two rows with SSE2, which x86-64 always has,
+// giving the same bytes as the scalar loop. Returns how many pixels of each row
+// were done
+static int rows_to_yuv420_sse2(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                               const uint32_t *row0, const uint32_t *row1, int width) {
+    int red = pixel_format == PIXEL_FORMAT_ARGB8888 ? 16 : 0;
+    __m128i red_shift = _mm_cvtsi32_si128(red);
+    __m128i blue_shift = _mm_cvtsi32_si128(16 - red);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i r[4], g[4], b[4];
+        unpack_pixels(&row0[x], red_shift, blue_shift, &r[0], &g[0], &b[0]);
+        unpack_pixels(&row0[x + 8], red_shift, blue_shift, &r[1], &g[1], &b[1]);
+        unpack_pixels(&row1[x], red_shift, blue_shift, &r[2], &g[2], &b[2]);
+        unpack_pixels(&row1[x + 8], red_shift, blue_shift, &r[3], &g[3], &b[3]);
+
+        _mm_storeu_si128((__m128i *)&y0[x],
+                         _mm_packus_epi16(luma_sse2(r[0], g[0], b[0]),
+                                          luma_sse2(r[1], g[1], b[1])));
+        if (y1) {
+            _mm_storeu_si128((__m128i *)&y1[x],
+                             _mm_packus_epi16(luma_sse2(r[2], g[2], b[2]),
+                                              luma_sse2(r[3], g[3], b[3])));
+        }
+
+        __m128i r_avg = average_quads(r[0], r[1], r[2], r[3]);
+        __m128i g_avg = average_quads(g[0], g[1], g[2], g[3]);
+        __m128i b_avg = average_quads(b[0], b[1], b[2], b[3]);
+        __m128i u8 = chroma_sse2(r_avg, g_avg, b_avg, -38, -74, 112);
+        __m128i v8 = chroma_sse2(r_avg, g_avg, b_avg, 112, -94, -18);
+        _mm_storel_epi64((__m128i *)&u[x / 2], _mm_packus_epi16(u8, u8));
+        _mm_storel_epi64((__m128i *)&v[x / 2], _mm_packus_epi16(v8, v8));
+    }
+    return x;
+}
+#endif
+
+void pixels_to_yuv420(uint8_t *yuv, const uint32_t *pixels, int width, int height) {
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    uint8_t *u_plane = yuv + (size_t)width * height;
+    uint8_t *v_plane = u_plane + (size_t)chroma_width * chroma_height;
+
+    for (int row = 0; row < height; row += 2) {
+        // the last row of odd heights is paired with itself, and written once
+        bool pair = row + 1 < height;
+        const uint32_t *row0 = &pixels[(size_t)row * width];
+        const uint32_t *row1 = pair ? row0 + width : row0;
+        uint8_t *y0 = &yuv[(size_t)row * width];
+        uint8_t *y1 = pair ? y0 + width : NULL;
+        uint8_t *u = &u_plane[(size_t)(row / 2) * chroma_width];
+        uint8_t *v = &v_plane[(size_t)(row / 2) * chroma_width];
+
+        int x = 0;
+#ifdef PIXEL_SSSE3
+        x = rows_to_yuv420_sse2(y0, y1, u, v, row0, row1, width);
+#endif
+        rows_to_yuv420_scalar(y0, y1, u, v, row0, row1, x, width);
+    }
+}
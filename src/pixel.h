@@ -0,0 +1,42 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stdint.h>
+
+// Every 32-bit color in the renderer (color buffer, texels, face and line
+// colors) is in one pixel format, picked at startup to match what the SDL
+// renderer takes natively so the color buffer is uploaded without conversion.
+// Alpha is the top byte in both, red and blue trade places. Textures are
+// converted to it as they load, so it is shared by every renderer and set
+// before anything is loaded
+enum pixel_format { PIXEL_FORMAT_ARGB8888, PIXEL_FORMAT_ABGR8888 };
+
+extern enum pixel_format pixel_format;
+
+// Convert a 0xAARRGGBB color to the pixel format
+static inline uint32_t pixel_from_argb(uint32_t argb) {
+    if (pixel_format == PIXEL_FORMAT_ARGB8888) {
+        return argb;
+    }
+    return (argb & 0xFF00FF00) | ((argb >> 16) & 0xFF) | ((argb & 0xFF) << 16);
+}
+
+// Convert count pixels decoded from a PNG, 4 bytes each for RGBA8 or 3 for
+// RGB8 with an opaque alpha added, to the pixel format
+void pixels_from_rgba(uint32_t *pixels, const uint8_t *rgba, int count,
+                      int components);
+
+// Convert count pixels in the pixel format to 3 bytes of RGB8 each, dropping
+// the alpha
+void pixels_to_rgb(uint8_t *rgb, const uint32_t *pixels, int count);
+
+// Convert count pixels in the pixel format to 4 bytes of RGBA8 each
+void pixels_to_rgba(uint8_t *rgba, const uint32_t *pixels, int count);
+
+// Convert a width x height image in the pixel format to planar YUV 4:2:0:
+// a full size plane of luma, then quarter size planes of blue and red
+// chroma, each (width + 1) / 2 x (height + 1) / 2 and averaged over 2x2
+// pixels. Uses the BT.601 limited range most encoders expect by default
+void pixels_to_yuv420(uint8_t *yuv, const uint32_t *pixels, int width, int height);
+
+#endif
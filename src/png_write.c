@@ -0,0 +1,641 @@
+#include "png_write.h"
+#include "pixel.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// SSE2 is always there on x86-64
+#define PNG_SSE2
+#include <emmintrin.h>
+#endif
+
+// Largest payload of a stored deflate block
+#define MAX_STORED_BLOCK 65535
+
+// Rows compressed together. Matches don't reach back into the strip before,
+// so smaller strips spread better over threads but compress a little worse
+#define PNG_STRIP_ROWS 64
+
+#define PNG_MAX_THREADS 64
+
+// Entries of the table of where 4 byte sequences were last seen
+#define HASH_BITS 15
+
+// Furthest back and longest a deflate match can be
+#define MAX_DISTANCE 32768
+#define MIN_MATCH 4
+#define MAX_MATCH 258
+
+// Filter types of the bytes starting each row
+#define FILTER_NONE 0
+#define FILTER_SUB 1
+#define FILTER_UP 2
+
+// RGB8
+#define BYTES_PER_PIXEL 3
+
+// CRC of a byte, and of a byte followed by 1 to 7 zero bytes, so the CRC
+// runs 8 bytes at a time
+static uint32_t crc_tables[8][256];
+
+// Fixed Huffman code of each literal and length symbol, and of each match
+// length together with its extra bits, bit reversed ready to be put. Distance
+// codes are all 5 bits
+typedef struct {
+    uint16_t code;
+    uint8_t bits;
+} huffman_code_t;
+
+static huffman_code_t literal_codes[288];
+static huffman_code_t length_codes[MAX_MATCH + 1];
+static uint8_t distance_codes[30];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static uint32_t reverse_bits(uint32_t code, int bits) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < bits; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    return reversed;
+}
+
+static void make_tables(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_tables[0][n] = c;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int n = 0; n < 256; n++) {
+            uint32_t c = crc_tables[k - 1][n];
+            crc_tables[k][n] = (c >> 8) ^ crc_tables[0][c & 0xFF];
+        }
+    }
+
+    for (int symbol = 0; symbol < 288; symbol++) {
+        uint32_t code;
+        int bits;
+        if (symbol < 144) {
+            code = 0x30 + symbol;
+            bits = 8;
+        } else if (symbol < 256) {
+            code = 0x190 + symbol - 144;
+            bits = 9;
+        } else if (symbol < 280) {
+            code = symbol - 256;
+            bits = 7;
+        } else {
+            code = 0xC0 + symbol - 280;
+            bits = 8;
+        }
+        literal_codes[symbol] = (huffman_code_t){(uint16_t)reverse_bits(code, bits), bits};
+    }
+
+    for (int code = 0; code < 30; code++) {
+        distance_codes[code] = (uint8_t)reverse_bits(code, 5);
+    }
+
+    // Lengths 3 to 10 have a symbol each, 258 has its own, and the ones in
+    // between share symbols 4 at a time, told apart by extra bits
+    for (int length = 3; length <= MAX_MATCH; length++) {
+        int n = length - 3;
+        int symbol, extra_bits = 0, extra = 0;
+        if (n < 8) {
+            symbol = 257 + n;
+        } else if (length == MAX_MATCH) {
+            symbol = 285;
+        } else {
+            int high_bit = 31 - __builtin_clz(n);
+            extra_bits = high_bit - 2;
+            extra = n & ((1 << extra_bits) - 1);
+            symbol = 257 + 4 * (high_bit - 1) + ((n >> extra_bits) & 3);
+        }
+        huffman_code_t code = literal_codes[symbol];
+        length_codes[length] = (huffman_code_t){(uint16_t)(code.code | extra << code.bits),
+                                                (uint8_t)(code.bits + extra_bits)};
+    }
+}
+
+static uint32_t update_crc(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t low =
+            crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF] ^
+              crc_tables[5][(low >> 16) & 0xFF] ^ crc_tables[4][low >> 24] ^
+              crc_tables[3][data[4]] ^ crc_tables[2][data[5]] ^ crc_tables[1][data[6]] ^
+              crc_tables[0][data[7]];
+    }
+    for (; size > 0; data++, size--) {
+        crc = crc_tables[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#define ADLER_MOD 65521
+
+#ifdef PNG_SSE2
+// Add 16 bytes at a time of a run to the sums. Each byte adds itself to a,
+// and to b once for every byte from it to the end of its 16, plus 16 times a
+// as it was before them. Returns how many bytes were added
+static size_t adler32_sse2(uint32_t *a, uint32_t *b, const uint8_t *data, size_t size) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights_low = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weights_high = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i byte_sums = zero, earlier_sums = zero, weighted_sums = zero;
+    size_t num_blocks = size / 16;
+    for (size_t k = 0; k < num_blocks; k++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)&data[k * 16]);
+        earlier_sums = _mm_add_epi32(earlier_sums, byte_sums);
+        byte_sums = _mm_add_epi32(byte_sums, _mm_sad_epu8(bytes, zero));
+        __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weights_low);
+        __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weights_high);
+        weighted_sums = _mm_add_epi32(weighted_sums, _mm_add_epi32(low, high));
+    }
+
+    // the sums of bytes are in the low halves of the two 64-bit lanes
+    uint64_t byte_sum = (uint32_t)_mm_cvtsi128_si32(byte_sums) +
+                        (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(byte_sums, 8));
+    uint64_t earlier_sum = (uint32_t)_mm_cvtsi128_si32(earlier_sums) +
+                           (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(earlier_sums, 8));
+    weighted_sums = _mm_add_epi32(weighted_sums, _mm_srli_si128(weighted_sums, 8));
+    weighted_sums = _mm_add_epi32(weighted_sums, _mm_srli_si128(weighted_sums, 4));
+    uint64_t weighted_sum = (uint32_t)_mm_cvtsi128_si32(weighted_sums);
+
+    *b = (uint32_t)((*b + 16 * num_blocks * *a + 16 * earlier_sum + weighted_sum) %
+                    ADLER_MOD);
+    *a = (uint32_t)((*a + byte_sum) % ADLER_MOD);
+    return num_blocks * 16;
+}
+#endif
+
+static uint32_t adler32(const uint8_t *data, size_t size) {
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        // the sums can't overflow in this many bytes before the modulo
+        size_t run = size < 5552 ? size : 5552;
+        size_t i = 0;
+#ifdef PNG_SSE2
+        i = adler32_sse2(&a, &b, data, run);
+#endif
+        for (; i < run; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+        data += run;
+        size -= run;
+    }
+    return (b << 16) | a;
+}
+
+// The Adler-32 of two runs of bytes one after the other, from the Adler-32 of
+// each and the length of the second
+static uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size) {
+    uint32_t rem = second_size % ADLER_MOD;
+    uint32_t a = first & 0xFFFF;
+    uint32_t b = (uint32_t)((uint64_t)rem * a % ADLER_MOD);
+    a += (second & 0xFFFF) + ADLER_MOD - 1;
+    b += (first >> 16) + (second >> 16) + ADLER_MOD - rem;
+    a %= ADLER_MOD;
+    b %= ADLER_MOD;
+    return (b << 16) | a;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+// out = a - b a byte at a time. Returns the sum of the results taken as
+// signed bytes, the usual guess at how well a filtered row compresses
+static uint32_t subtract_bytes(uint8_t *out, const uint8_t *a, const uint8_t *b,
+                               size_t size) {
+    size_t i = 0;
+    uint32_t sum = 0;
+#ifdef PNG_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = zero;
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)&a[i]),
+                                 _mm_loadu_si128((const __m128i *)&b[i]));
+        _mm_storeu_si128((__m128i *)&out[i], x);
+        // the magnitude of a signed byte is the smaller of it and its negation
+        // taken unsigned
+        __m128i magnitude = _mm_min_epu8(x, _mm_sub_epi8(zero, x));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(magnitude, zero));
+    }
+    sum = (uint32_t)(_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+#endif
+    for (; i < size; i++) {
+        uint8_t x = (uint8_t)(a[i] - b[i]);
+        out[i] = x;
+        sum += x < 128 ? x : 256 - x;
+    }
+    return sum;
+}
+
+// Filter a row of RGB bytes into out, a filter type byte and the filtered
+// bytes, with whichever of Sub and Up looks like it compresses better. above
+// is the row before, all zeros for the first
+static void filter_row(uint8_t *out, uint8_t *scratch, const uint8_t *row,
+                       const uint8_t *above, size_t size) {
+    // Sub is the difference from the pixel to the left, none for the first
+    static const uint8_t ZERO[BYTES_PER_PIXEL] = {0};
+    uint32_t sub_sum = subtract_bytes(out + 1, row, ZERO, BYTES_PER_PIXEL);
+    if (size > BYTES_PER_PIXEL) {
+        sub_sum += subtract_bytes(out + 1 + BYTES_PER_PIXEL, row + BYTES_PER_PIXEL, row,
+                                  size - BYTES_PER_PIXEL);
+    }
+    uint32_t up_sum = subtract_bytes(scratch, row, above, size);
+    if (up_sum < sub_sum) {
+        out[0] = FILTER_UP;
+        memcpy(out + 1, scratch, size);
+    } else {
+        out[0] = FILTER_SUB;
+    }
+}
+
+typedef struct {
+    uint8_t *out;
+    uint64_t bits; // not yet written, the first of them in the lowest bit
+    int num_bits;
+} bit_writer_t;
+
+static inline void put_bits(bit_writer_t *writer, uint32_t value, int count) {
+    writer->bits |= (uint64_t)value << writer->num_bits;
+    writer->num_bits += count;
+    if (writer->num_bits >= 32) {
+        writer->out[0] = (uint8_t)writer->bits;
+        writer->out[1] = (uint8_t)(writer->bits >> 8);
+        writer->out[2] = (uint8_t)(writer->bits >> 16);
+        writer->out[3] = (uint8_t)(writer->bits >> 24);
+        writer->out += 4;
+        writer->bits >>= 32;
+        writer->num_bits -= 32;
+    }
+}
+
+// Pad to a whole byte and write out what is left
+static void flush_bits(bit_writer_t *writer) {
+    while (writer->num_bits > 0) {
+        *writer->out++ = (uint8_t)writer->bits;
+        writer->bits >>= 8;
+        writer->num_bits -= 8;
+    }
+    writer->bits = 0;
+    writer->num_bits = 0;
+}
+
+static inline void put_literal(bit_writer_t *writer, uint8_t literal) {
+    put_bits(writer, literal_codes[literal].code, literal_codes[literal].bits);
+}
+
+static inline void put_match(bit_writer_t *writer, int length, int distance) {
+    put_bits(writer, length_codes[length].code, length_codes[length].bits);
+
+    // distances 1 to 4 have a code each, after that codes come in pairs that
+    // each cover twice as many distances as the pair before
+    int n = distance - 1;
+    int code = n, extra_bits = 0;
+    if (n >= 4) {
+        int high_bit = 31 - __builtin_clz(n);
+        extra_bits = high_bit - 1;
+        code = 2 * high_bit + ((n >> extra_bits) & 1);
+    }
+    put_bits(writer, distance_codes[code], 5);
+    if (extra_bits > 0) {
+        put_bits(writer, n & ((1 << extra_bits) - 1), extra_bits);
+    }
+}
+
+static inline uint32_t read_u32(const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, 4);
+    return value;
+}
+
+// Length of the match of a and b, up to max bytes, compared 8 at a time
+static inline size_t match_length(const uint8_t *a, const uint8_t *b, size_t max) {
+    size_t length = 0;
+    while (length + 8 <= max) {
+        uint64_t x, y;
+        memcpy(&x, a + length, 8);
+        memcpy(&y, b + length, 8);
+        if (x != y) {
+            // the first byte that differs, on little endian
+            return length + __builtin_ctzll(x ^ y) / 8;
+        }
+        length += 8;
+    }
+    while (length < max && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+// Compress data into a non-final block with the fixed Huffman codes, ending in
+// a sync flush. Each position is looked up once in the table of where its 4
+// bytes were last seen, and the match there, if any, taken greedily. Returns
+// the size written, at most deflate_bound(size)
+static size_t deflate_fast(uint8_t *out, const uint8_t *data, size_t size,
+                           uint32_t *table) {
+    // positions in the table are one past, so zero is none
+    memset(table, 0, sizeof(uint32_t) << HASH_BITS);
+    bit_writer_t writer = {.out = out};
+    put_bits(&writer, 2, 3); // not the final block, fixed Huffman codes
+
+    size_t i = 0;
+    while (i + MIN_MATCH <= size) {
+        uint32_t sequence = read_u32(&data[i]);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(i + 1);
+
+        if (candidate > 0 && i - (candidate - 1) <= MAX_DISTANCE &&
+            read_u32(&data[candidate - 1]) == sequence) {
+            size_t max = size - i < MAX_MATCH ? size - i : MAX_MATCH;
+            size_t length = MIN_MATCH + match_length(&data[candidate - 1 + MIN_MATCH],
+                                                     &data[i + MIN_MATCH], max - MIN_MATCH);
+            put_match(&writer, (int)length, (int)(i - (candidate - 1)));
+            i += length;
+        } else {
+            put_literal(&writer, data[i]);
+            i++;
+        }
+    }
+    for (; i < size; i++) {
+        put_literal(&writer, data[i]);
+    }
+    put_bits(&writer, literal_codes[256].code, literal_codes[256].bits); // end of block
+
+    // The sync flush, an empty stored block, leaves the stream on a byte
+    // boundary so the next strip's blocks can follow on
+    put_bits(&writer, 0, 3);
+    flush_bits(&writer);
+    static const uint8_t EMPTY_STORED[4] = {0x00, 0x00, 0xFF, 0xFF};
+    memcpy(writer.out, EMPTY_STORED, 4);
+    return writer.out + 4 - out;
+}
+
+// Most bytes of deflate_fast and deflate_stored output: 9 bits a literal
+static size_t deflate_bound(size_t size) {
+    return size + size / 8 + (size / MAX_STORED_BLOCK + 1) * 5 + 16;
+}
+
+// Copy data into non-final stored blocks
+static size_t deflate_stored(uint8_t *out, const uint8_t *data, size_t size) {
+    uint8_t *start = out;
+    for (size_t offset = 0; offset < size; offset += MAX_STORED_BLOCK) {
+        size_t block = size - offset < MAX_STORED_BLOCK ? size - offset : MAX_STORED_BLOCK;
+        *out++ = 0;
+        *out++ = (uint8_t)block;
+        *out++ = (uint8_t)(block >> 8);
+        *out++ = (uint8_t)~block;
+        *out++ = (uint8_t)(~block >> 8);
+        memcpy(out, &data[offset], block);
+        out += block;
+    }
+    return out - start;
+}
+
+// A strip of rows, compressed into a whole IDAT chunk ready to be written
+typedef struct {
+    int first_row;
+    int num_rows;
+    uint8_t *chunk;
+    size_t chunk_size;
+    uint32_t adler;      // of the filtered rows
+    size_t filtered_size;
+} png_strip_t;
+
+typedef struct {
+    png_options_t options;
+    const uint32_t *pixels;
+    int width;
+    int height;
+    png_strip_t *strips;
+    int num_strips;
+
+    pthread_mutex_t mutex;
+    int next_strip;
+    bool failed;
+} png_job_t;
+
+static bool write_strip(const png_job_t *job, png_strip_t *strip, bool zlib_header) {
+    size_t rgb_size = (size_t)job->width * BYTES_PER_PIXEL;
+    size_t row_size = 1 + rgb_size;
+    size_t filtered_size = row_size * strip->num_rows;
+
+    // two rows of RGB, the one filtered and the one above it, and a row for
+    // the Up filter to be tried in
+    uint8_t *rows = calloc(3, rgb_size);
+    uint8_t *filtered = malloc(filtered_size);
+    uint8_t *chunk = malloc(8 + 2 + deflate_bound(filtered_size) + 4);
+    bool fast = job->options.compression == PNG_FAST;
+    uint32_t *table = fast ? malloc(sizeof(uint32_t) << HASH_BITS) : NULL;
+    if (!rows || !filtered || !chunk || (fast && !table)) {
+        free(rows);
+        free(filtered);
+        free(chunk);
+        free(table);
+        return false;
+    }
+
+    uint8_t *row = rows, *above = rows + rgb_size, *scratch = rows + 2 * rgb_size;
+    if (strip->first_row > 0) {
+        pixels_to_rgb(above, &job->pixels[(size_t)job->width * (strip->first_row - 1)],
+                      job->width);
+    }
+    for (int y = 0; y < strip->num_rows; y++) {
+        const uint32_t *source = &job->pixels[(size_t)job->width * (strip->first_row + y)];
+        uint8_t *out = &filtered[row_size * y];
+        if (!fast) {
+            out[0] = FILTER_NONE;
+            pixels_to_rgb(out + 1, source, job->width);
+            continue;
+        }
+        pixels_to_rgb(row, source, job->width);
+        filter_row(out, scratch, row, above, rgb_size);
+        uint8_t *swap = above;
+        above = row;
+        row = swap;
+    }
+
+    uint8_t *data = chunk + 8;
+    if (zlib_header) {
+        // deflate with a 32K window, and a check that makes 0x7801 a
+        // multiple of 31
+        *data++ = 0x78;
+        *data++ = 0x01;
+    }
+    size_t size = 0;
+    if (fast) {
+        size = deflate_fast(data, filtered, filtered_size, table);
+    }
+    // frames of noise could come out bigger compressed than stored
+    size_t stored_size =
+        filtered_size + (filtered_size + MAX_STORED_BLOCK - 1) / MAX_STORED_BLOCK * 5;
+    if (!fast || size > stored_size) {
+        size = deflate_stored(data, filtered, filtered_size);
+    }
+    data += size;
+
+    size_t data_size = data - (chunk + 8);
+    put_u32(chunk, (uint32_t)data_size);
+    memcpy(chunk + 4, "IDAT", 4);
+    put_u32(data, update_crc(0xFFFFFFFFu, chunk + 4, 4 + data_size) ^ 0xFFFFFFFFu);
+
+    strip->chunk = chunk;
+    strip->chunk_size = 8 + data_size + 4;
+    strip->adler = adler32(filtered, filtered_size);
+    strip->filtered_size = filtered_size;
+    free(rows);
+    free(filtered);
+    free(table);
+    return true;
+}
+
+static void *png_worker(void *arg) {
+    png_job_t *job = arg;
+    for (;;) {
+        pthread_mutex_lock(&job->mutex);
+        int s = job->failed ? job->num_strips : job->next_strip++;
+        pthread_mutex_unlock(&job->mutex);
+        if (s >= job->num_strips) {
+            break;
+        }
+
+        if (!write_strip(job, &job->strips[s], s == 0)) {
+            pthread_mutex_lock(&job->mutex);
+            job->failed = true;
+            pthread_mutex_unlock(&job->mutex);
+        }
+    }
+    return NULL;
+}
+
+// Filter and compress the strips, spread over threads
+static bool write_strips(png_job_t *job) {
+    int num_threads = job->options.num_threads;
+    if (num_threads <= 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = num_cpus > 0 ? (int)num_cpus : 1;
+    }
+    if (num_threads > job->num_strips) {
+        num_threads = job->num_strips;
+    }
+    if (num_threads > PNG_MAX_THREADS) {
+        num_threads = PNG_MAX_THREADS;
+    }
+
+    pthread_mutex_init(&job->mutex, NULL);
+    pthread_t threads[PNG_MAX_THREADS];
+    int num_started = 0;
+    while (num_started < num_threads - 1 &&
+           pthread_create(&threads[num_started], NULL, png_worker, job) == 0) {
+        num_started++;
+    }
+    png_worker(job);
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job->mutex);
+    return !job->failed;
+}
+
+// A chunk is its length, type, data and the CRC of the type and data
+static bool write_chunk(FILE *file, const char *type, const uint8_t *data, size_t size) {
+    uint8_t header[8];
+    put_u32(header, (uint32_t)size);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = update_crc(0xFFFFFFFFu, header + 4, 4);
+    crc = update_crc(crc, data, size);
+    uint8_t footer[4];
+    put_u32(footer, crc ^ 0xFFFFFFFFu);
+
+    return fwrite(header, 1, 8, file) == 8 &&
+           (size == 0 || fwrite(data, 1, size, file) == size) &&
+           fwrite(footer, 1, 4, file) == 4;
+}
+
+bool png_write(const char *filename, const uint32_t *pixels, int width, int height,
+               const png_options_t *options) {
+    pthread_once(&tables_once, make_tables);
+
+    int num_strips = (height + PNG_STRIP_ROWS - 1) / PNG_STRIP_ROWS;
+    png_job_t job = {.pixels = pixels, .width = width, .height = height,
+                     .num_strips = num_strips};
+    if (options) {
+        job.options = *options;
+    }
+    job.strips = calloc(num_strips > 0 ? num_strips : 1, sizeof(png_strip_t));
+    if (!job.strips) {
+        fprintf(stderr, "Error allocating memory for %s. \n", filename);
+        return false;
+    }
+    for (int s = 0; s < num_strips; s++) {
+        int first_row = s * PNG_STRIP_ROWS;
+        int num_rows = height - first_row < PNG_STRIP_ROWS ? height - first_row
+                                                           : PNG_STRIP_ROWS;
+        job.strips[s] = (png_strip_t){.first_row = first_row, .num_rows = num_rows};
+    }
+    if (!write_strips(&job)) {
+        fprintf(stderr, "Error allocating memory for %s. \n", filename);
+        for (int s = 0; s < num_strips; s++) {
+            free(job.strips[s].chunk);
+        }
+        free(job.strips);
+        return false;
+    }
+
+    // The stream ends in an empty final block with the fixed codes, and the
+    // Adler-32 of all the strips' rows
+    uint32_t adler = 1;
+    for (int s = 0; s < num_strips; s++) {
+        adler = adler32_combine(adler, job.strips[s].adler, job.strips[s].filtered_size);
+    }
+    uint8_t end[6] = {0x03, 0x00};
+    put_u32(end + 2, adler);
+
+    uint8_t header[13];
+    put_u32(header, (uint32_t)width);
+    put_u32(header + 4, (uint32_t)height);
+    header[8] = 8;  // bits per channel
+    header[9] = 2;  // RGB
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // not interlaced
+
+    static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    FILE *file = fopen(filename, "wb");
+    bool ok = file && fwrite(SIGNATURE, 1, 8, file) == 8 &&
+              write_chunk(file, "IHDR", header, sizeof(header));
+    for (int s = 0; ok && s < num_strips; s++) {
+        ok = fwrite(job.strips[s].chunk, 1, job.strips[s].chunk_size, file) ==
+             job.strips[s].chunk_size;
+    }
+    ok = ok && write_chunk(file, "IDAT", end, sizeof(end)) &&
+         write_chunk(file, "IEND", NULL, 0);
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error writing %s. \n", filename);
+    }
+
+    for (int s = 0; s < num_strips; s++) {
+        free(job.strips[s].chunk);
+    }
+    free(job.strips);
+    return ok;
+}
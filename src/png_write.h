@@ -0,0 +1,35 @@
+#ifndef PNG_WRITE_H
+#define PNG_WRITE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum png_compression {
+    // Rows filtered by whichever of Sub and Up suits them, then compressed
+    // with a single probe LZ77 and the fixed Huffman codes. Rendered frames,
+    // mostly flat background, shrink several times over at close to the speed
+    // of storing them
+    PNG_FAST,
+    // Unfiltered rows in uncompressed deflate blocks, costing little more than
+    // copying the pixels
+    PNG_STORE,
+};
+
+// How a file is written; zeroed, PNG_FAST on one thread per CPU
+typedef struct {
+    enum png_compression compression;
+
+    // Threads to write the file with, 0 for one per CPU. Images are split into
+    // strips of rows that are filtered and compressed in parallel, each into
+    // its own IDAT chunk ending in a sync flush; the file comes out the same
+    // whatever the number of threads
+    int num_threads;
+} png_options_t;
+
+// Write width x height pixels in the pixel format, width a row, to an RGB8
+// PNG file, with the options or NULL for the defaults. Returns false if the
+// file couldn't be written
+bool png_write(const char *filename, const uint32_t *pixels, int width, int height,
+               const png_options_t *options);
+
+#endif
@@ -0,0 +1,604 @@
+#include "renderer.h"
+#include "array.h"
+#include "lod.h"
+#include "mesh.h"
+#include "meshlet.h"
+#include "pixel.h"
+#include "resolution.h"
+#include "texture.h"
+#include "triangle.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Instances are culled and given their matrix and level of detail this many
+// at a time, before the faces of those still in view are drawn
+#define INSTANCE_BATCH_SIZE 64
+
+// What the geometry stage works out for an instance before drawing it
+typedef struct {
+    const mesh_t *mesh;
+    texture_t *texture;
+    mat4_t model_view; // model space to camera space, the one matrix of the instance
+    float max_scale;
+    bool uniform_scale;
+    int lod_level;
+} instance_draw_t;
+
+// Cull, clip and project the face starting at first_index in the index buffer
+static void update_face(renderer_t *renderer, frame_t *frame, const instance_draw_t *draw,
+                        int first_index) {
+    const mesh_t *mesh = draw->mesh;
+    uint32_t face_indices[3] = {mesh_index(mesh, first_index),
+                                mesh_index(mesh, first_index + 1),
+                                mesh_index(mesh, first_index + 2)};
+    const mesh_vertex_t *face_vertices[3] = {&mesh->vertex_buffer[face_indices[0]],
+                                             &mesh->vertex_buffer[face_indices[1]],
+                                             &mesh->vertex_buffer[face_indices[2]]};
+
+    const vec4_t *view_vertices = renderer->view_vertices;
+    vec4_t transformed_vertices[3] = {view_vertices[face_indices[0]],
+                                      view_vertices[face_indices[1]],
+                                      view_vertices[face_indices[2]]};
+
+    // Check Backface Culling Algorithm (5)
+    vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]);
+    vec3_t vector_b = vec3_from_vec4(transformed_vertices[1]);
+    vec3_t vector_c = vec3_from_vec4(transformed_vertices[2]);
+
+    // 1. Find vectors B-A and C-A
+    vec3_t vector_ab = vec3_sub(vector_b, vector_a);
+    vec3_t vector_ac = vec3_sub(vector_c, vector_a);
+    vec3_normalize(&vector_ab);
+    vec3_normalize(&vector_ac);
+
+    // 2. Take their cross product and find the perpendicular normal N
+    vec3_t normal = vec3_cross(vector_ab, vector_ac);
+
+    // normalize the face normal vector
+    vec3_normalize(&normal);
+
+    vec3_t origin = {0, 0, 0};
+    vec3_t camera_ray = vec3_sub(origin, vector_a);
+
+    // 4. Take the Dot Product between normal N and the Camera Ray
+    float dot_normal_camera = vec3_dot(normal, camera_ray);
+
+    // 5. If this dot product is less than zero, then do not display the face
+    if (renderer->cull_method == CULL_BACKFACE) {
+        if (dot_normal_camera < 0) {
+            // cull face by bypassing the rest of the function
+            return;
+        }
+    }
+
+    // clipping
+    polygon_t polygon = create_polygon_from_triangle(
+        vec3_from_vec4(transformed_vertices[0]),
+        vec3_from_vec4(transformed_vertices[1]),
+        vec3_from_vec4(transformed_vertices[2]), face_vertices[0]->uv,
+        face_vertices[1]->uv, face_vertices[2]->uv);
+    clip_polygon(&polygon, renderer->frustum_planes);
+
+    triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLES];
+    int num_triangles_after_clipping = 0;
+
+    triangles_from_polygon(&polygon, triangles_after_clipping,
+                           &num_triangles_after_clipping);
+
+    for (int t = 0; t < num_triangles_after_clipping; t++) {
+        triangle_t triangle_after_clipping = triangles_after_clipping[t];
+
+        // Loop all three vertices to perform projection
+        vec4_t projected_points[3];
+        for (int j = 0; j < 3; j++) {
+            // project current vertex
+            projected_points[j] = mat4_mul_vec4_project(
+                renderer->proj_matrix, triangle_after_clipping.points[j]);
+
+            // scale into the view
+            projected_points[j].x *= (frame->render_width / 2.0);
+            projected_points[j].y *= (frame->render_height / 2.0);
+
+            // Invert the Y values because our obj comes with it's Y Values
+            // flipped
+            projected_points[j].y *= -1;
+
+            // translate projected points to the middle of the screen.
+            projected_points[j].x += (frame->render_width / 2.0);
+            projected_points[j].y += (frame->render_height / 2.0);
+        }
+
+        // Calculate the shade intensity based on how aligned is the face normal
+        // and the light ray
+        float light_intensity_factor = -vec3_dot(normal, renderer->light.direction);
+
+        uint32_t triangle_color =
+            light_apply_intensity(face_vertices[0]->color, light_intensity_factor);
+
+        triangle_t triangle_to_render = {
+            .points =
+                {
+
+                    {projected_points[0].x, projected_points[0].y,
+                     projected_points[0].z, projected_points[0].w},
+                    {projected_points[1].x, projected_points[1].y,
+                     projected_points[1].z, projected_points[1].w},
+                    {projected_points[2].x, projected_points[2].y,
+                     projected_points[2].z, projected_points[2].w}
+
+                },
+            .texcoords = {{triangle_after_clipping.texcoords[0].u,
+                           triangle_after_clipping.texcoords[0].v},
+                          {triangle_after_clipping.texcoords[1].u,
+                           triangle_after_clipping.texcoords[1].v},
+                          {triangle_after_clipping.texcoords[2].u,
+                           triangle_after_clipping.texcoords[2].v}},
+            .color = triangle_color,
+            .texture = draw->texture
+
+        };
+
+        //  save the projected triangle in the array of triangles to render.
+        frame_push_triangle(frame, &triangle_to_render);
+    }
+}
+
+// Place an instance in the world: its world matrix, and the bounding sphere
+// of its mesh moved along
+static void place_instance(const scene_t *scene, const scene_instance_t *instance,
+                           instance_state_t *state, bvh_sphere_t *bounds) {
+    const mesh_t *mesh = &scene->meshes[instance->mesh];
+    state->instance = *instance;
+
+    // Create scale, rotation, and translation matrices that will be used to
+    // multiply the mesh vertices
+    mat4_t scale_matrix =
+        mat4_make_scale(instance->scale.x, instance->scale.y, instance->scale.z);
+    mat4_t translation_matrix = mat4_make_translation(
+        instance->translation.x, instance->translation.y, instance->translation.z);
+    mat4_t rotation_matrix_x = mat4_make_rotation_x(instance->rotation.x);
+    mat4_t rotation_matrix_y = mat4_make_rotation_y(instance->rotation.y);
+    mat4_t rotation_matrix_z = mat4_make_rotation_z(instance->rotation.z);
+
+    // create a World Matrix combining scale, rotation, and translation to
+    // place the vector in the "world"
+    mat4_t world_matrix = mat4_identity();
+
+    //  order matters: First scale, then rotate, then translate
+    // [T]*[R]*[S]*v
+    //
+    world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
+    world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+    state->world_matrix = world_matrix;
+
+    float max_scale = fmaxf(fabsf(instance->scale.x),
+                            fmaxf(fabsf(instance->scale.y), fabsf(instance->scale.z)));
+    vec3_t bounds_center = vec3_div(vec3_add(mesh->bounds_min, mesh->bounds_max), 2);
+    float bounds_radius = vec3_length(vec3_sub(mesh->bounds_max, mesh->bounds_min)) / 2;
+    bounds->center =
+        vec3_from_vec4(mat4_mul_vec4(world_matrix, vec4_from_vec3(bounds_center)));
+    // a little slack for the rounding of the vertex transforms
+    bounds->radius = bounds_radius * max_scale * 1.0001f + 1e-5f;
+}
+
+// Work out the one matrix of an instance in view, from model to camera space,
+// and its level of detail
+static void prepare_instance(renderer_t *renderer, frame_t *frame,
+                             const mat4_t *view_matrix, int index, instance_draw_t *draw) {
+    const scene_instance_t *instance = &frame->instances[index];
+    instance_state_t *state = &renderer->instance_states[index];
+    const bvh_sphere_t *bounds = &renderer->instance_bounds[index];
+    const mesh_t *mesh = &renderer->scene->meshes[instance->mesh];
+    draw->mesh = mesh;
+    draw->texture =
+        instance->material >= 0 ? &renderer->scene->materials[instance->material] : NULL;
+    draw->model_view = mat4_mul_mat4(*view_matrix, state->world_matrix);
+
+    // The meshlet cones only hold while the scale keeps normals pointing the
+    // same way
+    draw->uniform_scale = instance->scale.x == instance->scale.y &&
+                          instance->scale.y == instance->scale.z && instance->scale.x > 0;
+    draw->max_scale = fmaxf(fabsf(instance->scale.x),
+                            fmaxf(fabsf(instance->scale.y), fabsf(instance->scale.z)));
+
+    // Pick the level of detail from how many pixels a model unit covers at
+    // the near side of the bounding sphere, no nearer than the near plane
+    draw->lod_level = 0;
+    if (renderer->lod_enabled && array_length(mesh->lods) > 0) {
+        vec3_t view_center =
+            vec3_from_vec4(mat4_mul_vec4(*view_matrix, vec4_from_vec3(bounds->center)));
+        float distance = vec3_length(view_center) - bounds->radius;
+        float pixels_per_unit = draw->max_scale * renderer->proj_matrix.m[1][1] *
+                                (frame->render_height / 2.0f) / fmaxf(distance, 0.1f);
+        state->lod_level = lod_select(mesh, state->lod_level, pixels_per_unit,
+                                      renderer->lod_error_pixels);
+        draw->lod_level = state->lod_level;
+    }
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Find the instances whose bounds reach into the frustum, through the tree or
+// one by one. Returns how many there are, in visible_instances in scene order
+static int cull_instances(renderer_t *renderer, frame_t *frame, const mat4_t *view_matrix) {
+    plane_t planes[NUM_PLANES];
+    frustum_planes_in_world(renderer->frustum_planes, *view_matrix, planes);
+    const bvh_sphere_t *instance_bounds = renderer->instance_bounds;
+    int *visible_instances = renderer->visible_instances;
+
+    int num_visible = 0;
+    frame->bvh_nodes_visited = 0;
+    if (renderer->bvh_culling &&
+        bvh_update(&renderer->instance_bvh, instance_bounds, frame->num_instances)) {
+        frame->bvh_nodes_visited =
+            bvh_cull(&renderer->instance_bvh, planes, visible_instances, &num_visible);
+        // drawn in scene order, so the image doesn't depend on the culling
+        qsort(visible_instances, num_visible, sizeof(int), compare_ints);
+        return num_visible;
+    }
+
+    for (int i = 0; i < frame->num_instances; i++) {
+        bool inside = true;
+        for (int plane = 0; plane < NUM_PLANES && inside; plane++) {
+            inside = vec3_dot(vec3_sub(instance_bounds[i].center, planes[plane].point),
+                              planes[plane].normal) >= -instance_bounds[i].radius;
+        }
+        if (inside) {
+            visible_instances[num_visible++] = i;
+        }
+    }
+    return num_visible;
+}
+
+// Transform the vertices the instance's level of detail uses, then cull its
+// meshlets and draw the faces of those left
+static void draw_instance(renderer_t *renderer, frame_t *frame,
+                          const instance_draw_t *draw) {
+    const mesh_t *mesh = draw->mesh;
+    int first_meshlet = 0;
+    int num_meshlets = array_length(mesh->meshlets);
+    int num_vertices = array_length(mesh->vertex_buffer);
+    int full_triangles = array_length(mesh->index_buffer) / 3;
+    if (array_length(mesh->lods) > 0) {
+        const mesh_lod_t *lod = &mesh->lods[draw->lod_level];
+        first_meshlet = lod->first_meshlet;
+        num_meshlets = lod->num_meshlets;
+        num_vertices = lod->num_vertices;
+        full_triangles = mesh->lods[0].num_triangles;
+    }
+    frame->full_triangles += full_triangles;
+
+    // Transform each welded vertex once, however many faces share it
+    if (num_vertices > renderer->view_vertices_capacity) {
+        vec4_t *grown = realloc(renderer->view_vertices, num_vertices * sizeof(vec4_t));
+        if (!grown) {
+            return;
+        }
+        renderer->view_vertices = grown;
+        renderer->view_vertices_capacity = num_vertices;
+    }
+    for (int i = 0; i < num_vertices; i++) {
+        vec4_t position = vec4_from_vec3(mesh->vertex_buffer[i].position);
+        renderer->view_vertices[i] = mat4_mul_vec4(draw->model_view, position);
+    }
+
+    // Cull whole meshlets first: their bounding spheres against the frustum,
+    // and their normal cones against the camera
+    frame->num_meshlets += num_meshlets;
+    for (int m = first_meshlet; m < first_meshlet + num_meshlets; m++) {
+        const meshlet_t *meshlet = &mesh->meshlets[m];
+
+        if (renderer->meshlet_culling) {
+            vec3_t view_center = vec3_from_vec4(
+                mat4_mul_vec4(draw->model_view, vec4_from_vec3(meshlet->center)));
+            // a little slack for the rounding of the vertex transforms
+            float radius = meshlet->radius * draw->max_scale * 1.0001f + 1e-5f;
+
+            if (sphere_outside_frustum(renderer->frustum_planes, view_center, radius)) {
+                frame->meshlets_outside++;
+                continue;
+            }
+
+            if (renderer->cull_method == CULL_BACKFACE && draw->uniform_scale) {
+                vec4_t axis = {meshlet->cone_axis.x, meshlet->cone_axis.y,
+                               meshlet->cone_axis.z, 0};
+                vec3_t view_axis = vec3_from_vec4(mat4_mul_vec4(draw->model_view, axis));
+                vec3_normalize(&view_axis);
+                if (meshlet_backfacing(meshlet, view_center, radius, view_axis)) {
+                    frame->meshlets_backfacing++;
+                    continue;
+                }
+            }
+        }
+
+        frame->triangles_submitted += meshlet->num_triangles;
+        int end = meshlet->first_index + meshlet->num_triangles * 3;
+        for (int i = meshlet->first_index; i < end; i += 3) {
+            update_face(renderer, frame, draw, i);
+        }
+    }
+}
+
+// The geometry stage: cull the frame's instances, then transform, cull, clip
+// and project the faces of those in view
+static void update_geometry(void *context, frame_t *frame) {
+    renderer_t *renderer = context;
+    frame->num_triangles_to_render = 0;
+    frame->instances_outside = 0;
+    frame->num_meshlets = 0;
+    frame->meshlets_outside = 0;
+    frame->meshlets_backfacing = 0;
+    frame->lod_level = 0;
+    frame->triangles_submitted = 0;
+    frame->full_triangles = 0;
+
+    int num_instances = frame->num_instances;
+    if (num_instances > renderer->instance_states_capacity) {
+        instance_state_t *states =
+            realloc(renderer->instance_states, num_instances * sizeof(instance_state_t));
+        renderer->instance_states = states ? states : renderer->instance_states;
+        bvh_sphere_t *bounds =
+            realloc(renderer->instance_bounds, num_instances * sizeof(bvh_sphere_t));
+        renderer->instance_bounds = bounds ? bounds : renderer->instance_bounds;
+        int *visible = realloc(renderer->visible_instances, num_instances * sizeof(int));
+        renderer->visible_instances = visible ? visible : renderer->visible_instances;
+        if (!states || !bounds || !visible) {
+            return;
+        }
+        // unseen, so placed below
+        for (int i = renderer->instance_states_capacity; i < num_instances; i++) {
+            states[i] = (instance_state_t){.instance = {.mesh = -1}};
+        }
+        renderer->instance_states_capacity = num_instances;
+    }
+
+    // Place the instances that moved since the last frame
+    instance_state_t *states = renderer->instance_states;
+    for (int i = 0; i < num_instances; i++) {
+        if (memcmp(&states[i].instance, &frame->instances[i], sizeof(scene_instance_t)) !=
+            0) {
+            place_instance(renderer->scene, &frame->instances[i], &states[i],
+                           &renderer->instance_bounds[i]);
+        }
+    }
+
+    vec3_t target = vec3_add(frame->camera.position, frame->camera.direction);
+
+    vec3_t up_direction = {0, 1, 0};
+    mat4_t view_matrix = mat4_look_at(frame->camera.position, target, up_direction);
+
+    int num_visible = cull_instances(renderer, frame, &view_matrix);
+    frame->instances_outside = num_instances - num_visible;
+
+    // Batches of instances in view: the matrix and level of detail of each in
+    // a tight loop, then their faces
+    for (int first = 0; first < num_visible; first += INSTANCE_BATCH_SIZE) {
+        instance_draw_t batch[INSTANCE_BATCH_SIZE];
+        int batch_size = num_visible - first < INSTANCE_BATCH_SIZE ? num_visible - first
+                                                                   : INSTANCE_BATCH_SIZE;
+        for (int i = 0; i < batch_size; i++) {
+            int index = renderer->visible_instances[first + i];
+            prepare_instance(renderer, frame, &view_matrix, index, &batch[i]);
+        }
+
+        for (int i = 0; i < batch_size; i++) {
+            draw_instance(renderer, frame, &batch[i]);
+            frame->lod_level += batch[i].lod_level;
+        }
+    }
+    if (num_visible > 0) {
+        frame->lod_level /= num_visible;
+    }
+}
+
+bool renderer_init(renderer_t *renderer, int width, int height, scene_t *scene) {
+    memset(renderer, 0, sizeof(*renderer));
+    renderer->width = width;
+    renderer->height = height;
+    renderer->render_width = width;
+    renderer->render_height = height;
+    renderer->scene = scene;
+
+    renderer->camera = camera_new();
+    renderer->light = (light_t){.direction = {0, 0, 1}};
+    renderer->cull_method = CULL_BACKFACE;
+    renderer->render_method = RENDER_WIRE;
+    renderer->mipmapping = true;
+    renderer->meshlet_culling = true;
+    renderer->bvh_culling = true;
+    renderer->lod_enabled = true;
+    renderer->lod_error_pixels = LOD_ERROR_PIXELS;
+    renderer->render_scale = MAX_RENDER_SCALE;
+
+    // Allocate the required bytes in memory for the color and depth buffers
+    renderer->color_buffer = (uint32_t *)malloc(sizeof(uint32_t) * width * height);
+    renderer->z_buffer = (float *)malloc(sizeof(float) * width * height);
+    if (!renderer->color_buffer || !renderer->z_buffer) {
+        fprintf(stderr, "Error allocating memory for the color buffer. \n");
+        free(renderer->color_buffer);
+        free(renderer->z_buffer);
+        return false;
+    }
+
+    // Initialize the perspective projection matrix
+    float aspecty = (float)height / (float)width;
+    float aspectx = (float)width / (float)height;
+    float fovy = M_PI / 3.0; // the same as 180/3, or 60 degrees
+    float fovx = atan(tan(fovy / 2) * aspectx) * 2.0;
+
+    float znear = 0.1;
+    float zfar = 100.0;
+    renderer->proj_matrix = mat4_make_perspective(fovy, aspecty, znear, zfar);
+
+    // initialize frustum planes
+    init_frustum_planes(renderer->frustum_planes, fovx, fovy, znear, zfar);
+
+    if (!pipeline_init(&renderer->pipeline, update_geometry, renderer, width, height)) {
+        free(renderer->color_buffer);
+        free(renderer->z_buffer);
+        return false;
+    }
+    return true;
+}
+
+void renderer_destroy(renderer_t *renderer) {
+    pipeline_destroy(&renderer->pipeline);
+    free(renderer->view_vertices);
+    free(renderer->instance_states);
+    free(renderer->instance_bounds);
+    free(renderer->visible_instances);
+    free_bvh(&renderer->instance_bvh);
+    free(renderer->color_buffer);
+    free(renderer->z_buffer);
+    memset(renderer, 0, sizeof(*renderer));
+}
+
+void renderer_set_camera(renderer_t *renderer, vec3_t position, float yaw_angle) {
+    renderer->camera.position = position;
+    renderer->camera.yaw_angle = yaw_angle;
+    camera_update_direction(&renderer->camera);
+}
+
+void renderer_forget_frames(renderer_t *renderer) {
+    for (int i = 0; i < renderer->instance_states_capacity; i++) {
+        renderer->instance_states[i].lod_level = 0;
+    }
+}
+
+void renderer_render_frame(renderer_t *renderer) {
+    renderer_submit_frame(renderer);
+    renderer_draw_frame(renderer);
+    renderer_finish_frame(renderer);
+}
+
+void renderer_submit_frame(renderer_t *renderer) {
+    // Snapshot the camera and instances so the geometry stage can run while
+    // input and animation move on to the next frame
+    frame_t *frame = pipeline_next_frame(&renderer->pipeline);
+    frame->camera = renderer->camera;
+    frame_snapshot_instances(frame, renderer->scene->instances,
+                             array_length(renderer->scene->instances));
+    scaled_render_size(renderer, &frame->render_width, &frame->render_height);
+
+    pipeline_submit(&renderer->pipeline);
+}
+
+void renderer_draw_frame(renderer_t *renderer) {
+    frame_t *frame = pipeline_current_frame(&renderer->pipeline);
+    enum render_method render_method = renderer->render_method;
+    double raster_start = stats_now_ms();
+
+    // rasterize at the resolution the frame's geometry was projected for
+    renderer->render_width = frame->render_width;
+    renderer->render_height = frame->render_height;
+
+    clear_color_buffer(renderer, 0xFF000000);
+    clear_z_buffer(renderer);
+
+    draw_grid(renderer, pixel_from_argb(0xFF404040));
+    // loop all projected triangles and render them
+    for (int i = 0; i < frame->num_triangles_to_render; i++) {
+        triangle_t triangle = frame->triangles_to_render[i];
+
+        if (render_method == RENDER_WIRE_VERTEX) {
+            draw_rect(renderer, triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6,
+                      pixel_from_argb(0xFFFFFF00));
+            draw_rect(renderer, triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6,
+                      pixel_from_argb(0xFFFFFF00));
+            draw_rect(renderer, triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6,
+                      pixel_from_argb(0xFFFFFF00));
+        }
+
+        if ((render_method == RENDER_TEXTURED ||
+             render_method == RENDER_TEXTURED_WIRE) &&
+            triangle.texture) {
+            draw_textured_triangle(
+                renderer, triangle.points[0].x, triangle.points[0].y, triangle.points[0].z,
+                triangle.points[0].w, triangle.texcoords[0].u,
+                triangle.texcoords[0].v, // vertex A
+                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z,
+                triangle.points[1].w, triangle.texcoords[1].u,
+                triangle.texcoords[1].v, // vertex B
+                triangle.points[2].x, triangle.points[2].y, triangle.points[2].z,
+                triangle.points[2].w, triangle.texcoords[2].u,
+                triangle.texcoords[2].v, // vertex C
+                triangle.texture);
+        }
+        if (render_method == RENDER_WIRE_VERTEX ||
+            render_method == RENDER_FILL_TRIANGLE_WIRE ||
+            render_method == RENDER_WIRE) {
+            draw_triangle(
+
+                renderer, triangle.points[0].x, triangle.points[0].y, triangle.points[1].x,
+                triangle.points[1].y, triangle.points[2].x, triangle.points[2].y,
+                0xFFFFFFFF
+
+            );
+        }
+
+        if (render_method == RENDER_FILL_TRIANGLE ||
+            render_method == RENDER_FILL_TRIANGLE_WIRE) {
+            draw_filled_triangle(
+
+                renderer, triangle.points[0].x, triangle.points[0].y, triangle.points[0].z,
+                triangle.points[0].w, triangle.points[1].x, triangle.points[1].y,
+                triangle.points[1].z, triangle.points[1].w, triangle.points[2].x,
+                triangle.points[2].y, triangle.points[2].z, triangle.points[2].w,
+                triangle.color
+
+            );
+        }
+    }
+
+    frame->raster_ms = stats_now_ms() - raster_start;
+}
+
+void renderer_finish_frame(renderer_t *renderer) {
+    frame_t *frame = pipeline_current_frame(&renderer->pipeline);
+
+    long texture_bytes = 0, texture_bytes_without_mips = 0;
+    if (renderer->count_texture_fetches) {
+        scene_t *scene = renderer->scene;
+        for (int i = 0; i < array_length(scene->materials); i++) {
+            long bytes, bytes_without_mips;
+            texture_fetched_bytes(&scene->materials[i], &bytes, &bytes_without_mips);
+            texture_bytes += bytes;
+            texture_bytes_without_mips += bytes_without_mips;
+        }
+    }
+
+    frame_stats_t frame_stats = {
+        .geometry_ms = frame->geometry_ms,
+        .raster_ms = frame->raster_ms,
+        .latency_ms = stats_now_ms() - frame->submit_time,
+        .render_scale = (float)frame->render_width / renderer->width,
+        .num_triangles = frame->num_triangles_to_render,
+        .num_instances = frame->num_instances,
+        .instances_outside = frame->instances_outside,
+        .bvh_nodes_visited = frame->bvh_nodes_visited,
+        .num_meshlets = frame->num_meshlets,
+        .meshlets_outside = frame->meshlets_outside,
+        .meshlets_backfacing = frame->meshlets_backfacing,
+        .lod_level = frame->lod_level,
+        .triangles_submitted = frame->triangles_submitted,
+        .full_triangles = frame->full_triangles,
+        .texture_bytes = texture_bytes,
+        .texture_bytes_without_mips = texture_bytes_without_mips};
+    if (renderer->print_stats) {
+        stats_record_frame(&renderer->stats, &frame_stats);
+    }
+
+    // pick the resolution of the next frame from how long this one took
+    update_render_scale(renderer, frame_stats.raster_ms);
+
+    // In pipelined mode the next frame's geometry was built while this one was
+    // rasterized; pick it up for the next frame
+    pipeline_sync(&renderer->pipeline);
+}
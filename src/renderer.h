@@ -0,0 +1,107 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "bvh.h"
+#include "camera.h"
+#include "clipping.h"
+#include "draw.h"
+#include "light.h"
+#include "matrix.h"
+#include "pipeline.h"
+#include "scene.h"
+#include "stats.h"
+#include "vector.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// What the geometry stage keeps of each instance between frames
+typedef struct {
+    scene_instance_t instance; // as last seen, to tell when it has moved
+    mat4_t world_matrix;
+    int lod_level; // last drawn, for the hysteresis of lod_select
+} instance_state_t;
+
+// Everything a view of a scene is rendered with. Renderers share nothing but
+// the scene they draw, which they only read unless counting texture fetches,
+// so each one can render on a thread of its own
+struct renderer {
+    // The buffers are allocated at width x height, but only the top-left
+    // render_width x render_height area is drawn
+    uint32_t *color_buffer;
+    float *z_buffer;
+    int width;
+    int height;
+    int render_width;
+    int render_height;
+
+    scene_t *scene;
+    camera_t camera;
+    light_t light;
+    mat4_t proj_matrix;
+    plane_t frustum_planes[NUM_PLANES]; // in camera space
+
+    enum cull_method cull_method;
+    enum render_method render_method;
+
+    bool mipmapping; // sample minified triangles from a smaller mip level
+    // Mark the texture lines sampled in the textures themselves, for the
+    // stats. Only one renderer of a scene may count at a time
+    bool count_texture_fetches;
+    bool meshlet_culling; // cull whole meshlets before their faces are visited
+    bool bvh_culling;     // cull instances through the tree rather than one by one
+    bool lod_enabled;
+    float lod_error_pixels; // on screen error a level of detail is allowed
+
+    // When enabled, the render scale follows the measured raster time
+    bool dynamic_resolution;
+    float render_scale;
+
+    // Camera space positions of the vertex buffer of the instance being
+    // drawn, rebuilt for each instance
+    vec4_t *view_vertices;
+    int view_vertices_capacity;
+
+    // The state and world space bounds of each instance, the instances found
+    // in view, and the tree they are culled through; all grown together
+    instance_state_t *instance_states;
+    bvh_sphere_t *instance_bounds;
+    int *visible_instances;
+    int instance_states_capacity;
+    bvh_t instance_bvh;
+
+    pipeline_t pipeline;
+    stats_t stats;
+    bool print_stats; // print the averaged stats once a second
+};
+
+// Allocate width x height buffers to draw the scene into and start the
+// pipeline. The camera starts at the origin looking down +z, drawing
+// wireframes with backface culling. Returns false if out of memory
+bool renderer_init(renderer_t *renderer, int width, int height, scene_t *scene);
+void renderer_destroy(renderer_t *renderer);
+
+// Move the camera to position, looking along its yaw angle
+void renderer_set_camera(renderer_t *renderer, vec3_t position, float yaw_angle);
+
+// Forget the levels of detail drawn so far, so the next frame picks them
+// afresh and comes out the same whatever frames were drawn before it
+void renderer_forget_frames(renderer_t *renderer);
+
+// Render the scene as it is now: submit, draw and finish a frame back to back.
+// The image is left in the top-left render_width x render_height pixels of the
+// color buffer, render_width pixels a row. When pipelined, it is the frame
+// submitted by the call before
+void renderer_render_frame(renderer_t *renderer);
+
+// Snapshot the camera and the scene's instances, and run the geometry stage
+// of the next frame, or start it on the pipeline's thread when pipelined
+void renderer_submit_frame(renderer_t *renderer);
+
+// Rasterize the current frame into the color buffer
+void renderer_draw_frame(renderer_t *renderer);
+
+// Record the stats of the frame drawn, once it has been presented, pick the
+// resolution of the next one and pick up its geometry
+void renderer_finish_frame(renderer_t *renderer);
+
+#endif
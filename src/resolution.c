@@ -0,0 +1,45 @@
+#include "resolution.h"
+#include "renderer.h"
+#include <math.h>
+
+// Ignore corrections smaller than this so the resolution doesn't jitter around
+// the budget every frame
+#define RENDER_SCALE_DEADBAND 0.02f
+
+// How much of the correction is applied per frame, to smooth out spikes
+#define RENDER_SCALE_DAMPING 0.3f
+
+void update_render_scale(renderer_t *renderer, float raster_ms) {
+    float render_scale = renderer->render_scale;
+    if (!renderer->dynamic_resolution) {
+        renderer->render_scale = MAX_RENDER_SCALE;
+        return;
+    }
+    if (raster_ms <= 0) {
+        return;
+    }
+
+    // Raster time grows with the pixel count, which is the square of the scale
+    float ideal_scale = render_scale * sqrtf(RASTER_BUDGET_MS / raster_ms);
+    float correction = (ideal_scale - render_scale) * RENDER_SCALE_DAMPING;
+
+    if (fabsf(correction) < RENDER_SCALE_DEADBAND) {
+        return;
+    }
+
+    render_scale += correction;
+    if (render_scale < MIN_RENDER_SCALE)
+        render_scale = MIN_RENDER_SCALE;
+    if (render_scale > MAX_RENDER_SCALE)
+        render_scale = MAX_RENDER_SCALE;
+    renderer->render_scale = render_scale;
+}
+
+void scaled_render_size(const renderer_t *renderer, int *width, int *height) {
+    *width = (int)(renderer->width * renderer->render_scale);
+    *height = (int)(renderer->height * renderer->render_scale);
+    if (*width < 1)
+        *width = 1;
+    if (*height < 1)
+        *height = 1;
+}
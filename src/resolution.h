@@ -0,0 +1,25 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include "draw.h"
+#include <stdbool.h>
+
+// The frame rate the viewer paces itself to
+#define FPS 30
+#define FRAME_TARGET_TIME (1000 / FPS)
+
+#define MIN_RENDER_SCALE 0.25f
+#define MAX_RENDER_SCALE 1.0f
+
+// Part of the frame time the raster stage is allowed to take; the rest is left
+// for geometry, presenting and input
+#define RASTER_BUDGET_MS (FRAME_TARGET_TIME * 0.75f)
+
+// Follow the measured raster time with the renderer's render scale, when it
+// has dynamic resolution enabled
+void update_render_scale(renderer_t *renderer, float raster_ms);
+
+// The renderer's buffer size scaled down by its render scale
+void scaled_render_size(const renderer_t *renderer, int *width, int *height);
+
+#endif
@@ -0,0 +1,107 @@
+#include "scene.h"
+#include "array.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Distance between neighbouring instances of a crowd, and how far in front
+// of the camera its first row stands
+#define CROWD_SPACING 5.0f
+#define CROWD_DISTANCE 8.0f
+
+int scene_add_mesh(scene_t *scene, const char *filename) {
+    mesh_t mesh;
+    memset(&mesh, 0, sizeof(mesh));
+    if (!load_obj_file_data(&mesh, filename)) {
+        free_mesh(&mesh);
+        return -1;
+    }
+    int index = array_length(scene->meshes);
+    array_push(scene->meshes, mesh);
+    if (array_length(scene->meshes) == index) {
+        fprintf(stderr, "Error allocating memory for mesh %s. \n", filename);
+        free_mesh(&mesh);
+        return -1;
+    }
+    return index;
+}
+
+int scene_add_material(scene_t *scene, const char *filename) {
+    texture_t texture;
+    if (!load_texture(&texture, filename, TEXTURE_LAYOUT_TILED)) {
+        fprintf(stderr, "Error loading texture %s. \n", filename);
+        return -1;
+    }
+    int index = array_length(scene->materials);
+    array_push(scene->materials, texture);
+    if (array_length(scene->materials) == index) {
+        fprintf(stderr, "Error allocating memory for texture %s. \n", filename);
+        free_texture(&texture);
+        return -1;
+    }
+    return index;
+}
+
+int scene_add_instance(scene_t *scene, int mesh, int material, vec3_t translation) {
+    scene_instance_t instance = {.mesh = mesh,
+                                 .material = material,
+                                 .rotation = {0, 0, 0},
+                                 .scale = {1, 1, 1},
+                                 .translation = translation};
+    int index = array_length(scene->instances);
+    array_push(scene->instances, instance);
+    return array_length(scene->instances) > index ? index : -1;
+}
+
+bool scene_add_crowd(scene_t *scene, int count) {
+    static const char *const names[] = {"f22", "f117", "efa"};
+    int num_assets = sizeof(names) / sizeof(names[0]);
+    int meshes[sizeof(names) / sizeof(names[0])];
+    int materials[sizeof(names) / sizeof(names[0])];
+
+    for (int i = 0; i < num_assets; i++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "./assets/%s.obj", names[i]);
+        meshes[i] = scene_add_mesh(scene, filename);
+        snprintf(filename, sizeof(filename), "./assets/%s.png", names[i]);
+        materials[i] = scene_add_material(scene, filename);
+        if (meshes[i] < 0 || materials[i] < 0) {
+            return false;
+        }
+    }
+
+    // rows across the view, going away from the camera
+    int columns = (int)ceilf(sqrtf((float)count));
+    for (int i = 0; i < count; i++) {
+        vec3_t translation = {(i % columns - (columns - 1) / 2.0f) * CROWD_SPACING, 0,
+                              CROWD_DISTANCE + (i / columns) * CROWD_SPACING};
+        if (scene_add_instance(scene, meshes[i % num_assets], materials[i % num_assets],
+                               translation) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void scene_animate(scene_t *scene, float delta_time) {
+    for (int i = 0; i < array_length(scene->instances); i++) {
+        scene->instances[i].rotation.x += 0.01 * delta_time;
+        scene->instances[i].rotation.y += 0.01 * delta_time;
+        scene->instances[i].rotation.z += 0.01 * delta_time;
+    }
+}
+
+void free_scene(scene_t *scene) {
+    for (int i = 0; i < array_length(scene->meshes); i++) {
+        free_mesh(&scene->meshes[i]);
+    }
+    for (int i = 0; i < array_length(scene->materials); i++) {
+        free_texture(&scene->materials[i]);
+    }
+    array_free(scene->meshes);
+    array_free(scene->materials);
+    array_free(scene->instances);
+    scene->meshes = NULL;
+    scene->materials = NULL;
+    scene->instances = NULL;
+}
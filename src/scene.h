@@ -0,0 +1,45 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "mesh.h"
+#include "texture.h"
+#include "vector.h"
+#include <stdbool.h>
+
+// One placement of a mesh in the world. Instances are only a transform and
+// references into the scene's meshes and materials, so any number of them
+// share one copy of the vertices, indices and texture
+typedef struct {
+    int mesh;     // index into scene.meshes
+    int material; // index into scene.materials, the texture the faces sample
+    vec3_t rotation;
+    vec3_t scale;
+    vec3_t translation;
+} scene_instance_t;
+
+typedef struct {
+    mesh_t *meshes;              // dynamic array
+    texture_t *materials;        // dynamic array
+    scene_instance_t *instances; // dynamic array, drawn in order
+} scene_t;
+
+// Load an OBJ file or a PNG texture into the scene. Return its index, or -1
+// if it couldn't be loaded
+int scene_add_mesh(scene_t *scene, const char *filename);
+int scene_add_material(scene_t *scene, const char *filename);
+
+// Place mesh at translation, unrotated and unscaled. Returns its index, or -1
+// if out of memory
+int scene_add_instance(scene_t *scene, int mesh, int material, vec3_t translation);
+
+// Load the f22, f117 and efa and place count instances of them, taking turns,
+// on a grid in front of the camera. Returns false if an asset failed to load
+// or there was no memory for the instances
+bool scene_add_crowd(scene_t *scene, int count);
+
+// Spin every instance a little further, by how much time has passed in seconds
+void scene_animate(scene_t *scene, float delta_time);
+
+void free_scene(scene_t *scene);
+
+#endif
@@ -0,0 +1,84 @@
+#include "stats.h"
+#include <stdio.h>
+#include <time.h>
+
+#define STATS_REPORT_INTERVAL_MS 1000.0
+
+double stats_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+void stats_record_frame(stats_t *stats, const frame_stats_t *frame) {
+    frame_stats_t *totals = &stats->totals;
+    double now = stats_now_ms();
+    if (stats->num_frames == 0 && stats->report_start_time == 0) {
+        stats->report_start_time = now;
+    }
+
+    totals->geometry_ms += frame->geometry_ms;
+    totals->raster_ms += frame->raster_ms;
+    totals->latency_ms += frame->latency_ms;
+    totals->render_scale += frame->render_scale;
+    totals->num_triangles += frame->num_triangles;
+    totals->num_instances += frame->num_instances;
+    totals->instances_outside += frame->instances_outside;
+    totals->bvh_nodes_visited += frame->bvh_nodes_visited;
+    totals->num_meshlets += frame->num_meshlets;
+    totals->meshlets_outside += frame->meshlets_outside;
+    totals->meshlets_backfacing += frame->meshlets_backfacing;
+    totals->lod_level += frame->lod_level;
+    totals->triangles_submitted += frame->triangles_submitted;
+    totals->full_triangles += frame->full_triangles;
+    totals->texture_bytes += frame->texture_bytes;
+    totals->texture_bytes_without_mips += frame->texture_bytes_without_mips;
+    stats->num_frames++;
+
+    int num_frames = stats->num_frames;
+    double elapsed = now - stats->report_start_time;
+    if (elapsed < STATS_REPORT_INTERVAL_MS) {
+        return;
+    }
+
+    // throughput is frames presented per second, latency is how old the
+    // geometry of a frame is by the time it reaches the screen
+    printf("%.1f fps | geometry %.2f ms | raster %.2f ms | latency %.2f ms | "
+           "scale %.2f | %d triangles\n",
+           num_frames * 1000.0 / elapsed, totals->geometry_ms / num_frames,
+           totals->raster_ms / num_frames, totals->latency_ms / num_frames,
+           totals->render_scale / num_frames, totals->num_triangles / num_frames);
+
+    if (totals->num_instances > num_frames) {
+        printf("    instances culled per frame: %.1f outside the frustum, of %d, "
+               "%.1f tree nodes visited\n",
+               (float)totals->instances_outside / num_frames,
+               totals->num_instances / num_frames,
+               (float)totals->bvh_nodes_visited / num_frames);
+    }
+
+    if (totals->num_meshlets > 0) {
+        printf("    meshlets culled per frame: %.1f outside the frustum, %.1f backfacing, "
+               "of %d\n",
+               (float)totals->meshlets_outside / num_frames,
+               (float)totals->meshlets_backfacing / num_frames,
+               totals->num_meshlets / num_frames);
+    }
+
+    if (totals->full_triangles > 0) {
+        printf("    level of detail %.1f: %d triangles submitted per frame, of %d at full "
+               "detail\n",
+               totals->lod_level / num_frames, totals->triangles_submitted / num_frames,
+               totals->full_triangles / num_frames);
+    }
+
+    if (totals->texture_bytes_without_mips > 0) {
+        printf("    texture fetched per frame: %.1f KB sampled, %.1f KB without mips\n",
+               totals->texture_bytes / 1024.0 / num_frames,
+               totals->texture_bytes_without_mips / 1024.0 / num_frames);
+    }
+
+    *totals = (frame_stats_t){0};
+    stats->num_frames = 0;
+    stats->report_start_time = now;
+}
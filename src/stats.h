@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Timings of a single presented frame, averaged and printed once per second
+typedef struct {
+    float geometry_ms;  // transform, cull, clip and project the frame
+    float raster_ms;    // draw the frame's triangles into the color buffer
+    float latency_ms;   // from the geometry snapshot to the frame being presented
+    float render_scale; // internal resolution relative to the window
+    int num_triangles;
+
+    // instances of the scene, and those culled whole
+    int num_instances;
+    int instances_outside;
+    int bvh_nodes_visited; // nodes of the instance tree culled through
+
+    // meshlets drawn from, and those culled before any of their faces
+    int num_meshlets;
+    int meshlets_outside;
+    int meshlets_backfacing;
+
+    // average level of detail drawn, and the faces sent through the face loop
+    // out of those of the instances drawn at full detail
+    float lod_level;
+    int triangles_submitted;
+    int full_triangles;
+
+    // distinct texture memory sampled, with and without mipmapping; only
+    // filled in while texture fetches are being counted
+    long texture_bytes;
+    long texture_bytes_without_mips;
+} frame_stats_t;
+
+// The frames recorded since the last report
+typedef struct {
+    frame_stats_t totals;
+    int num_frames;
+    double report_start_time;
+} stats_t;
+
+double stats_now_ms(void);
+void stats_record_frame(stats_t *stats, const frame_stats_t *frame);
+
+#endif
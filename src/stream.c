@@ -0,0 +1,198 @@
+#include "stream.h"
+#include "pixel.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static void *stream_writer(void *arg) {
+    stream_t *stream = arg;
+
+    // A reader going away fails the write with EPIPE instead of killing the
+    // process
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, NULL);
+
+    pthread_mutex_lock(&stream->mutex);
+    for (;;) {
+        while (stream->count == 0 && !stream->closing) {
+            pthread_cond_wait(&stream->frame_queued, &stream->mutex);
+        }
+        if (stream->count == 0) {
+            break;
+        }
+        int slot = stream->head;
+        pthread_mutex_unlock(&stream->mutex);
+
+        double start = stats_now_ms();
+        bool ok = write_all(stream->fd, stream->frames[slot], stream->frame_size);
+        double end = stats_now_ms();
+
+        pthread_mutex_lock(&stream->mutex);
+        stream_stats_t *stats = &stream->stats;
+        double write_ms = end - start;
+        double latency_ms = end - stream->queued_at[slot];
+        stats->write_ms += write_ms;
+        stats->latency_ms += latency_ms;
+        if (write_ms > stats->max_write_ms) {
+            stats->max_write_ms = write_ms;
+        }
+        if (latency_ms > stats->max_latency_ms) {
+            stats->max_latency_ms = latency_ms;
+        }
+        stream->head = (stream->head + 1) % STREAM_RING_FRAMES;
+        stream->count--;
+        if (ok) {
+            stats->frames_written++;
+        } else {
+            fprintf(stderr, "Error writing the stream: %s. \n", strerror(errno));
+            stream->failed = true;
+        }
+        pthread_cond_signal(&stream->frame_written);
+        if (!ok) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stream->mutex);
+    return NULL;
+}
+
+bool stream_open(stream_t *stream, const char *path, enum stream_format format,
+                 int width, int height, bool drop_when_full) {
+    *stream = (stream_t){.format = format,
+                         .width = width,
+                         .height = height,
+                         .drop_when_full = drop_when_full};
+    if (format == STREAM_YUV420) {
+        stream->frame_size =
+            (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    } else {
+        stream->frame_size = (size_t)width * height * 4;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        // Keep stdout's file for the frames, and point stdout itself at stderr
+        fflush(stdout);
+        stream->fd = dup(STDOUT_FILENO);
+        if (stream->fd >= 0) {
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+    } else {
+        stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (stream->fd < 0) {
+        fprintf(stderr, "Error opening %s: %s. \n", path, strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < STREAM_RING_FRAMES; i++) {
+        stream->frames[i] = malloc(stream->frame_size);
+        if (!stream->frames[i]) {
+            fprintf(stderr, "Error allocating memory for the stream. \n");
+            for (int j = 0; j < i; j++) {
+                free(stream->frames[j]);
+            }
+            close(stream->fd);
+            return false;
+        }
+    }
+
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->frame_queued, NULL);
+    pthread_cond_init(&stream->frame_written, NULL);
+    if (pthread_create(&stream->writer, NULL, stream_writer, stream) != 0) {
+        fprintf(stderr, "Error creating the stream writer thread. \n");
+        pthread_mutex_destroy(&stream->mutex);
+        pthread_cond_destroy(&stream->frame_queued);
+        pthread_cond_destroy(&stream->frame_written);
+        for (int i = 0; i < STREAM_RING_FRAMES; i++) {
+            free(stream->frames[i]);
+        }
+        close(stream->fd);
+        return false;
+    }
+    return true;
+}
+
+bool stream_push_frame(stream_t *stream, const uint32_t *pixels) {
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->count == STREAM_RING_FRAMES && !stream->failed) {
+        if (stream->drop_when_full) {
+            stream->stats.frames_dropped++;
+            pthread_mutex_unlock(&stream->mutex);
+            return true;
+        }
+
+        double start = stats_now_ms();
+        while (stream->count == STREAM_RING_FRAMES && !stream->failed) {
+            pthread_cond_wait(&stream->frame_written, &stream->mutex);
+        }
+        stream->stats.frames_stalled++;
+        stream->stats.stall_ms += stats_now_ms() - start;
+    }
+    if (stream->failed) {
+        pthread_mutex_unlock(&stream->mutex);
+        return false;
+    }
+    int slot = (stream->head + stream->count) % STREAM_RING_FRAMES;
+    pthread_mutex_unlock(&stream->mutex);
+
+    // Only this thread fills free slots, so the conversion needs no lock
+    if (stream->format == STREAM_YUV420) {
+        pixels_to_yuv420(stream->frames[slot], pixels, stream->width, stream->height);
+    } else {
+        pixels_to_rgba(stream->frames[slot], pixels, stream->width * stream->height);
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->queued_at[slot] = stats_now_ms();
+    stream->count++;
+    pthread_cond_signal(&stream->frame_queued);
+    pthread_mutex_unlock(&stream->mutex);
+    return true;
+}
+
+void stream_close(stream_t *stream) {
+    pthread_mutex_lock(&stream->mutex);
+    stream->closing = true;
+    pthread_cond_signal(&stream->frame_queued);
+    pthread_mutex_unlock(&stream->mutex);
+    pthread_join(stream->writer, NULL);
+
+    close(stream->fd);
+    pthread_mutex_destroy(&stream->mutex);
+    pthread_cond_destroy(&stream->frame_queued);
+    pthread_cond_destroy(&stream->frame_written);
+    for (int i = 0; i < STREAM_RING_FRAMES; i++) {
+        free(stream->frames[i]);
+    }
+
+    const stream_stats_t *stats = &stream->stats;
+    int num_written = stats->frames_written > 0 ? stats->frames_written : 1;
+    printf("Streamed %d frames: %d dropped, %d stalled for %.1f ms | write %.2f ms, "
+           "%.2f ms max | latency %.2f ms, %.2f ms max\n",
+           stats->frames_written, stats->frames_dropped, stats->frames_stalled,
+           stats->stall_ms, stats->write_ms / num_written, stats->max_write_ms,
+           stats->latency_ms / num_written, stats->max_latency_ms);
+}
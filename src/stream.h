@@ -0,0 +1,72 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames that can be waiting for the writer before the renderer has to wait
+// for it or drop frames
+#define STREAM_RING_FRAMES 4
+
+enum stream_format {
+    STREAM_RGBA,   // 4 bytes a pixel
+    STREAM_YUV420, // planar, with chroma at half resolution (see pixels_to_yuv420)
+};
+
+// How the stream kept up, since it was opened
+typedef struct {
+    int frames_written;
+    int frames_dropped; // thrown away because the ring was full
+    int frames_stalled; // that had to wait for room in the ring
+    double stall_ms;    // time the renderer spent waiting
+    double write_ms;    // time spent in write, and the longest a frame took
+    double max_write_ms;
+    double latency_ms; // from a frame being queued to it being written
+    double max_latency_ms;
+} stream_stats_t;
+
+// Raw frames written to a file, pipe or stdout by a thread of their own, so a
+// slow reader holds up the renderer only once the ring of frames is full
+typedef struct {
+    int fd;
+    enum stream_format format;
+    int width;
+    int height;
+    size_t frame_size;
+
+    // When the ring is full, drop the frame rather than wait for the writer
+    bool drop_when_full;
+
+    // frames[head] is the oldest of count frames queued, each converted when it
+    // was queued
+    uint8_t *frames[STREAM_RING_FRAMES];
+    double queued_at[STREAM_RING_FRAMES];
+    int head;
+    int count;
+
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t frame_queued;
+    pthread_cond_t frame_written;
+    bool closing;
+    bool failed; // a write failed, the reader probably went away
+
+    stream_stats_t stats;
+} stream_t;
+
+// Open a stream of width x height frames to path, or to stdout if path is "-".
+// Whatever else is printed to stdout goes to stderr from then on, to keep it
+// out of the frames. Writing to a named pipe waits for it to have a reader
+bool stream_open(stream_t *stream, const char *path, enum stream_format format,
+                 int width, int height, bool drop_when_full);
+
+// Convert width x height pixels and queue them to be written. Returns false
+// once writing has failed
+bool stream_push_frame(stream_t *stream, const uint32_t *pixels);
+
+// Write out the frames still queued, close the stream and print its stats
+void stream_close(stream_t *stream);
+
+#endif
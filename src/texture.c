@@ -1,28 +1,236 @@
 #include "texture.h"
-#include "display.h"
+#include "draw.h"
+#include "pixel.h"
 #include "upng.h"
+#include <math.h>
 #include <stdint.h>
-#include <stdio.h>
-#include <wchar.h>
-
-color_t *mesh_texture = NULL;
-int texture_width = 64;
-int texture_height = 64;
-upng_t *png_texture = NULL;
-
-void load_png_texture_data(char *filename) {
-    png_texture = upng_new_from_file(filename);
-    if (png_texture != NULL) {
-        upng_decode(png_texture);
-        if (upng_get_error(png_texture) == UPNG_EOK) {
-            mesh_texture = (uint32_t *)upng_get_buffer(png_texture);
-            texture_height = upng_get_height(png_texture);
-            texture_width = upng_get_width(png_texture);
+#include <stdlib.h>
+#include <string.h>
+
+// 16 texels of 4 bytes make up a 64-byte cache line
+#define TEXELS_PER_LINE_SHIFT 4
+#define LINE_SIZE 64
+
+
+static int level_num_texels(const mip_level_t *level) {
+    if (level->layout == TEXTURE_LAYOUT_TILED) {
+        int tile_rows = (level->height + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+        return level->tiles_per_row * tile_rows * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+    }
+    return level->width * level->height;
+}
+
+static uint32_t *alloc_line_bits(int num_texels) {
+    int num_lines = (num_texels >> TEXELS_PER_LINE_SHIFT) + 1;
+    return (uint32_t *)calloc((num_lines + 31) / 32, sizeof(uint32_t));
+}
+
+// Copy a row-major image into a mip level with the given layout
+static bool store_level(mip_level_t *level, const uint32_t *pixels, int width,
+                        int height, enum texture_layout layout) {
+    level->width = width;
+    level->height = height;
+    level->tiles_per_row = (width + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+    level->layout = layout;
+
+    // tiled levels are padded to whole tiles
+    int num_texels = level_num_texels(level);
+    level->texels = (uint32_t *)calloc(num_texels, sizeof(uint32_t));
+    level->fetched_lines = alloc_line_bits(num_texels);
+    if (!level->texels || !level->fetched_lines) {
+        return false;
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            level->texels[texture_texel_index(level, x, y)] = pixels[(width * y) + x];
+        }
+    }
+    return true;
+}
+
+// Average each 2x2 block of a row-major image into a half-sized one. Odd
+// widths or heights reuse the last column or row
+static uint32_t *downsample(const uint32_t *pixels, int width, int height,
+                           int *half_width, int *half_height) {
+    *half_width = width > 1 ? width / 2 : 1;
+    *half_height = height > 1 ? height / 2 : 1;
+
+    uint32_t *half = (uint32_t *)malloc(sizeof(uint32_t) * *half_width * *half_height);
+    if (!half) {
+        return NULL;
+    }
+
+    for (int y = 0; y < *half_height; y++) {
+        int y0 = y * 2;
+        int y1 = y0 + 1 < height ? y0 + 1 : y0;
+        for (int x = 0; x < *half_width; x++) {
+            int x0 = x * 2;
+            int x1 = x0 + 1 < width ? x0 + 1 : x0;
+            uint32_t block[4] = {pixels[width * y0 + x0], pixels[width * y0 + x1],
+                                 pixels[width * y1 + x0], pixels[width * y1 + x1]};
+
+            uint32_t average = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t sum = 2; // round to nearest
+                for (int i = 0; i < 4; i++) {
+                    sum += (block[i] >> shift) & 0xFF;
+                }
+                average |= (sum / 4) << shift;
+            }
+            half[(*half_width * y) + x] = average;
+        }
+    }
+    return half;
+}
+
+// Decode a PNG into a mipmapped texture with the given texel layout
+bool load_texture(texture_t *texture, const char *filename, enum texture_layout layout) {
+    memset(texture, 0, sizeof(*texture));
+
+    upng_t *png_image = upng_new_from_file(filename);
+    if (png_image == NULL) {
+        return false;
+    }
+
+    upng_decode(png_image);
+    upng_format format = upng_get_format(png_image);
+    if (upng_get_error(png_image) != UPNG_EOK ||
+        (format != UPNG_RGBA8 && format != UPNG_RGB8)) {
+        upng_free(png_image);
+        return false;
+    }
+
+    int width = upng_get_width(png_image);
+    int height = upng_get_height(png_image);
+    uint32_t *pixels = (uint32_t *)malloc(sizeof(uint32_t) * width * height);
+    if (!pixels) {
+        upng_free(png_image);
+        return false;
+    }
+
+    // Swizzle once into the pixel format of the color buffer, so drawing a
+    // texel is a plain copy
+    pixels_from_rgba(pixels, upng_get_buffer(png_image), width * height,
+                     format == UPNG_RGBA8 ? 4 : 3);
+    upng_free(png_image);
+
+    // Build the mip chain, each level box filtered from the one above it
+    bool ok = true;
+    while (ok && texture->num_levels < MAX_MIP_LEVELS) {
+        ok = store_level(&texture->levels[texture->num_levels++], pixels, width,
+                         height, layout);
+        if (!ok || (width == 1 && height == 1)) {
+            break;
         }
+
+        uint32_t *half = downsample(pixels, width, height, &width, &height);
+        free(pixels);
+        pixels = half;
+        ok = pixels != NULL;
+    }
+    free(pixels);
+
+    texture->fetched_base_lines = alloc_line_bits(level_num_texels(&texture->levels[0]));
+    if (!ok || !texture->fetched_base_lines) {
+        free_texture(texture);
+        return false;
+    }
+
+    texture_set_wrap(texture, TEXTURE_WRAP_CLAMP);
+    return true;
+}
+
+static bool is_power_of_two(int n) { return n > 0 && (n & (n - 1)) == 0; }
+
+static int log2_int(int n) {
+    int log = 0;
+    while (n > 1) {
+        n >>= 1;
+        log++;
     }
+    return log;
+}
+
+// Choose how every mip level of the texture addresses its texels, so the
+// sampler doesn't have to work it out per pixel
+void texture_set_wrap(texture_t *texture, enum texture_wrap wrap) {
+    texture->wrap = wrap;
+
+    for (int i = 0; i < texture->num_levels; i++) {
+        mip_level_t *level = &texture->levels[i];
+        bool power_of_two = is_power_of_two(level->width) && is_power_of_two(level->height);
+
+        if (power_of_two) {
+            level->address = wrap == TEXTURE_WRAP_REPEAT ? TEXTURE_ADDRESS_POT_REPEAT
+                                                         : TEXTURE_ADDRESS_POT_CLAMP;
+            level->shift_x = TEXCOORD_FRACTION_BITS - log2_int(level->width);
+            level->shift_y = TEXCOORD_FRACTION_BITS - log2_int(level->height);
+        } else {
+            level->address = wrap == TEXTURE_WRAP_REPEAT ? TEXTURE_ADDRESS_NPOT_REPEAT
+                                                         : TEXTURE_ADDRESS_NPOT_CLAMP;
+            level->shift_x = 0;
+            level->shift_y = 0;
+        }
+    }
+}
+
+void free_texture(texture_t *texture) {
+    for (int i = 0; i < texture->num_levels; i++) {
+        free(texture->levels[i].texels);
+        free(texture->levels[i].fetched_lines);
+    }
+    free(texture->fetched_base_lines);
+    memset(texture, 0, sizeof(*texture));
+}
+
+// Pick the mip level whose texels are closest to one per pixel, given the
+// area a triangle covers in base level texels and in screen pixels
+int texture_select_level(const texture_t *texture, float texel_area, float pixel_area) {
+    if (texel_area <= pixel_area || pixel_area <= 0) {
+        return 0;
+    }
+
+    // each level halves the texel footprint along both axes
+    int level = (int)(0.5f * log2f(texel_area / pixel_area) + 0.5f);
+    return level < texture->num_levels ? level : texture->num_levels - 1;
+}
+
+// Track which cache lines a frame samples, both from the level it uses and
+// from the base level it would have used without mipmapping
+void texture_count_fetches(texture_t *texture, const mip_level_t *level, int index,
+                           float u, float v) {
+    int line = index >> TEXELS_PER_LINE_SHIFT;
+    level->fetched_lines[line / 32] |= 1u << (line % 32);
+
+    int base_line =
+        texture_sample_index(&texture->levels[0], u, v) >> TEXELS_PER_LINE_SHIFT;
+    texture->fetched_base_lines[base_line / 32] |= 1u << (base_line % 32);
+}
+
+static long count_and_clear_lines(uint32_t *lines, int num_texels) {
+    int num_words = ((num_texels >> TEXELS_PER_LINE_SHIFT) + 1 + 31) / 32;
+    long count = 0;
+    for (int i = 0; i < num_words; i++) {
+        count += __builtin_popcount(lines[i]);
+        lines[i] = 0;
+    }
+    return count * LINE_SIZE;
+}
+
+// Bytes of distinct texture memory sampled since the last call, with the
+// current mip selection and as if everything had been sampled from the base
+void texture_fetched_bytes(texture_t *texture, long *bytes, long *bytes_without_mips) {
+    *bytes = 0;
+    for (int i = 0; i < texture->num_levels; i++) {
+        *bytes += count_and_clear_lines(texture->levels[i].fetched_lines,
+                                        level_num_texels(&texture->levels[i]));
+    }
+    *bytes_without_mips = count_and_clear_lines(
+        texture->fetched_base_lines, level_num_texels(&texture->levels[0]));
 }
 
 tex2_t tex2_clone(tex2_t *t) {
     tex2_t result = {t->u, t->v};
     return result;
-}
\ No newline at end of file
+}
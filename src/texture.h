@@ -2,6 +2,8 @@
 #define TEXTURE_H
 
 #include "upng.h"
+#include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct {
@@ -9,14 +11,131 @@ typedef struct {
     float v;
 } tex2_t;
 
-extern int texture_width;
-extern int texture_height;
-extern uint32_t *mesh_texture;
-extern const uint8_t REDBRICK_TEXTURE[];
+// Texels are kept in 4x4 tiles of 64 bytes, one cache line each, so a triangle
+// walking the texture vertically touches as few lines as one walking it
+// horizontally. The linear row-major layout is kept for comparison
+#define TEXTURE_TILE_SHIFT 2
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_SHIFT)
+#define TEXTURE_TILE_MASK (TEXTURE_TILE_SIZE - 1)
+
+enum texture_layout { TEXTURE_LAYOUT_LINEAR, TEXTURE_LAYOUT_TILED };
+
+// Enough mip levels for a 32768x32768 texture
+#define MAX_MIP_LEVELS 16
+
+// Texture coordinates are sampled as 16.16 fixed point
+#define TEXCOORD_FRACTION_BITS 16
+#define TEXCOORD_ONE (1 << TEXCOORD_FRACTION_BITS)
+
+// What happens to texture coordinates outside [0, 1]
+enum texture_wrap { TEXTURE_WRAP_CLAMP, TEXTURE_WRAP_REPEAT };
+
+// How a mip level turns a fixed point coordinate into a texel, picked once per
+// level from its wrap mode and whether its size is a power of two. Power of
+// two levels only need a shift and a mask, the others a multiply
+enum texture_address {
+    TEXTURE_ADDRESS_POT_CLAMP,
+    TEXTURE_ADDRESS_POT_REPEAT,
+    TEXTURE_ADDRESS_NPOT_CLAMP,
+    TEXTURE_ADDRESS_NPOT_REPEAT
+};
 
-extern upng_t *png_texture;
+typedef struct {
+    uint32_t *texels;
+    int width;
+    int height;
+    int tiles_per_row; // padded width in tiles, for the tiled layout
+    enum texture_layout layout;
+
+    enum texture_address address;
+    int shift_x; // fixed point to texel shifts, for power of two sizes
+    int shift_y;
+
+    // one bit per 64-byte line of texels sampled this frame, when counting
+    uint32_t *fetched_lines;
+} mip_level_t;
+
+// A texture is its base image followed by a chain of half-sized mip levels,
+// down to 1x1
+typedef struct {
+    mip_level_t levels[MAX_MIP_LEVELS];
+    int num_levels;
+    enum texture_wrap wrap;
 
-void load_png_texture_data(char *filename);
+    // lines of the base level that would have been sampled without mipmapping
+    uint32_t *fetched_base_lines;
+} texture_t;
+
+extern const uint8_t REDBRICK_TEXTURE[];
+
+bool load_texture(texture_t *texture, const char *filename, enum texture_layout layout);
+void free_texture(texture_t *texture);
+void texture_set_wrap(texture_t *texture, enum texture_wrap wrap);
 tex2_t tex2_clone(tex2_t *t);
 
-#endif
\ No newline at end of file
+int texture_select_level(const texture_t *texture, float texel_area, float pixel_area);
+
+// Fetches are marked in the texture itself, so they only add up right while
+// one renderer at a time counts them
+void texture_count_fetches(texture_t *texture, const mip_level_t *level, int index,
+                           float u, float v);
+void texture_fetched_bytes(texture_t *texture, long *bytes, long *bytes_without_mips);
+
+// Offset of texel (x, y) in level->texels
+static inline int texture_texel_index(const mip_level_t *level, int x, int y) {
+    if (level->layout == TEXTURE_LAYOUT_LINEAR) {
+        return (level->width * y) + x;
+    }
+    int tile = (y >> TEXTURE_TILE_SHIFT) * level->tiles_per_row +
+               (x >> TEXTURE_TILE_SHIFT);
+    return (tile << (2 * TEXTURE_TILE_SHIFT)) |
+           ((y & TEXTURE_TILE_MASK) << TEXTURE_TILE_SHIFT) | (x & TEXTURE_TILE_MASK);
+}
+
+static inline int clamp_texcoord(int coord) {
+    coord = coord < 0 ? 0 : coord;
+    return coord > TEXCOORD_ONE - 1 ? TEXCOORD_ONE - 1 : coord;
+}
+
+// Fixed point coordinate of a wrapped or clamped texture coordinate. Coordinates
+// are brought into [0, 1] as floats first, as far off ones overflow an int
+static inline int fixed_texcoord(float coord, bool repeat) {
+    coord = repeat ? coord - floorf(coord) : coord;
+    return (int)(fminf(fmaxf(coord, 0.0f), 1.0f) * TEXCOORD_ONE);
+}
+
+// Offset in level->texels of the texel under the texture coordinate (u, v)
+static inline int texture_sample_index(const mip_level_t *level, float u, float v) {
+    bool repeat = level->address == TEXTURE_ADDRESS_POT_REPEAT ||
+                  level->address == TEXTURE_ADDRESS_NPOT_REPEAT;
+    int fixed_u = fixed_texcoord(u, repeat);
+    int fixed_v = fixed_texcoord(v, repeat);
+    int x, y;
+
+    switch (level->address) {
+    case TEXTURE_ADDRESS_POT_CLAMP:
+        x = clamp_texcoord(fixed_u) >> level->shift_x;
+        y = clamp_texcoord(fixed_v) >> level->shift_y;
+        break;
+    case TEXTURE_ADDRESS_POT_REPEAT:
+        x = (fixed_u >> level->shift_x) & (level->width - 1);
+        y = (fixed_v >> level->shift_y) & (level->height - 1);
+        break;
+    case TEXTURE_ADDRESS_NPOT_CLAMP:
+        // Multiplied in 64 bits, as levels may be wider than the 16 bits left
+        x = (int)(((int64_t)clamp_texcoord(fixed_u) * level->width) >>
+                  TEXCOORD_FRACTION_BITS);
+        y = (int)(((int64_t)clamp_texcoord(fixed_v) * level->height) >>
+                  TEXCOORD_FRACTION_BITS);
+        break;
+    default:
+        x = (int)(((int64_t)(fixed_u & (TEXCOORD_ONE - 1)) * level->width) >>
+                  TEXCOORD_FRACTION_BITS);
+        y = (int)(((int64_t)(fixed_v & (TEXCOORD_ONE - 1)) * level->height) >>
+                  TEXCOORD_FRACTION_BITS);
+        break;
+    }
+    return texture_texel_index(level, x, y);
+}
+
+#endif
@@ -1,6 +1,9 @@
 #include "triangle.h"
-#include "display.h"
+#include "draw.h"
+#include "renderer.h"
 #include "swap.h"
+#include <math.h>
+#include <stdlib.h>
 
 vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p)
 {
@@ -31,9 +34,9 @@ vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p)
     return weights;
 }
 
-void draw_texel(int x, int y, color_t *texture, vec4_t point_a, vec4_t point_b,
-                vec4_t point_c, float u0, float v0, float u1, float v1, float u2,
-                float v2)
+void draw_texel(renderer_t *renderer, int x, int y, texture_t *texture,
+                const mip_level_t *level, vec4_t point_a, vec4_t point_b, vec4_t point_c,
+                float u0, float v0, float u1, float v1, float u2, float v2)
 {
     vec2_t p = {x, y};
     vec2_t a = vec2_from_vec4(point_a);
@@ -68,31 +71,26 @@ void draw_texel(int x, int y, color_t *texture, vec4_t point_a, vec4_t point_b,
     interpolated_u /= interpolated_reciprocal_w;
     interpolated_v /= interpolated_reciprocal_w;
 
-    // Clamp UVs to avoid out-of-bounds texture access.
-    if (interpolated_u < 0.0f)
-        interpolated_u = 0.0f;
-    if (interpolated_u > 1.0f)
-        interpolated_u = 1.0f;
-    if (interpolated_v < 0.0f)
-        interpolated_v = 0.0f;
-    if (interpolated_v > 1.0f)
-        interpolated_v = 1.0f;
-
-    // Map the UV coordinate to the full texture width and height
-    int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-    int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
-
     interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
     //  only draw pixel if the depth value is less than the one previously stored
-    if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x])
+    float *depth = &renderer->z_buffer[(renderer->render_width * y) + x];
+    if (interpolated_reciprocal_w < *depth)
     {
-        draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
+        // The level's sampler wraps or clamps the UVs to stay inside the texture
+        int texel_index = texture_sample_index(level, interpolated_u, interpolated_v);
+        draw_pixel(renderer, x, y, level->texels[texel_index]);
+
+        if (renderer->count_texture_fetches)
+        {
+            texture_count_fetches(texture, level, texel_index, interpolated_u,
+                                  interpolated_v);
+        }
 
-        z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+        *depth = interpolated_reciprocal_w;
     }
 }
 
-void draw_triangle_pixel(int x, int y, color_t color, vec4_t point_a, vec4_t point_b, vec4_t point_c)
+void draw_triangle_pixel(renderer_t *renderer, int x, int y, color_t color, vec4_t point_a, vec4_t point_b, vec4_t point_c)
 {
     vec2_t p = {x, y};
     vec2_t a = vec2_from_vec4(point_a);
@@ -117,15 +115,16 @@ void draw_triangle_pixel(int x, int y, color_t color, vec4_t point_a, vec4_t poi
 
     interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
     //  only draw pixel if the depth value is less than the one previously stored
-    if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x])
+    float *depth = &renderer->z_buffer[(renderer->render_width * y) + x];
+    if (interpolated_reciprocal_w < *depth)
     {
-        draw_pixel(x, y, color);
+        draw_pixel(renderer, x, y, color);
 
-        z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+        *depth = interpolated_reciprocal_w;
     }
 }
 
-void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1, float z1, float w1, int x2, int y2, float z2, float w2, color_t color)
+void draw_filled_triangle(renderer_t *renderer, int x0, int y0, float z0, float w0, int x1, int y1, float z1, float w1, int x2, int y2, float z2, float w2, color_t color)
 {
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1)
@@ -181,7 +180,7 @@ void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1, fl
             for (int x = x_start; x < x_end; x++)
             {
                 // Draw our pixel with the color that comes from the texture
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
+                draw_triangle_pixel(renderer, x, y, color, point_a, point_b, point_c);
             }
         }
     }
@@ -213,16 +212,17 @@ void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1, fl
             for (int x = x_start; x < x_end; x++)
             {
                 // Draw our pixel with the color that comes from the texture
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
+                draw_triangle_pixel(renderer, x, y, color, point_a, point_b, point_c);
             }
         }
     }
 }
 
-void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0, float v0,
+void draw_textured_triangle(renderer_t *renderer,
+                            int x0, int y0, float z0, float w0, float u0, float v0,
                             int x1, int y1, float z1, float w1, float u1, float v1,
                             int x2, int y2, float z2, float w2, float u2, float v2,
-                            color_t *texture)
+                            texture_t *texture)
 {
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1)
@@ -257,6 +257,18 @@ void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0, float
     v1 = 1 - v1;
     v2 = 1 - v2;
 
+    // Pick the mip level from how many base level texels the triangle covers
+    // per screen pixel
+    const mip_level_t *level = &texture->levels[0];
+    if (renderer->mipmapping)
+    {
+        float pixel_area =
+            fabsf((float)(x1 - x0) * (y2 - y0) - (float)(x2 - x0) * (y1 - y0));
+        float texel_area = fabsf((u1 - u0) * (v2 - v0) - (u2 - u0) * (v1 - v0)) *
+                           level->width * level->height;
+        level = &texture->levels[texture_select_level(texture, texel_area, pixel_area)];
+    }
+
     // Create vector points and texture coords after we sort the vertices
     vec4_t point_a = {x0, y0, z0, w0};
     vec4_t point_b = {x1, y1, z1, w1};
@@ -289,8 +301,8 @@ void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0, float
             for (int x = x_start; x < x_end; x++)
             {
                 // Draw our pixel with the color that comes from the texture
-                draw_texel(x, y, texture, point_a, point_b, point_c, u0, v0, u1, v1,
-                           u2, v2);
+                draw_texel(renderer, x, y, texture, level, point_a, point_b, point_c,
+                           u0, v0, u1, v1, u2, v2);
             }
         }
     }
@@ -322,8 +334,8 @@ void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0, float
             for (int x = x_start; x < x_end; x++)
             {
                 // Draw our pixel with the color that comes from the texture
-                draw_texel(x, y, texture, point_a, point_b, point_c, u0, v0, u1, v1,
-                           u2, v2);
+                draw_texel(renderer, x, y, texture, level, point_a, point_b, point_c,
+                           u0, v0, u1, v1, u2, v2);
             }
         }
     }
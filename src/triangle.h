@@ -1,7 +1,7 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
-#include "display.h"
+#include "draw.h"
 #include "texture.h"
 #include <stdint.h>
 
@@ -21,11 +21,12 @@ typedef struct
     vec4_t points[3];
     color_t color;
     tex2_t texcoords[3];
+    texture_t *texture; // of the instance the triangle belongs to, or NULL
 } triangle_t;
 
-void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1, float z1, float w1, int x2, int y2, float z2, float w2, color_t color);
+void draw_filled_triangle(renderer_t *renderer, int x0, int y0, float z0, float w0, int x1, int y1, float z1, float w1, int x2, int y2, float z2, float w2, color_t color);
 
-void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0, float v0, int x1, int y1, float z1, float w1,
+void draw_textured_triangle(renderer_t *renderer, int x0, int y0, float z0, float w0, float u0, float v0, int x1, int y1, float z1, float w1,
                             float u1, float v1, int x2, int y2, float z2, float w2, float u2, float v2,
-                            color_t *texture);
+                            texture_t *texture);
 #endif
\ No newline at end of file
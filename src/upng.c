@@ -25,12 +25,21 @@ not be misrepresented as being the original software.
 */
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "file.h"
 #include "upng.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+/* SSE2 is always there on x86-64, SSSE3 is checked for at runtime */
+#define UPNG_SSE2
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
 #define MAKE_BYTE(b) ((b) & 0xFF)
 #define MAKE_DWORD(a, b, c, d)                                                      \
     ((MAKE_BYTE(a) << 24) | (MAKE_BYTE(b) << 16) | (MAKE_BYTE(c) << 8) |            \
@@ -53,14 +62,46 @@ not be misrepresented as being the original software.
           17: 3-10 zeros, 18: 11-138 zeros */
 #define MAX_SYMBOLS 288 /* largest number of symbols used by any tree type */
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
-#define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
+/* Huffman codes are decoded with lookup tables indexed by the next bits of the
+ * input. Codes no longer than the table's root bits resolve in one lookup, longer
+ * ones go through a second lookup in a subtable indexed by their remaining bits */
+#define LITLEN_ROOT_BITS 10
+#define DISTANCE_ROOT_BITS 8
+#define CODE_LENGTH_ROOT_BITS 7
+
+/* root table plus room for the subtables of the worst case complete code */
+#define LITLEN_TABLE_SIZE 2048
+#define DISTANCE_TABLE_SIZE 1024
+#define CODE_LENGTH_TABLE_SIZE (1 << CODE_LENGTH_ROOT_BITS)
+
+/* a table entry holds the symbol (or the offset of a subtable) in its upper 16
+ * bits and the number of bits to consume (or to index the subtable with) in its
+ * lower 8. An entry of 0 bits is not a valid code */
+#define HUFFMAN_ENTRY(value, bits) (((unsigned)(value) << 16) | (bits))
+#define HUFFMAN_LINK 0x100
+#define HUFFMAN_ENTRY_BITS(entry) ((entry) & 0xFF)
+#define HUFFMAN_ENTRY_VALUE(entry) ((entry) >> 16)
+
+typedef struct huffman_table {
+    unsigned *entries;
+    unsigned root_bits;
+} huffman_table;
+
+/* input of the inflater: a bit buffer in front of the compressed bytes, consumed
+ * from the least significant bit. The compressed stream of a PNG is split over
+ * its IDAT chunks, which are read in place from the source buffer one after the
+ * other */
+typedef struct inflate_bits {
+    const unsigned char *next; /* next byte to shift into the buffer */
+    const unsigned char *end;  /* end of the current chunk's data */
+    const unsigned char *chunk; /* current IDAT chunk, NULL after the last one */
+    const unsigned char *source_end;
+    uint64_t buffer;
+    unsigned count;        /* number of valid bits in buffer */
+    unsigned long overrun; /* zero bytes shifted in past the end of the input */
+} inflate_bits;
 
 #define SET_ERROR(upng, code)                                                       \
     do {                                                                            \
@@ -89,7 +130,8 @@ typedef enum upng_color {
 typedef struct upng_source {
     const unsigned char *buffer;
     unsigned long size;
-    char owning;
+    char owning; /* buffer is file's contents, to be closed with the source */
+    file_source_t file;
 } upng_source;
 
 struct upng_t {
@@ -108,13 +150,9 @@ struct upng_t {
 
     upng_state state;
     upng_source source;
-};
 
-typedef struct huffman_tree {
-    unsigned *tree2d;
-    unsigned maxbitlen; /*maximum number of bits a single code can get */
-    unsigned numcodes;  /*number of symbols in the alphabet = number of codes */
-} huffman_tree;
+    upng_simd simd;
+};
 
 static const unsigned LENGTH_BASE[29] =
     {/*the base lengths represented by codes 257-285 */
@@ -145,228 +183,279 @@ static const unsigned
                                  */
     = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-    289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0,   1,
-    2,   3,   298, 299, 4,   5,   6,   7,   301, 304, 302, 303, 8,   9,   10,  11,
-    305, 306, 12,  13,  14,  15,  308, 339, 309, 324, 310, 317, 311, 314, 312, 313,
-    16,  17,  18,  19,  315, 316, 20,  21,  22,  23,  318, 321, 319, 320, 24,  25,
-    26,  27,  322, 323, 28,  29,  30,  31,  325, 332, 326, 329, 327, 328, 32,  33,
-    34,  35,  330, 331, 36,  37,  38,  39,  333, 336, 334, 335, 40,  41,  42,  43,
-    337, 338, 44,  45,  46,  47,  340, 355, 341, 348, 342, 345, 343, 344, 48,  49,
-    50,  51,  346, 347, 52,  53,  54,  55,  349, 352, 350, 351, 56,  57,  58,  59,
-    353, 354, 60,  61,  62,  63,  356, 363, 357, 360, 358, 359, 64,  65,  66,  67,
-    361, 362, 68,  69,  70,  71,  364, 367, 365, 366, 72,  73,  74,  75,  368, 369,
-    76,  77,  78,  79,  371, 434, 372, 403, 373, 388, 374, 381, 375, 378, 376, 377,
-    80,  81,  82,  83,  379, 380, 84,  85,  86,  87,  382, 385, 383, 384, 88,  89,
-    90,  91,  386, 387, 92,  93,  94,  95,  389, 396, 390, 393, 391, 392, 96,  97,
-    98,  99,  394, 395, 100, 101, 102, 103, 397, 400, 398, 399, 104, 105, 106, 107,
-    401, 402, 108, 109, 110, 111, 404, 419, 405, 412, 406, 409, 407, 408, 112, 113,
-    114, 115, 410, 411, 116, 117, 118, 119, 413, 416, 414, 415, 120, 121, 122, 123,
-    417, 418, 124, 125, 126, 127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131,
-    425, 426, 132, 133, 134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433,
-    140, 141, 142, 143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441,
-    144, 145, 146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153,
-    154, 155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-    160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168, 169,
-    170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472, 176, 177,
-    178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184, 185, 186, 187,
-    481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493, 487, 490, 488, 489,
-    192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494, 497, 495, 496, 200, 201,
-    202, 203, 498, 499, 204, 205, 206, 207, 501, 508, 502, 505, 503, 504, 208, 209,
-    210, 211, 506, 507, 212, 213, 214, 215, 509, 512, 510, 511, 216, 217, 218, 219,
-    513, 514, 220, 221, 222, 223, 516, 531, 517, 524, 518, 521, 519, 520, 224, 225,
-    226, 227, 522, 523, 228, 229, 230, 231, 525, 528, 526, 527, 232, 233, 234, 235,
-    529, 530, 236, 237, 238, 239, 532, 539, 533, 536, 534, 535, 240, 241, 242, 243,
-    537, 538, 244, 245, 246, 247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545,
-    252, 253, 254, 255, 547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553,
-    260, 261, 262, 263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269,
-    270, 271, 562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279,
-    569, 572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0,   0};
-
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-    33, 48, 34, 41, 35, 38, 36, 37, 0,  1,  2,  3,  39, 40, 4,  5,
-    6,  7,  42, 45, 43, 44, 8,  9,  10, 11, 46, 47, 12, 13, 14, 15,
-    49, 56, 50, 53, 51, 52, 16, 17, 18, 19, 54, 55, 20, 21, 22, 23,
-    57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28, 29, 30, 31, 0,  0};
-
-static unsigned char read_bit(unsigned long *bitpointer,
-                              const unsigned char *bitstream) {
-    unsigned char result =
-        (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) &
-                        1);
-    (*bitpointer)++;
-    return result;
+static uint64_t load_le64(const unsigned char *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream,
-                          unsigned long nbits) {
-    unsigned result = 0, i;
-    for (i = 0; i < nbits; i++)
-        result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
-    return result;
+/* start reading at the data of the IDAT chunk at chunk. The chunks up to IEND
+ * must have been validated to lie within the source buffer */
+static void bits_init(inflate_bits *bits, const unsigned char *chunk,
+                      const unsigned char *source_end) {
+    bits->chunk = chunk;
+    bits->source_end = source_end;
+    bits->next = chunk + 8;
+    bits->end = bits->next + upng_chunk_length(chunk);
+    bits->buffer = 0;
+    bits->count = 0;
+    bits->overrun = 0;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree *tree, unsigned *buffer,
-                              unsigned numcodes, unsigned maxbitlen) {
-    tree->tree2d = buffer;
+/* move on to the data of the next IDAT chunk; returns 0 if there is none */
+static int bits_next_chunk(inflate_bits *bits) {
+    const unsigned char *chunk = bits->chunk;
+    if (chunk == NULL) {
+        return 0;
+    }
+
+    do {
+        chunk += upng_chunk_length(chunk) + 12;
+        if (chunk + 12 > bits->source_end || upng_chunk_type(chunk) == CHUNK_IEND) {
+            bits->chunk = NULL;
+            return 0;
+        }
+    } while (upng_chunk_type(chunk) != CHUNK_IDAT);
+
+    bits->chunk = chunk;
+    bits->next = chunk + 8;
+    bits->end = bits->next + upng_chunk_length(chunk);
+    return 1;
+}
+
+/* top the bit buffer up to at least 56 bits, a word at a time while at least a
+ * word of the current chunk is left, a byte at a time across chunk boundaries */
+static void bits_refill(inflate_bits *bits) {
+    if (bits->end - bits->next >= 8) {
+        /* bits above the new count are the start of the next byte, which the
+         * next refill shifts in again at the same position */
+        bits->buffer |= load_le64(bits->next) << bits->count;
+        bits->next += (63 - bits->count) >> 3;
+        bits->count |= 56;
+        return;
+    }
 
-    tree->numcodes = numcodes;
-    tree->maxbitlen = maxbitlen;
+    while (bits->count <= 56) {
+        if (bits->next < bits->end) {
+            bits->buffer |= (uint64_t)(*bits->next++) << bits->count;
+        } else if (bits_next_chunk(bits)) {
+            continue;
+        } else {
+            bits->overrun++;
+        }
+        bits->count += 8;
+    }
+}
+
+/* true once more bits were consumed than the input holds */
+static int bits_overrun(const inflate_bits *bits) {
+    return bits->overrun * 8 > bits->count;
+}
+
+static void bits_drop(inflate_bits *bits, unsigned nbits) {
+    bits->buffer >>= nbits;
+    bits->count -= nbits;
+}
+
+static unsigned bits_get(inflate_bits *bits, unsigned nbits) {
+    unsigned result;
+    if (bits->count < nbits) {
+        bits_refill(bits);
+    }
+    result = (unsigned)(bits->buffer & ((1u << nbits) - 1));
+    bits_drop(bits, nbits);
+    return result;
+}
+
+static unsigned reverse_bits(unsigned code, unsigned nbits) {
+    unsigned result = 0, i;
+    for (i = 0; i < nbits; i++) {
+        result = (result << 1) | ((code >> i) & 1);
+    }
+    return result;
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by
- * Deflate. maxbitlen is the maximum bits that a code in the tree can have. return
- * value is error.*/
-static void huffman_tree_create_lengths(upng_t *upng, huffman_tree *tree,
-                                        const unsigned *bitlen) {
-    unsigned tree1d[MAX_SYMBOLS];
-    unsigned blcount[MAX_BIT_LENGTH];
+/*given the code lengths (as stored in the PNG file), generate the lookup table of
+ * the canonical Huffman code defined by Deflate. size is the number of entries
+ * available for the root table and its subtables*/
+static void huffman_table_create_lengths(upng_t *upng, huffman_table *table,
+                                         unsigned *entries, unsigned size,
+                                         unsigned root_bits, const unsigned *bitlen,
+                                         unsigned numcodes) {
+    unsigned codes[MAX_SYMBOLS];
+    unsigned blcount[MAX_BIT_LENGTH + 1];
     unsigned nextcode[MAX_BIT_LENGTH + 1];
-    unsigned bits, n, i;
-    unsigned nodefilled = 0; /*up to which node it is filled */
-    unsigned treepos = 0;    /*position in the tree (1 of the numcodes columns) */
+    unsigned char subtable_bits[1 << LITLEN_ROOT_BITS];
+    unsigned root_size = 1u << root_bits;
+    unsigned root_mask = root_size - 1;
+    unsigned bits, n, used;
+    long left;
+
+    table->entries = entries;
+    table->root_bits = root_bits;
 
     /* initialize local vectors */
     memset(blcount, 0, sizeof(blcount));
     memset(nextcode, 0, sizeof(nextcode));
+    memset(subtable_bits, 0, root_size);
 
     /*step 1: count number of instances of each code length */
-    for (bits = 0; bits < tree->numcodes; bits++) {
-        blcount[bitlen[bits]]++;
+    for (n = 0; n < numcodes; n++) {
+        if (bitlen[n] > MAX_BIT_LENGTH) {
+            SET_ERROR(upng, UPNG_EMALFORMED);
+            return;
+        }
+        blcount[bitlen[n]]++;
+    }
+    blcount[0] = 0;
+
+    /* reject oversubscribed codes; incomplete ones just leave invalid entries */
+    left = 1;
+    for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+        left = (left << 1) - blcount[bits];
+        if (left < 0) {
+            SET_ERROR(upng, UPNG_EMALFORMED);
+            return;
+        }
     }
 
     /*step 2: generate the nextcode values */
-    for (bits = 1; bits <= tree->maxbitlen; bits++) {
+    for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
         nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
     }
 
-    /*step 3: generate all the codes */
-    for (n = 0; n < tree->numcodes; n++) {
+    /*step 3: generate all the codes, bit reversed since deflate packs them from
+     * the most significant bit while the bit buffer is read from the least */
+    for (n = 0; n < numcodes; n++) {
         if (bitlen[n] != 0) {
-            tree1d[n] = nextcode[bitlen[n]]++;
+            codes[n] = reverse_bits(nextcode[bitlen[n]]++, bitlen[n]);
+            if (bitlen[n] > root_bits) {
+                unsigned prefix = codes[n] & root_mask;
+                if (bitlen[n] - root_bits > subtable_bits[prefix]) {
+                    subtable_bits[prefix] = (unsigned char)(bitlen[n] - root_bits);
+                }
+            }
         }
     }
 
-    /*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
-       uninited, a value >= numcodes is an address to another bit, a value < numcodes
-       is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as
-       many columns as codes - 1 a good huffmann tree has N * 2 - 1 nodes, of which N
-       - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and
-       1 option point to). There is only memory for such good tree currently, if
-       there are more nodes (due to too long length codes), error 55 will happen */
-    for (n = 0; n < tree->numcodes * 2; n++) {
-        tree->tree2d[n] =
-            32767; /*32767 here means the tree2d isn't filled there yet */
+    /*step 4: lay out the subtables after the root table, each big enough for
+     * the longest code sharing its root prefix */
+    for (n = 0; n < root_size; n++) {
+        entries[n] = 0;
     }
-
-    for (n = 0; n < tree->numcodes; n++) { /*the codes */
-        for (i = 0; i < bitlen[n]; i++) {  /*the bits for this code */
-            unsigned char bit =
-                (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-            /* check if oversubscribed */
-            if (treepos > tree->numcodes - 2) {
+    used = root_size;
+    for (n = 0; n < root_size; n++) {
+        if (subtable_bits[n] != 0) {
+            unsigned subtable_size = 1u << subtable_bits[n];
+            if (used + subtable_size > size) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
                 return;
             }
-
-            if (tree->tree2d[2 * treepos + bit] == 32767) { /*not yet filled in */
-                if (i + 1 == bitlen[n]) {                   /*last bit */
-                    tree->tree2d[2 * treepos + bit] =
-                        n; /*put the current code in it */
-                    treepos = 0;
-                } else { /*put address of the next step in here, first that address
-                            has to be found of course (it's just nodefilled + 1)...
-                          */
-                    nodefilled++;
-                    tree->tree2d[2 * treepos + bit] =
-                        nodefilled + tree->numcodes; /*addresses encoded with
-                                                        numcodes added to it */
-                    treepos = nodefilled;
-                }
-            } else {
-                treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
-            }
+            entries[n] = HUFFMAN_ENTRY(used, subtable_bits[n] | HUFFMAN_LINK);
+            memset(&entries[used], 0, subtable_size * sizeof(unsigned));
+            used += subtable_size;
         }
     }
 
-    for (n = 0; n < tree->numcodes * 2; n++) {
-        if (tree->tree2d[n] == 32767) {
-            tree->tree2d[n] = 0; /*remove possible remaining 32767's */
+    /*step 5: fill every entry whose index starts with a code with that code's
+     * symbol */
+    for (n = 0; n < numcodes; n++) {
+        unsigned len = bitlen[n], i;
+        if (len == 0) {
+            continue;
+        }
+
+        if (len <= root_bits) {
+            for (i = codes[n]; i < root_size; i += 1u << len) {
+                entries[i] = HUFFMAN_ENTRY(n, len);
+            }
+        } else {
+            unsigned link = entries[codes[n] & root_mask];
+            unsigned sublen = len - root_bits;
+            unsigned subtable_size = 1u << HUFFMAN_ENTRY_BITS(link);
+            unsigned *subtable = &entries[HUFFMAN_ENTRY_VALUE(link)];
+            for (i = codes[n] >> root_bits; i < subtable_size; i += 1u << sublen) {
+                subtable[i] = HUFFMAN_ENTRY(n, sublen);
+            }
         }
     }
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in,
-                                      unsigned long *bp,
-                                      const huffman_tree *codetree,
-                                      unsigned long inlength) {
-    unsigned treepos = 0, ct;
-    unsigned char bit;
-    for (;;) {
-        /* error: end of input memory reached without endcode */
-        if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-            SET_ERROR(upng, UPNG_EMALFORMED);
-            return 0;
-        }
+static unsigned huffman_decode_symbol(upng_t *upng, inflate_bits *bits,
+                                      const huffman_table *table) {
+    unsigned entry;
 
-        bit = read_bit(bp, in);
+    if (bits->count < MAX_BIT_LENGTH) {
+        bits_refill(bits);
+    }
 
-        ct = codetree->tree2d[(treepos << 1) | bit];
-        if (ct < codetree->numcodes) {
-            return ct;
-        }
+    entry = table->entries[bits->buffer & ((1u << table->root_bits) - 1)];
+    if (entry & HUFFMAN_LINK) {
+        bits_drop(bits, table->root_bits);
+        entry = table->entries[HUFFMAN_ENTRY_VALUE(entry) +
+                               (bits->buffer &
+                                ((1u << HUFFMAN_ENTRY_BITS(entry)) - 1))];
+    }
 
-        treepos = ct - codetree->numcodes;
-        if (treepos >= codetree->numcodes) {
-            SET_ERROR(upng, UPNG_EMALFORMED);
-            return 0;
-        }
+    /* error: not a code of this table, or end of input reached without endcode */
+    if (HUFFMAN_ENTRY_BITS(entry) == 0) {
+        SET_ERROR(upng, UPNG_EMALFORMED);
+        return 0;
     }
+
+    bits_drop(bits, HUFFMAN_ENTRY_BITS(entry));
+    if (bits_overrun(bits)) {
+        SET_ERROR(upng, UPNG_EMALFORMED);
+        return 0;
+    }
+    return HUFFMAN_ENTRY_VALUE(entry);
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also
  * Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t *upng, huffman_tree *codetree,
-                                     huffman_tree *codetreeD,
-                                     huffman_tree *codelengthcodetree,
-                                     const unsigned char *in, unsigned long *bp,
-                                     unsigned long inlength) {
+static void get_tree_inflate_dynamic(upng_t *upng, huffman_table *codetree,
+                                     unsigned *codetree_buffer,
+                                     huffman_table *codetreeD,
+                                     unsigned *codetreeD_buffer,
+                                     inflate_bits *bits) {
     unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
+    unsigned codelengthcode_buffer[CODE_LENGTH_TABLE_SIZE];
+    huffman_table codelengthcodetree;
     unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
     unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
     unsigned n, hlit, hdist, hclen, i;
 
-    /*make sure that length values that aren't filled in will be 0, or a wrong tree
-     * will be generated */
-    /*C-code note: use no "return" between ctor and dtor of an uivector! */
-    if ((*bp) >> 3 >= inlength - 2) {
-        SET_ERROR(upng, UPNG_EMALFORMED);
-        return;
-    }
-
     /* clear bitlen arrays */
     memset(bitlen, 0, sizeof(bitlen));
     memset(bitlenD, 0, sizeof(bitlenD));
 
-    /*the bit pointer is or will go past the memory */
-    hlit = read_bits(bp, in, 5) +
-           257; /*number of literal/length codes + 257. Unlike the spec, the value
-                   257 is added to it here already */
-    hdist = read_bits(bp, in, 5) + 1; /*number of distance codes. Unlike the spec,
-                                         the value 1 is added to it here already */
-    hclen = read_bits(bp, in, 4) + 4; /*number of code length codes. Unlike the spec,
-                                         the value 4 is added to it here already */
+    hlit = bits_get(bits, 5) + 257; /*number of literal/length codes + 257. Unlike
+                                       the spec, the value 257 is added to it here
+                                       already */
+    hdist = bits_get(bits, 5) + 1;  /*number of distance codes. Unlike the spec,
+                                       the value 1 is added to it here already */
+    hclen = bits_get(bits, 4) + 4;  /*number of code length codes. Unlike the spec,
+                                       the value 4 is added to it here already */
+
+    if (hlit > NUM_DEFLATE_CODE_SYMBOLS || hdist > NUM_DISTANCE_SYMBOLS) {
+        SET_ERROR(upng, UPNG_EMALFORMED);
+        return;
+    }
 
     for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
         if (i < hclen) {
-            codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+            codelengthcode[CLCL[i]] = bits_get(bits, 3);
         } else {
             codelengthcode[CLCL[i]] = 0; /*if not, it must stay 0 */
         }
     }
 
-    huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
+    huffman_table_create_lengths(upng, &codelengthcodetree, codelengthcode_buffer,
+                                 CODE_LENGTH_TABLE_SIZE, CODE_LENGTH_ROOT_BITS,
+                                 codelengthcode, NUM_CODE_LENGTH_CODES);
 
     /* bail now if we encountered an error earlier */
     if (upng->error != UPNG_EOK) {
@@ -376,13 +465,11 @@ static void get_tree_inflate_dynamic(upng_t *upng, huffman_tree *codetree,
     /*now we can use this tree to read the lengths for the tree that this function
      * will return */
     i = 0;
-    while (
-        i <
-        hlit +
-            hdist) { /*i is the current symbol we're reading in the part that
-                        contains the code lengths of lit/len codes and dist codes */
-        unsigned code =
-            huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+    while (i < hlit + hdist) { /*i is the current symbol we're reading in the part
+                                  that contains the code lengths of lit/len codes
+                                  and dist codes */
+        unsigned code = huffman_decode_symbol(upng, bits, &codelengthcodetree);
+        unsigned replength, value;
         if (upng->error != UPNG_EOK) {
             break;
         }
@@ -394,153 +481,118 @@ static void get_tree_inflate_dynamic(upng_t *upng, huffman_tree *codetree,
                 bitlenD[i - hlit] = code;
             }
             i++;
-        } else if (code == 16) { /*repeat previous */
-            unsigned replength =
-                3;          /*read in the 2 bits that indicate repeat length (3-6) */
-            unsigned value; /*set value to the previous code */
-
-            if ((*bp) >> 3 >= inlength) {
-                SET_ERROR(upng, UPNG_EMALFORMED);
-                break;
-            }
-            /*error, bit pointer jumps past memory */
-            replength += read_bits(bp, in, 2);
-
-            if ((i - 1) < hlit) {
-                value = bitlen[i - 1];
-            } else {
-                value = bitlenD[i - hlit - 1];
-            }
-
-            /*repeat this value in the next lengths */
-            for (n = 0; n < replength; n++) {
-                /* i is larger than the amount of codes */
-                if (i >= hlit + hdist) {
-                    SET_ERROR(upng, UPNG_EMALFORMED);
-                    break;
-                }
+            continue;
+        }
 
-                if (i < hlit) {
-                    bitlen[i] = value;
-                } else {
-                    bitlenD[i - hlit] = value;
-                }
-                i++;
-            }
-        } else if (code == 17) {    /*repeat "0" 3-10 times */
-            unsigned replength = 3; /*read in the bits that indicate repeat length */
-            if ((*bp) >> 3 >= inlength) {
+        if (code == 16) { /*repeat previous 3-6 times */
+            /* error: there is no previous length */
+            if (i == 0) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
                 break;
             }
-
-            /*error, bit pointer jumps past memory */
-            replength += read_bits(bp, in, 3);
-
-            /*repeat this value in the next lengths */
-            for (n = 0; n < replength; n++) {
-                /* error: i is larger than the amount of codes */
-                if (i >= hlit + hdist) {
-                    SET_ERROR(upng, UPNG_EMALFORMED);
-                    break;
-                }
-
-                if (i < hlit) {
-                    bitlen[i] = 0;
-                } else {
-                    bitlenD[i - hlit] = 0;
-                }
-                i++;
-            }
+            replength = 3 + bits_get(bits, 2);
+            value = (i - 1) < hlit ? bitlen[i - 1] : bitlenD[i - hlit - 1];
+        } else if (code == 17) { /*repeat "0" 3-10 times */
+            replength = 3 + bits_get(bits, 3);
+            value = 0;
         } else if (code == 18) { /*repeat "0" 11-138 times */
-            unsigned replength =
-                11; /*read in the bits that indicate repeat length */
-            /* error, bit pointer jumps past memory */
-            if ((*bp) >> 3 >= inlength) {
+            replength = 11 + bits_get(bits, 7);
+            value = 0;
+        } else {
+            /* somehow an unexisting code appeared. This can never happen. */
+            SET_ERROR(upng, UPNG_EMALFORMED);
+            break;
+        }
+
+        /*repeat this value in the next lengths */
+        for (n = 0; n < replength; n++) {
+            /* i is larger than the amount of codes */
+            if (i >= hlit + hdist) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
                 break;
             }
 
-            replength += read_bits(bp, in, 7);
-
-            /*repeat this value in the next lengths */
-            for (n = 0; n < replength; n++) {
-                /* i is larger than the amount of codes */
-                if (i >= hlit + hdist) {
-                    SET_ERROR(upng, UPNG_EMALFORMED);
-                    break;
-                }
-                if (i < hlit)
-                    bitlen[i] = 0;
-                else
-                    bitlenD[i - hlit] = 0;
-                i++;
+            if (i < hlit) {
+                bitlen[i] = value;
+            } else {
+                bitlenD[i - hlit] = value;
             }
-        } else {
-            /* somehow an unexisting code appeared. This can never happen. */
-            SET_ERROR(upng, UPNG_EMALFORMED);
-            break;
+            i++;
         }
     }
 
+    /*the length of the end code 256 must be larger than 0 */
     if (upng->error == UPNG_EOK && bitlen[256] == 0) {
         SET_ERROR(upng, UPNG_EMALFORMED);
     }
 
-    /*the length of the end code 256 must be larger than 0 */
     /*now we've finally got hlit and hdist, so generate the code trees, and the
      * function is done */
     if (upng->error == UPNG_EOK) {
-        huffman_tree_create_lengths(upng, codetree, bitlen);
+        huffman_table_create_lengths(upng, codetree, codetree_buffer,
+                                     LITLEN_TABLE_SIZE, LITLEN_ROOT_BITS, bitlen,
+                                     NUM_DEFLATE_CODE_SYMBOLS);
     }
     if (upng->error == UPNG_EOK) {
-        huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+        huffman_table_create_lengths(upng, codetreeD, codetreeD_buffer,
+                                     DISTANCE_TABLE_SIZE, DISTANCE_ROOT_BITS,
+                                     bitlenD, NUM_DISTANCE_SYMBOLS);
+    }
+}
+
+/* the code lengths of the fixed Huffman trees of btype 1 */
+static void get_tree_inflate_fixed(upng_t *upng, huffman_table *codetree,
+                                   unsigned *codetree_buffer,
+                                   huffman_table *codetreeD,
+                                   unsigned *codetreeD_buffer) {
+    unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+    unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+    unsigned i;
+
+    for (i = 0; i < NUM_DEFLATE_CODE_SYMBOLS; i++) {
+        if (i <= 143)
+            bitlen[i] = 8;
+        else if (i <= 255)
+            bitlen[i] = 9;
+        else if (i <= 279)
+            bitlen[i] = 7;
+        else
+            bitlen[i] = 8;
     }
+    for (i = 0; i < NUM_DISTANCE_SYMBOLS; i++) {
+        bitlenD[i] = 5;
+    }
+
+    huffman_table_create_lengths(upng, codetree, codetree_buffer, LITLEN_TABLE_SIZE,
+                                 LITLEN_ROOT_BITS, bitlen, NUM_DEFLATE_CODE_SYMBOLS);
+    huffman_table_create_lengths(upng, codetreeD, codetreeD_buffer,
+                                 DISTANCE_TABLE_SIZE, DISTANCE_ROOT_BITS, bitlenD,
+                                 NUM_DISTANCE_SYMBOLS);
 }
 
 /*inflate a block with dynamic of fixed Huffman tree*/
 static void inflate_huffman(upng_t *upng, unsigned char *out, unsigned long outsize,
-                            const unsigned char *in, unsigned long *bp,
-                            unsigned long *pos, unsigned long inlength,
-                            unsigned btype) {
-    unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-    unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-    unsigned done = 0;
-
-    huffman_tree codetree;
-    huffman_tree codetreeD;
+                            inflate_bits *bits, unsigned long *pos, unsigned btype) {
+    unsigned codetree_buffer[LITLEN_TABLE_SIZE];
+    unsigned codetreeD_buffer[DISTANCE_TABLE_SIZE];
+    huffman_table codetree;
+    huffman_table codetreeD;
 
     if (btype == 1) {
-        /* fixed trees */
-        huffman_tree_init(&codetree, (unsigned *)FIXED_DEFLATE_CODE_TREE,
-                          NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-        huffman_tree_init(&codetreeD, (unsigned *)FIXED_DISTANCE_TREE,
-                          NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-    } else if (btype == 2) {
-        /* dynamic trees */
-        unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-        huffman_tree codelengthcodetree;
-
-        huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS,
-                          DEFLATE_CODE_BITLEN);
-        huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS,
-                          DISTANCE_BITLEN);
-        huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer,
-                          NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-        get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree,
-                                 in, bp, inlength);
+        get_tree_inflate_fixed(upng, &codetree, codetree_buffer, &codetreeD,
+                               codetreeD_buffer);
+    } else {
+        get_tree_inflate_dynamic(upng, &codetree, codetree_buffer, &codetreeD,
+                                 codetreeD_buffer, bits);
     }
 
-    while (done == 0) {
-        unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+    while (upng->error == UPNG_EOK) {
+        unsigned code = huffman_decode_symbol(upng, bits, &codetree);
         if (upng->error != UPNG_EOK) {
             return;
         }
 
-        if (code == 256) {
-            /* end code */
-            done = 1;
-        } else if (code <= 255) {
+        if (code <= 255) {
             /* literal symbol */
             if ((*pos) >= outsize) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
@@ -549,25 +601,21 @@ static void inflate_huffman(upng_t *upng, unsigned char *out, unsigned long outs
 
             /* store output */
             out[(*pos)++] = (unsigned char)(code);
-        } else if (code >= FIRST_LENGTH_CODE_INDEX &&
-                   code <= LAST_LENGTH_CODE_INDEX) { /*length code */
-            /* part 1: get length base */
-            unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-            unsigned codeD, distance, numextrabitsD;
-            unsigned long start, forward, backward, numextrabits;
-
-            /* part 2: get extra bits and add the value of that to length */
-            numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
-
-            /* error, bit pointer will jump past memory */
-            if (((*bp) >> 3) >= inlength) {
-                SET_ERROR(upng, UPNG_EMALFORMED);
-                return;
-            }
-            length += read_bits(bp, in, numextrabits);
+        } else if (code == 256) {
+            /* end code */
+            return;
+        } else if (code <= LAST_LENGTH_CODE_INDEX) { /*length code */
+            unsigned long length, distance;
+            unsigned codeD;
+            unsigned char *dest;
+            const unsigned char *src;
+
+            /* part 1 and 2: get length base and add the value of its extra bits */
+            length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX] +
+                     bits_get(bits, LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX]);
 
             /*part 3: get distance code */
-            codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+            codeD = huffman_decode_symbol(upng, bits, &codetreeD);
             if (upng->error != UPNG_EOK) {
                 return;
             }
@@ -578,120 +626,125 @@ static void inflate_huffman(upng_t *upng, unsigned char *out, unsigned long outs
                 return;
             }
 
-            distance = DISTANCE_BASE[codeD];
-
             /*part 4: get extra bits from distance */
-            numextrabitsD = DISTANCE_EXTRA[codeD];
+            distance = DISTANCE_BASE[codeD] + bits_get(bits, DISTANCE_EXTRA[codeD]);
 
-            /* error, bit pointer will jump past memory */
-            if (((*bp) >> 3) >= inlength) {
+            /* error: reading past the end of the input, before the start of the
+             * output, or writing past its end */
+            if (bits_overrun(bits) || distance > (*pos) ||
+                (*pos) + length > outsize) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
                 return;
             }
 
-            distance += read_bits(bp, in, numextrabitsD);
-
-            /*part 5: fill in all the out[n] values based on the length and dist */
-            start = (*pos);
-            backward = start - distance;
-
-            if ((*pos) + length >= outsize) {
-                SET_ERROR(upng, UPNG_EMALFORMED);
-                return;
-            }
-
-            for (forward = 0; forward < length; forward++) {
-                out[(*pos)++] = out[backward];
-                backward++;
-
-                if (backward >= start) {
-                    backward = start - distance;
+            /*part 5: fill in all the out[n] values based on the length and dist.
+             * overlapping copies repeat the last distance bytes, so they have to
+             * go a byte at a time */
+            dest = &out[*pos];
+            src = dest - distance;
+            if (distance >= length) {
+                memcpy(dest, src, length);
+            } else {
+                unsigned long n;
+                for (n = 0; n < length; n++) {
+                    dest[n] = src[n];
                 }
             }
+            (*pos) += length;
+        } else {
+            /* invalid length code (286-287 are never used) */
+            SET_ERROR(upng, UPNG_EMALFORMED);
+            return;
         }
     }
 }
 
 static void inflate_uncompressed(upng_t *upng, unsigned char *out,
-                                 unsigned long outsize, const unsigned char *in,
-                                 unsigned long *bp, unsigned long *pos,
-                                 unsigned long inlength) {
-    unsigned long p;
-    unsigned len, nlen, n;
+                                 unsigned long outsize, inflate_bits *bits,
+                                 unsigned long *pos) {
+    unsigned len, nlen;
 
     /* go to first boundary of byte */
-    while (((*bp) & 0x7) != 0) {
-        (*bp)++;
-    }
-    p = (*bp) / 8; /*byte position */
+    bits_drop(bits, bits->count & 0x7);
 
     /* read len (2 bytes) and nlen (2 bytes) */
-    if (p >= inlength - 4) {
-        SET_ERROR(upng, UPNG_EMALFORMED);
-        return;
-    }
-
-    len = in[p] + 256 * in[p + 1];
-    p += 2;
-    nlen = in[p] + 256 * in[p + 1];
-    p += 2;
+    len = bits_get(bits, 16);
+    nlen = bits_get(bits, 16);
 
     /* check if 16-bit nlen is really the one's complement of len */
-    if (len + nlen != 65535) {
+    if (bits_overrun(bits) || len + nlen != 65535) {
         SET_ERROR(upng, UPNG_EMALFORMED);
         return;
     }
 
-    if ((*pos) + len >= outsize) {
+    if ((*pos) + len > outsize) {
         SET_ERROR(upng, UPNG_EMALFORMED);
         return;
     }
 
+    /* the first bytes of the literal data may already be in the bit buffer */
+    while (len > 0 && bits->count >= 8) {
+        out[(*pos)++] = (unsigned char)bits_get(bits, 8);
+        len--;
+    }
+    if (bits->count == 0) {
+        /* drop the partial byte a word refill may have left above the count */
+        bits->buffer = 0;
+    }
+
     /* read the literal data: len bytes are now stored in the out buffer */
-    if (p + len > inlength) {
+    if (bits_overrun(bits)) {
         SET_ERROR(upng, UPNG_EMALFORMED);
         return;
     }
 
-    for (n = 0; n < len; n++) {
-        out[(*pos)++] = in[p++];
-    }
+    while (len > 0) {
+        unsigned long available = (unsigned long)(bits->end - bits->next);
+        unsigned long n = available < len ? available : len;
+
+        /* the data may continue in the next IDAT chunk */
+        if (available == 0) {
+            if (!bits_next_chunk(bits)) {
+                SET_ERROR(upng, UPNG_EMALFORMED);
+                return;
+            }
+            continue;
+        }
 
-    (*bp) = p * 8;
+        memcpy(&out[*pos], bits->next, n);
+        bits->next += n;
+        (*pos) += n;
+        len -= n;
+    }
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
 static upng_error uz_inflate_data(upng_t *upng, unsigned char *out,
-                                  unsigned long outsize, const unsigned char *in,
-                                  unsigned long insize, unsigned long inpos) {
-    unsigned long bp = 0;  /*bit pointer in the "in" data, current byte is bp >> 3,
-                              current bit is bp & 0x7 (from lsb to msb of the byte) */
+                                  unsigned long outsize, inflate_bits *bits) {
     unsigned long pos = 0; /*byte position in the out buffer */
-
     unsigned done = 0;
 
     while (done == 0) {
         unsigned btype;
 
-        /* ensure next bit doesn't point past the end of the buffer */
-        if ((bp >> 3) >= insize) {
+        /* read block control bits */
+        done = bits_get(bits, 1);
+        btype = bits_get(bits, 2);
+
+        /* ensure the block header didn't read past the end of the buffer */
+        if (bits_overrun(bits)) {
             SET_ERROR(upng, UPNG_EMALFORMED);
             return upng->error;
         }
 
-        /* read block control bits */
-        done = read_bit(&bp, &in[inpos]);
-        btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
-
         /* process control type appropriateyly */
         if (btype == 3) {
             SET_ERROR(upng, UPNG_EMALFORMED);
             return upng->error;
         } else if (btype == 0) {
-            inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos,
-                                 insize); /*no compression */
+            inflate_uncompressed(upng, out, outsize, bits, &pos); /*no compression */
         } else {
-            inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize,
+            inflate_huffman(upng, out, outsize, bits, &pos,
                             btype); /*compression, btype 01 or 10 */
         }
 
@@ -704,10 +757,18 @@ static upng_error uz_inflate_data(upng_t *upng, unsigned char *out,
     return upng->error;
 }
 
+/*inflate the zlib stream in the IDAT chunks starting at chunk*/
 static upng_error uz_inflate(upng_t *upng, unsigned char *out, unsigned long outsize,
-                             const unsigned char *in, unsigned long insize) {
+                             const unsigned char *chunk) {
+    inflate_bits bits;
+    unsigned char in[2];
+
+    bits_init(&bits, chunk, upng->source.buffer + upng->source.size);
+
     /* we require two bytes for the zlib data header */
-    if (insize < 2) {
+    in[0] = (unsigned char)bits_get(&bits, 8);
+    in[1] = (unsigned char)bits_get(&bits, 8);
+    if (bits_overrun(&bits)) {
         SET_ERROR(upng, UPNG_EMALFORMED);
         return upng->error;
     }
@@ -734,7 +795,7 @@ static upng_error uz_inflate(upng_t *upng, unsigned char *out, unsigned long out
     }
 
     /* create output buffer */
-    uz_inflate_data(upng, out, outsize, in, insize, 2);
+    uz_inflate_data(upng, out, outsize, &bits);
 
     return upng->error;
 }
@@ -754,6 +815,204 @@ static int paeth_predictor(int a, int b, int c) {
         return c;
 }
 
+#ifdef UPNG_SSE2
+/* SSE2/SSSE3 versions of the filters for 3 and 4 byte pixels. Sub, Average and
+ * Paeth depend on the pixel to the left, so apart from 4 byte Sub they still go
+ * a pixel at a time, but all the bytes of a pixel at once. Pixels are loaded and
+ * stored through memcpy so 3 byte pixels never touch the bytes after them */
+static __m128i load_pixel(const unsigned char *p, unsigned long bytewidth) {
+    int value;
+    if (bytewidth == 4) {
+        memcpy(&value, p, 4);
+    } else {
+        /* assembled in registers, a 3 byte copy through memory stalls the load */
+        value = p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+    return _mm_cvtsi32_si128(value);
+}
+
+static void store_pixel(unsigned char *p, __m128i pixel, unsigned long bytewidth) {
+    int value = _mm_cvtsi128_si32(pixel);
+    if (bytewidth == 4) {
+        memcpy(p, &value, 4);
+    } else {
+        p[0] = (unsigned char)value;
+        p[1] = (unsigned char)(value >> 8);
+        p[2] = (unsigned char)(value >> 16);
+    }
+}
+
+static void unfilter_sub_sse2(unsigned char *recon, const unsigned char *scanline,
+                              unsigned long bytewidth, unsigned long length) {
+    __m128i a = _mm_setzero_si128();
+    unsigned long i = 0;
+
+    if (bytewidth == 4) {
+        /* add each pixel to the ones after it within 16 bytes in two steps, then
+         * the last pixel of the previous 16 bytes to all of them */
+        for (; i + 16 <= length; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *)&scanline[i]);
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi8(x, a);
+            _mm_storeu_si128((__m128i *)&recon[i], x);
+            a = _mm_shuffle_epi32(x, 0xFF);
+        }
+    }
+
+    for (; i < length; i += bytewidth) {
+        a = _mm_add_epi8(a, load_pixel(&scanline[i], bytewidth));
+        store_pixel(&recon[i], a, bytewidth);
+    }
+}
+
+static void unfilter_up_sse2(unsigned char *recon, const unsigned char *scanline,
+                             const unsigned char *precon, unsigned long length) {
+    unsigned long i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)&scanline[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&precon[i]);
+        _mm_storeu_si128((__m128i *)&recon[i], _mm_add_epi8(x, b));
+    }
+    for (; i < length; i++) {
+        recon[i] = scanline[i] + precon[i];
+    }
+}
+
+static void unfilter_average_sse2(unsigned char *recon, const unsigned char *scanline,
+                                  const unsigned char *precon, unsigned long bytewidth,
+                                  unsigned long length) {
+    const __m128i ones = _mm_set1_epi8(1);
+    __m128i a = _mm_setzero_si128();
+    unsigned long i;
+
+    for (i = 0; i < length; i += bytewidth) {
+        __m128i b = load_pixel(&precon[i], bytewidth);
+        /* _mm_avg_epu8 rounds up, the filter rounds down */
+        __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b),
+                                       _mm_and_si128(_mm_xor_si128(a, b), ones));
+        a = _mm_add_epi8(load_pixel(&scanline[i], bytewidth), average);
+        store_pixel(&recon[i], a, bytewidth);
+    }
+}
+
+/* the predictor of paeth_predictor from the 16-bit left (a), above (b) and upper
+ * left (c) pixels and their distances to the estimate a + b - c. Ties favor a
+ * over b over c */
+static __m128i paeth_nearest(__m128i a, __m128i b, __m128i c, __m128i pa, __m128i pb,
+                             __m128i pc) {
+    __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    __m128i use_a = _mm_cmpeq_epi16(smallest, pa);
+    __m128i use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(smallest, pb));
+    __m128i use_c = _mm_andnot_si128(_mm_or_si128(use_a, use_b),
+                                     _mm_set1_epi16(-1));
+    return _mm_or_si128(_mm_or_si128(_mm_and_si128(use_a, a), _mm_and_si128(use_b, b)),
+                        _mm_and_si128(use_c, c));
+}
+
+static __m128i abs_epi16_sse2(__m128i x) {
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static void unfilter_paeth_sse2(unsigned char *recon, const unsigned char *scanline,
+                                const unsigned char *precon, unsigned long bytewidth,
+                                unsigned long length) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, c = zero;
+    unsigned long i;
+
+    for (i = 0; i < length; i += bytewidth) {
+        __m128i b = _mm_unpacklo_epi8(load_pixel(&precon[i], bytewidth), zero);
+        __m128i x = _mm_unpacklo_epi8(load_pixel(&scanline[i], bytewidth), zero);
+        /* |p - a| = |b - c|, |p - b| = |a - c| and |p - c| = |a + b - 2c| */
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = _mm_add_epi16(pa, pb);
+        __m128i nearest = paeth_nearest(a, b, c, abs_epi16_sse2(pa),
+                                        abs_epi16_sse2(pb), abs_epi16_sse2(pc));
+
+        /* bytes wrap around within their 16-bit lanes */
+        a = _mm_add_epi8(nearest, x);
+        store_pixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+        c = b;
+    }
+}
+
+__attribute__((target("ssse3"))) static void
+unfilter_paeth_ssse3(unsigned char *recon, const unsigned char *scanline,
+                     const unsigned char *precon, unsigned long bytewidth,
+                     unsigned long length) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, c = zero;
+    unsigned long i;
+
+    for (i = 0; i < length; i += bytewidth) {
+        __m128i b = _mm_unpacklo_epi8(load_pixel(&precon[i], bytewidth), zero);
+        __m128i x = _mm_unpacklo_epi8(load_pixel(&scanline[i], bytewidth), zero);
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = _mm_add_epi16(pa, pb);
+        __m128i nearest = paeth_nearest(a, b, c, _mm_abs_epi16(pa), _mm_abs_epi16(pb),
+                                        _mm_abs_epi16(pc));
+
+        a = _mm_add_epi8(nearest, x);
+        store_pixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+        c = b;
+    }
+}
+
+/* unfilter a scanline with the vector filters, if there is one for the filter
+ * and pixel size. Returns 0 when the scalar filter has to be used */
+static int unfilter_scanline_simd(unsigned char *recon, const unsigned char *scanline,
+                                  const unsigned char *precon, unsigned long bytewidth,
+                                  unsigned char filterType, unsigned long length,
+                                  upng_simd simd) {
+    int pixels = bytewidth == 3 || bytewidth == 4;
+
+    if (simd == UPNG_SIMD_NONE) {
+        return 0;
+    }
+    /* the first scanline has no previous one, Up, Average and Paeth reduce to
+     * simpler filters there which the scalar code handles */
+    if (filterType == 1 && pixels) {
+        unfilter_sub_sse2(recon, scanline, bytewidth, length);
+        return 1;
+    }
+    if (precon == 0) {
+        return 0;
+    }
+    if (filterType == 2) {
+        unfilter_up_sse2(recon, scanline, precon, length);
+        return 1;
+    }
+    if (filterType == 3 && pixels) {
+        unfilter_average_sse2(recon, scanline, precon, bytewidth, length);
+        return 1;
+    }
+    if (filterType == 4 && pixels) {
+        if (simd == UPNG_SIMD_SSSE3) {
+            unfilter_paeth_ssse3(recon, scanline, precon, bytewidth, length);
+        } else {
+            unfilter_paeth_sse2(recon, scanline, precon, bytewidth, length);
+        }
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+/* the best vector instructions available on this CPU */
+static upng_simd detect_simd(void) {
+#ifdef UPNG_SSE2
+    if (__builtin_cpu_supports("ssse3")) {
+        return UPNG_SIMD_SSSE3;
+    }
+    return UPNG_SIMD_SSE2;
+#else
+    return UPNG_SIMD_NONE;
+#endif
+}
+
 static void unfilter_scanline(upng_t *upng, unsigned char *recon,
                               const unsigned char *scanline,
                               const unsigned char *precon, unsigned long bytewidth,
@@ -769,6 +1028,13 @@ static void unfilter_scanline(upng_t *upng, unsigned char *recon,
      */
 
     unsigned long i;
+#ifdef UPNG_SSE2
+    if (unfilter_scanline_simd(recon, scanline, precon, bytewidth, filterType, length,
+                               upng->simd)) {
+        return;
+    }
+#endif
+
     switch (filterType) {
     case 0:
         for (i = 0; i < length; i++)
@@ -973,7 +1239,7 @@ static upng_format determine_format(upng_t *upng) {
 
 static void upng_free_source(upng_t *upng) {
     if (upng->source.owning != 0) {
-        free((void *)upng->source.buffer);
+        file_source_close(&upng->source.file);
     }
 
     upng->source.buffer = NULL;
@@ -1060,9 +1326,8 @@ upng_error upng_header(upng_t *upng) {
  * "generic")*/
 upng_error upng_decode(upng_t *upng) {
     const unsigned char *chunk;
-    unsigned char *compressed;
+    const unsigned char *first_idat = NULL;
     unsigned char *inflated;
-    unsigned long compressed_size = 0, compressed_index = 0;
     unsigned long inflated_size;
     upng_error error;
 
@@ -1124,7 +1389,9 @@ upng_error upng_decode(upng_t *upng) {
 
         /* parse chunks */
         if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-            compressed_size += length;
+            if (first_idat == NULL) {
+                first_idat = chunk;
+            }
         } else if (upng_chunk_type(chunk) == CHUNK_IEND) {
             break;
         } else if (upng_chunk_critical(chunk)) {
@@ -1135,56 +1402,28 @@ upng_error upng_decode(upng_t *upng) {
         chunk += upng_chunk_length(chunk) + 12;
     }
 
-    /* allocate enough space for the (compressed and filtered) image data */
-    compressed = (unsigned char *)malloc(compressed_size);
-    if (compressed == NULL) {
-        SET_ERROR(upng, UPNG_ENOMEM);
+    /* the compressed data is inflated straight out of the IDAT chunks */
+    if (first_idat == NULL) {
+        SET_ERROR(upng, UPNG_EMALFORMED);
         return upng->error;
     }
 
-    /* scan through the chunks again, this time copying the values into
-     * our compressed buffer.  there's no reason to validate anything a second time.
-     */
-    chunk = upng->source.buffer + 33;
-    while (chunk < upng->source.buffer + upng->source.size) {
-        unsigned long length;
-        const unsigned char *data; /*the data in the chunk */
-
-        length = upng_chunk_length(chunk);
-        data = chunk + 8;
-
-        /* parse chunks */
-        if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-            memcpy(compressed + compressed_index, data, length);
-            compressed_index += length;
-        } else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-            break;
-        }
-
-        chunk += upng_chunk_length(chunk) + 12;
-    }
-
     /* allocate space to store inflated (but still filtered) data */
     inflated_size =
         ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
     inflated = (unsigned char *)malloc(inflated_size);
     if (inflated == NULL) {
-        free(compressed);
         SET_ERROR(upng, UPNG_ENOMEM);
         return upng->error;
     }
 
     /* decompress image data */
-    error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
+    error = uz_inflate(upng, inflated, inflated_size, first_idat);
     if (error != UPNG_EOK) {
-        free(compressed);
         free(inflated);
         return upng->error;
     }
 
-    /* free the compressed compressed data */
-    free(compressed);
-
     /* allocate final image buffer */
     upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
     upng->buffer = (unsigned char *)malloc(upng->size);
@@ -1239,6 +1478,8 @@ static upng_t *upng_new(void) {
     upng->source.size = 0;
     upng->source.owning = 0;
 
+    upng->simd = detect_simd();
+
     return upng;
 }
 
@@ -1252,44 +1493,28 @@ upng_t *upng_new_from_bytes(const unsigned char *buffer, unsigned long size) {
     upng->source.size = size;
     upng->source.owning = 0;
 
+    upng->simd = detect_simd();
+
     return upng;
 }
 
 upng_t *upng_new_from_file(const char *filename) {
     upng_t *upng;
-    unsigned char *buffer;
-    FILE *file;
-    long size;
 
     upng = upng_new();
     if (upng == NULL) {
         return NULL;
     }
 
-    file = fopen(filename, "rb");
-    if (file == NULL) {
+    /* map the file, or read it into memory where it can't be mapped */
+    if (!file_source_open(&upng->source.file, filename)) {
         SET_ERROR(upng, UPNG_ENOTFOUND);
         return upng;
     }
 
-    /* get filesize */
-    fseek(file, 0, SEEK_END);
-    size = ftell(file);
-    rewind(file);
-
-    /* read contents of the file into the vector */
-    buffer = (unsigned char *)malloc((unsigned long)size);
-    if (buffer == NULL) {
-        fclose(file);
-        SET_ERROR(upng, UPNG_ENOMEM);
-        return upng;
-    }
-    fread(buffer, 1, (unsigned long)size, file);
-    fclose(file);
-
-    /* set the read buffer as our source buffer, with owning flag set */
-    upng->source.buffer = buffer;
-    upng->source.size = size;
+    /* decode straight out of the file's contents, with owning flag set */
+    upng->source.buffer = upng->source.file.data;
+    upng->source.size = upng->source.file.size;
     upng->source.owning = 1;
 
     return upng;
@@ -1345,6 +1570,14 @@ unsigned upng_get_pixelsize(const upng_t *upng) {
 
 upng_format upng_get_format(const upng_t *upng) { return upng->format; }
 
+void upng_set_simd(upng_t *upng, upng_simd simd) {
+    /* never more than the CPU supports */
+    upng_simd supported = detect_simd();
+    upng->simd = simd < supported ? simd : supported;
+}
+
+upng_simd upng_get_simd(const upng_t *upng) { return upng->simd; }
+
 const unsigned char *upng_get_buffer(const upng_t *upng) { return upng->buffer; }
 
 unsigned upng_get_size(const upng_t *upng) { return upng->size; }
\ No newline at end of file
@@ -55,6 +55,14 @@ typedef enum upng_format {
     UPNG_LUMINANCE_ALPHA8
 } upng_format;
 
+/* vector instructions used to unfilter scanlines; picked at runtime from what
+ * the CPU supports */
+typedef enum upng_simd {
+    UPNG_SIMD_NONE,
+    UPNG_SIMD_SSE2,
+    UPNG_SIMD_SSSE3
+} upng_simd;
+
 typedef struct upng_t upng_t;
 
 upng_t *upng_new_from_bytes(const unsigned char *buffer, unsigned long size);
@@ -64,6 +72,10 @@ void upng_free(upng_t *upng);
 upng_error upng_header(upng_t *upng);
 upng_error upng_decode(upng_t *upng);
 
+/* limit the vector instructions used, e.g. to compare against the scalar code */
+void upng_set_simd(upng_t *upng, upng_simd simd);
+upng_simd upng_get_simd(const upng_t *upng);
+
 upng_error upng_get_error(const upng_t *upng);
 unsigned upng_get_error_line(const upng_t *upng);
 
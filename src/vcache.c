@@ -0,0 +1,320 @@
+#include "vcache.h"
+#include "array.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Scoring from Forsyth's "Linear-Speed Vertex Cache Optimisation": recently
+// used vertices score higher, the three of the last triangle a fixed amount,
+// and vertices with few triangles left get a boost so they are finished off
+// rather than left behind as isolated triangles
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+// Scores of vertices by cache position and by triangles left, precomputed
+#define MAX_VALENCE_SCORED 32
+
+typedef struct {
+    float position_scores[VCACHE_SIZE];
+    float valence_scores[MAX_VALENCE_SCORED];
+} vcache_scores_t;
+
+static void init_scores(vcache_scores_t *scores) {
+    for (int i = 0; i < VCACHE_SIZE; i++) {
+        if (i < 3) {
+            scores->position_scores[i] = LAST_TRIANGLE_SCORE;
+        } else {
+            float scale = 1.0f / (VCACHE_SIZE - 3);
+            scores->position_scores[i] = powf(1.0f - (i - 3) * scale, CACHE_DECAY_POWER);
+        }
+    }
+    for (int i = 0; i < MAX_VALENCE_SCORED; i++) {
+        scores->valence_scores[i] =
+            i == 0 ? 0 : VALENCE_BOOST_SCALE * powf((float)i, -VALENCE_BOOST_POWER);
+    }
+}
+
+static float vertex_score(const vcache_scores_t *scores, int cache_position,
+                          int triangles_left) {
+    if (triangles_left == 0) {
+        return -1.0f; // not needed by anything any more
+    }
+    float score = cache_position >= 0 && cache_position < VCACHE_SIZE
+                      ? scores->position_scores[cache_position]
+                      : 0;
+    return score + (triangles_left < MAX_VALENCE_SCORED
+                        ? scores->valence_scores[triangles_left]
+                        : VALENCE_BOOST_SCALE * powf((float)triangles_left,
+                                                     -VALENCE_BOOST_POWER));
+}
+
+float vcache_acmr(const mesh_t *mesh, int cache_size) {
+    int num_triangles = array_length(mesh->lods) > 0 ? (int)mesh->lods[0].num_triangles
+                                                     : array_length(mesh->index_buffer) / 3;
+    if (num_triangles == 0 || cache_size <= 0) {
+        return 0;
+    }
+
+    uint32_t cache[cache_size];
+    int cached = 0;
+    long misses = 0;
+    for (int i = 0; i < num_triangles * 3; i++) {
+        uint32_t vertex = mesh_index(mesh, i);
+        int position = 0;
+        while (position < cached && cache[position] != vertex) {
+            position++;
+        }
+        if (position == cached) {
+            misses++;
+            if (cached < cache_size) {
+                cached++;
+            }
+            position = cached - 1;
+        }
+        // move the vertex to the front, pushing the ones before it back
+        memmove(&cache[1], &cache[0], position * sizeof(cache[0]));
+        cache[0] = vertex;
+    }
+    return (float)misses / num_triangles;
+}
+
+// Forsyth's pass over num_triangles triangles of vertices numbered below
+// num_vertices, writing their corners to order in the new order
+static bool optimize_triangles(const uint32_t *indices, int num_triangles, int num_vertices,
+                               uint32_t *order) {
+    // triangles of each vertex, as ranges of one array; a degenerate
+    // triangle is listed once per corner using the vertex
+    int *triangles_left = calloc(num_vertices, sizeof(int));
+    int *first_triangle = malloc((num_vertices + 1) * sizeof(int));
+    int *vertex_triangles = malloc((size_t)num_triangles * 3 * sizeof(int));
+    int *cache_positions = malloc(num_vertices * sizeof(int));
+    float *vertex_scores = malloc(num_vertices * sizeof(float));
+    float *triangle_scores = malloc(num_triangles * sizeof(float));
+    bool *emitted = calloc(num_triangles, sizeof(bool));
+    bool ok = triangles_left && first_triangle && vertex_triangles && cache_positions &&
+              vertex_scores && triangle_scores && emitted;
+
+    if (ok) {
+        vcache_scores_t scores;
+        init_scores(&scores);
+
+        for (int i = 0; i < num_triangles * 3; i++) {
+            triangles_left[indices[i]]++;
+        }
+        first_triangle[0] = 0;
+        for (int v = 0; v < num_vertices; v++) {
+            first_triangle[v + 1] = first_triangle[v] + triangles_left[v];
+            cache_positions[v] = -1;
+            triangles_left[v] = 0;
+        }
+        for (int i = 0; i < num_triangles * 3; i++) {
+            uint32_t v = indices[i];
+            vertex_triangles[first_triangle[v] + triangles_left[v]++] = i / 3;
+        }
+        for (int v = 0; v < num_vertices; v++) {
+            vertex_scores[v] = vertex_score(&scores, -1, triangles_left[v]);
+        }
+
+        int best_triangle = 0;
+        for (int t = 0; t < num_triangles; t++) {
+            triangle_scores[t] = vertex_scores[indices[t * 3]] +
+                                 vertex_scores[indices[t * 3 + 1]] +
+                                 vertex_scores[indices[t * 3 + 2]];
+            if (triangle_scores[t] > triangle_scores[best_triangle]) {
+                best_triangle = t;
+            }
+        }
+
+        // the cache after the emitted triangles, with room for the three
+        // vertices pushed in while the oldest are pushed out
+        uint32_t cache[VCACHE_SIZE + 3];
+        int cached = 0;
+        int next_unemitted = 0;
+
+        for (int emitted_count = 0; emitted_count < num_triangles; emitted_count++) {
+            if (best_triangle < 0) {
+                // nothing in the cache leads anywhere; start again from the
+                // first triangle left, which keeps the whole pass linear
+                while (emitted[next_unemitted]) {
+                    next_unemitted++;
+                }
+                best_triangle = next_unemitted;
+            }
+
+            const uint32_t *corners = &indices[best_triangle * 3];
+            memcpy(&order[emitted_count * 3], corners, 3 * sizeof(uint32_t));
+            emitted[best_triangle] = true;
+
+            // drop the triangle from the lists of its vertices
+            for (int j = 0; j < 3; j++) {
+                uint32_t v = corners[j];
+                int *list = &vertex_triangles[first_triangle[v]];
+                int count = triangles_left[v];
+                for (int k = 0; k < count; k++) {
+                    if (list[k] == best_triangle) {
+                        list[k] = list[count - 1];
+                        break;
+                    }
+                }
+                triangles_left[v]--;
+            }
+
+            // the triangle's vertices go to the front of the cache, in order
+            uint32_t new_cache[VCACHE_SIZE + 3];
+            int new_cached = 0;
+            for (int j = 0; j < 3; j++) {
+                bool seen = false;
+                for (int k = 0; k < new_cached; k++) {
+                    seen = seen || new_cache[k] == corners[j];
+                }
+                if (!seen) {
+                    new_cache[new_cached++] = corners[j];
+                }
+            }
+            for (int k = 0; k < cached; k++) {
+                uint32_t v = cache[k];
+                if (v != corners[0] && v != corners[1] && v != corners[2]) {
+                    new_cache[new_cached++] = v;
+                }
+            }
+
+            // rescore everything that was or is in the cache, and the
+            // triangles around it, picking the best of those to go next
+            for (int k = 0; k < new_cached; k++) {
+                uint32_t v = new_cache[k];
+                cache_positions[v] = k < VCACHE_SIZE ? k : -1;
+                vertex_scores[v] =
+                    vertex_score(&scores, cache_positions[v], triangles_left[v]);
+            }
+            best_triangle = -1;
+            float best_score = -1;
+            for (int k = 0; k < new_cached; k++) {
+                uint32_t v = new_cache[k];
+                const int *list = &vertex_triangles[first_triangle[v]];
+                for (int l = 0; l < triangles_left[v]; l++) {
+                    int t = list[l];
+                    const uint32_t *c = &indices[t * 3];
+                    triangle_scores[t] =
+                        vertex_scores[c[0]] + vertex_scores[c[1]] + vertex_scores[c[2]];
+                    if (triangle_scores[t] > best_score) {
+                        best_score = triangle_scores[t];
+                        best_triangle = t;
+                    }
+                }
+            }
+
+            cached = new_cached < VCACHE_SIZE ? new_cached : VCACHE_SIZE;
+            memcpy(cache, new_cache, cached * sizeof(uint32_t));
+        }
+    }
+
+    free(triangles_left);
+    free(first_triangle);
+    free(vertex_triangles);
+    free(cache_positions);
+    free(vertex_scores);
+    free(triangle_scores);
+    free(emitted);
+    return ok;
+}
+
+bool vcache_optimize(mesh_t *mesh) {
+    int num_vertices = array_length(mesh->vertex_buffer);
+    int num_triangles = array_length(mesh->index_buffer) / 3;
+    if (num_triangles == 0) {
+        return true;
+    }
+
+    uint32_t *order = malloc((size_t)num_triangles * 3 * sizeof(uint32_t));
+    uint32_t *local_indices = malloc((size_t)num_triangles * 3 * sizeof(uint32_t));
+    uint32_t *local_vertices = malloc((size_t)num_triangles * 3 * sizeof(uint32_t));
+    uint32_t *remap = malloc(num_vertices * sizeof(uint32_t));
+    bool ok = order && local_indices && local_vertices && remap;
+
+    // Meshlets are reordered one at a time, so they stay runs of the index
+    // buffer; the vertices of each are numbered from 0 for the pass
+    int num_meshlets = array_length(mesh->meshlets);
+    for (int m = 0; ok && m < (num_meshlets > 0 ? num_meshlets : 1); m++) {
+        int first = num_meshlets > 0 ? (int)mesh->meshlets[m].first_index : 0;
+        int count = num_meshlets > 0 ? (int)mesh->meshlets[m].num_triangles * 3
+                                     : num_triangles * 3;
+
+        int num_local = 0;
+        for (int i = 0; i < count; i++) {
+            uint32_t v = mesh_index(mesh, first + i);
+            remap[v] = UINT32_MAX;
+        }
+        for (int i = 0; i < count; i++) {
+            uint32_t v = mesh_index(mesh, first + i);
+            if (remap[v] == UINT32_MAX) {
+                local_vertices[num_local] = v;
+                remap[v] = num_local++;
+            }
+            local_indices[i] = remap[v];
+        }
+
+        ok = optimize_triangles(local_indices, count / 3, num_local, &order[first]);
+        for (int i = 0; ok && i < count; i++) {
+            order[first + i] = local_vertices[order[first + i]];
+        }
+    }
+
+    if (ok) {
+        // number the vertices in the order the triangles first reach them,
+        // so the transformed vertices are read roughly front to back too.
+        // The coarsest level of detail goes first: each level only uses
+        // vertices of the one before it, so every level then uses a prefix
+        // of the vertex buffer
+        for (int v = 0; v < num_vertices; v++) {
+            remap[v] = UINT32_MAX;
+        }
+        uint32_t next_vertex = 0;
+        int num_lods = array_length(mesh->lods);
+        for (int l = (num_lods > 0 ? num_lods : 1) - 1; l >= 0; l--) {
+            int first = num_lods > 0 ? (int)mesh->lods[l].first_index : 0;
+            int end = num_lods > 0 ? first + (int)mesh->lods[l].num_triangles * 3
+                                   : num_triangles * 3;
+            for (int i = first; i < end; i++) {
+                if (remap[order[i]] == UINT32_MAX) {
+                    remap[order[i]] = next_vertex++;
+                }
+            }
+            if (num_lods > 0) {
+                mesh->lods[l].num_vertices = next_vertex;
+            }
+        }
+        for (int v = 0; v < num_vertices; v++) {
+            if (remap[v] == UINT32_MAX) {
+                remap[v] = next_vertex++;
+            }
+        }
+
+        // the index buffer is only rewritten once the vertices have somewhere to go
+        mesh_vertex_t *vertices = array_hold(NULL, num_vertices, sizeof(mesh_vertex_t));
+        ok = vertices != NULL;
+        if (ok) {
+            for (int v = 0; v < num_vertices; v++) {
+                vertices[remap[v]] = mesh->vertex_buffer[v];
+            }
+            for (int i = 0; i < num_triangles * 3; i++) {
+                uint32_t index = remap[order[i]];
+                if (mesh->index_size == 2) {
+                    ((uint16_t *)mesh->index_buffer)[i] = (uint16_t)index;
+                } else {
+                    ((uint32_t *)mesh->index_buffer)[i] = index;
+                }
+            }
+            array_free(mesh->vertex_buffer);
+            mesh->vertex_buffer = vertices;
+        }
+    }
+
+    free(order);
+    free(local_indices);
+    free(local_vertices);
+    free(remap);
+    return ok;
+}
@@ -0,0 +1,24 @@
+#ifndef VCACHE_H
+#define VCACHE_H
+
+#include "mesh.h"
+#include <stdbool.h>
+
+// Vertices modelled as staying in the post-transform cache, least recently
+// used first out
+#define VCACHE_SIZE 32
+
+// Average cache misses per triangle of the mesh's full detail faces, drawn
+// through an LRU cache of cache_size vertices: 3 with no reuse at all, about 0.5 for
+// a large regular grid at best
+float vcache_acmr(const mesh_t *mesh, int cache_size);
+
+// Reorder the faces of the index buffer so vertices are reused while still
+// cached, using Tom Forsyth's linear-speed vertex cache optimization, then
+// renumber the vertex buffer in the order the faces first use it, coarsest
+// level of detail first. Faces are only reordered within their meshlet, if
+// the mesh has been split into them. Returns false if out of memory, leaving
+// the mesh as it was
+bool vcache_optimize(mesh_t *mesh);
+
+#endif
@@ -0,0 +1,162 @@
+#include "weld.h"
+#include "array.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WELD_OUT_OF_MEMORY UINT32_MAX
+
+// Open addressing table of vertex buffer slots, kept at most half full
+typedef struct {
+    int32_t *slots; // vertex index + 1, 0 for empty
+    uint32_t mask;
+} weld_table_t;
+
+static uint32_t hash_vertex(const mesh_vertex_t *vertex) {
+    uint32_t words[sizeof(mesh_vertex_t) / sizeof(uint32_t)];
+    memcpy(words, vertex, sizeof(words));
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+    // fold the high bits down, the table is indexed with the low ones
+    return hash ^ (hash >> 15);
+}
+
+// Index of the vertex equal to corner, adding it if there is none yet, or
+// WELD_OUT_OF_MEMORY if there was no room to
+static uint32_t weld_corner(weld_table_t *table, mesh_vertex_t **vertices,
+                            const mesh_vertex_t *corner) {
+    uint32_t slot = hash_vertex(corner) & table->mask;
+    while (table->slots[slot] != 0) {
+        uint32_t index = table->slots[slot] - 1;
+        if (memcmp(&(*vertices)[index], corner, sizeof(*corner)) == 0) {
+            return index;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+
+    uint32_t index = array_length(*vertices);
+    array_push(*vertices, *corner);
+    if (array_length(*vertices) == (int)index) {
+        return WELD_OUT_OF_MEMORY;
+    }
+    table->slots[slot] = index + 1;
+    return index;
+}
+
+bool weld_mesh(mesh_t *mesh) {
+    int num_positions = array_length(mesh->vertices);
+    // without any positions there is nothing for the faces to point at
+    int num_faces = num_positions > 0 ? array_length(mesh->faces) : 0;
+    int num_corners = num_faces * 3;
+
+    weld_table_t table;
+    uint32_t size = 16;
+    while (size < 2u * num_corners) {
+        size *= 2;
+    }
+    table.slots = calloc(size, sizeof(int32_t));
+    table.mask = size - 1;
+    uint32_t *indices = malloc((size_t)num_corners * sizeof(uint32_t) + 1);
+    if (!table.slots || !indices) {
+        free(table.slots);
+        free(indices);
+        return false;
+    }
+
+    mesh_vertex_t *vertices = NULL;
+    for (int i = 0; i < num_faces; i++) {
+        const face_t *face = &mesh->faces[i];
+        int corners[3] = {face->a, face->b, face->c};
+        tex2_t uvs[3] = {face->a_uv, face->b_uv, face->c_uv};
+
+        // OBJ indices were checked when parsing, but cube and hand-made
+        // faces were not; never index outside the positions
+        bool valid = true;
+        for (int j = 0; j < 3; j++) {
+            valid = valid && corners[j] >= 0 && corners[j] < num_positions;
+        }
+
+        for (int j = 0; j < 3; j++) {
+            mesh_vertex_t corner;
+            memset(&corner, 0, sizeof(corner)); // no stray padding in the key
+            corner.position = mesh->vertices[valid ? corners[j] : 0];
+            corner.uv = uvs[j];
+            corner.color = face->color;
+            indices[i * 3 + j] = weld_corner(&table, &vertices, &corner);
+            if (indices[i * 3 + j] == WELD_OUT_OF_MEMORY) {
+                free(table.slots);
+                free(indices);
+                array_free(vertices);
+                return false;
+            }
+        }
+    }
+    free(table.slots);
+
+    // narrow the indices when every vertex fits in 16 bits
+    int num_vertices = array_length(vertices);
+    int index_size = num_vertices <= UINT16_MAX + 1 ? 2 : 4;
+    void *index_buffer = array_hold(NULL, num_corners, index_size);
+    if (!index_buffer) {
+        free(indices);
+        array_free(vertices);
+        return false;
+    }
+    if (index_size == 2) {
+        uint16_t *narrow = index_buffer;
+        for (int i = 0; i < num_corners; i++) {
+            narrow[i] = (uint16_t)indices[i];
+        }
+    } else {
+        memcpy(index_buffer, indices, (size_t)num_corners * sizeof(uint32_t));
+    }
+    free(indices);
+
+    array_free(mesh->vertex_buffer);
+    array_free(mesh->index_buffer);
+    mesh->vertex_buffer = vertices;
+    mesh->index_buffer = index_buffer;
+    mesh->index_size = index_size;
+    return true;
+}
+
+int *weld_position_ids(const mesh_t *mesh, int *num_positions) {
+    int num_vertices = array_length(mesh->vertex_buffer);
+    uint32_t size = 16;
+    while (size < 2u * num_vertices) {
+        size *= 2;
+    }
+    int *slots = calloc(size, sizeof(int)); // vertex + 1 with the position
+    int *ids = malloc((num_vertices + 1) * sizeof(int));
+    if (!slots || !ids) {
+        free(slots);
+        free(ids);
+        return NULL;
+    }
+
+    *num_positions = 0;
+    for (int v = 0; v < num_vertices; v++) {
+        vec3_t position = mesh->vertex_buffer[v].position;
+        uint32_t words[3];
+        memcpy(words, &position, sizeof(words));
+        uint32_t hash = ((words[0] * 73856093u) ^ (words[1] * 19349663u) ^
+                         (words[2] * 83492791u));
+        uint32_t slot = (hash ^ (hash >> 16)) & (size - 1);
+        while (slots[slot] != 0 &&
+               memcmp(&mesh->vertex_buffer[slots[slot] - 1].position, &position,
+                      sizeof(position)) != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        if (slots[slot] == 0) {
+            slots[slot] = v + 1;
+            ids[v] = (*num_positions)++;
+        } else {
+            ids[v] = ids[slots[slot] - 1];
+        }
+    }
+    free(slots);
+    return ids;
+}
@@ -0,0 +1,17 @@
+#ifndef WELD_H
+#define WELD_H
+
+#include "mesh.h"
+#include <stdbool.h>
+
+// Build the mesh's vertex and index buffers from its faces, giving every
+// distinct (position, uv, color) corner a single vertex. Faces pointing at
+// missing vertices become degenerate triangles. Returns false if out of memory
+bool weld_mesh(mesh_t *mesh);
+
+// Number the distinct positions of the vertex buffer, so vertices either side
+// of a UV seam can be told to be the same point. Returns an array of the
+// position of each vertex, to be freed, or NULL if out of memory
+int *weld_position_ids(const mesh_t *mesh, int *num_positions);
+
+#endif